@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace kv {
+
+// v0.9: slab allocator for shard keys and values.
+//
+// Small blocks (<= kMaxSmall bytes) come from 256 KiB slabs, rounded up to a
+// size class (8-byte steps up to 128, then four classes per doubling) and
+// recycled through per-class free lists. Larger blocks (object chunks) are
+// allocated individually at their exact size. Callers free with the same size
+// they allocated, so no per-block header is needed.
+//
+// Not thread-safe: each shard owns one arena and uses it under its lock.
+class Arena {
+ public:
+  static constexpr std::size_t kMaxSmall = 4096;
+  static constexpr std::size_t kSlabBytes = 256 * 1024;
+
+  Arena() = default;
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(std::size_t n);
+  void deallocate(void* p, std::size_t n);
+
+  // Size actually reserved for an n-byte request; two sizes with the same
+  // rounded size can reuse each other's block.
+  static std::size_t rounded_size(std::size_t n);
+
+  // Drop every block at once.
+  void reset();
+
+  std::size_t bytes_reserved() const { return slab_bytes_ + large_bytes_; }
+  std::size_t bytes_in_use() const { return in_use_bytes_; }
+
+ private:
+  static constexpr std::size_t kNumClasses = 36;
+
+  static std::size_t class_index(std::size_t n);
+  static std::size_t class_size(std::size_t idx);
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  FreeBlock* free_[kNumClasses] = {};
+  std::vector<std::unique_ptr<char[]>> slabs_;
+  char* bump_ = nullptr;
+  std::size_t bump_left_ = 0;
+
+  std::size_t slab_bytes_ = 0;
+  std::size_t large_bytes_ = 0;
+  std::size_t in_use_bytes_ = 0;
+};
+
+}  // namespace kv
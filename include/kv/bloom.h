@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kv {
+
+// v0.9: bloom filter stored in every SSTable.
+//
+// Filter bytes are followed by one byte holding the probe count, so readers
+// need no side information. Probes use double hashing over a 64-bit hash of
+// the key that is fixed by the file format (not std::hash).
+class BloomBuilder {
+ public:
+  explicit BloomBuilder(int bits_per_key) : bits_per_key_(bits_per_key) {}
+
+  void add(std::string_view key) { hashes_.push_back(hash(key)); }
+  std::string finish() const;
+
+  static uint64_t hash(std::string_view key);
+
+ private:
+  int bits_per_key_;
+  std::vector<uint64_t> hashes_;
+};
+
+// False means the key is definitely absent; `filter` is BloomBuilder output.
+bool bloom_may_contain(std::string_view filter, std::string_view key);
+
+}  // namespace kv
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace kv {
+
+// v0.9: in-tree LZ4 block codec (the LZ4 block format, no frame or
+// dictionary; one hash probe per position, like LZ4's fast mode). Used for
+// WAL batch payloads and snapshot file blocks when Options::compression is
+// kLz4.
+//
+// Appends the compressed form of `in` to `out`. Returns false, leaving `out`
+// as it was, when that would not save at least an eighth of the input.
+bool lz4_compress(std::string_view in, std::string& out);
+// Appends the `raw_len` bytes that `in` decodes to. False (and `out` as it
+// was) on a malformed block or one that does not decode to exactly raw_len.
+bool lz4_decompress(std::string_view in, std::size_t raw_len, std::string& out);
+
+}  // namespace kv
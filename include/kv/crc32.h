@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kv {
+
+// IEEE CRC-32 (reflected, polynomial 0xEDB88320). Shared by SSTable blocks
+// and value log records; pass the previous result to continue a running
+// checksum.
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, std::size_t n);
+
+// v0.9: CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), used by WAL
+// format v2. Chains like crc32_update. Uses the SSE4.2 crc32 instruction
+// (three interleaved streams joined with PCLMUL on long buffers) when the
+// CPU has it, slice-by-8 tables otherwise; picked once, on first use.
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, std::size_t n);
+
+}  // namespace kv
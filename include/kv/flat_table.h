@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#include "kv/arena.h"
+
+namespace kv {
+
+// Sequence number meaning "newest version" / "no snapshot is live".
+inline constexpr uint64_t kMaxSeq = std::numeric_limits<uint64_t>::max();
+
+// v0.9 MVCC: one version of a key's value, newest first. `seq` is the
+// sequence number of the write that produced it; `prev` points at the next
+// older version, kept only while some snapshot may still read it.
+// With kExpires the value bytes are followed by a u64 expiry time (unix ms).
+struct ValueRec {
+  static constexpr uint32_t kTombstone = 1;
+  static constexpr uint32_t kValueRef = 2;  // bytes are an encoded ValuePointer
+  static constexpr uint32_t kExpires = 4;
+
+  uint64_t seq;
+  ValueRec* prev;
+  uint32_t len;
+  uint32_t flags;
+
+  bool tombstone() const { return (flags & kTombstone) != 0; }
+  bool value_ref() const { return (flags & kValueRef) != 0; }
+  bool expires() const { return (flags & kExpires) != 0; }
+  uint64_t expires_at() const {
+    uint64_t t = 0;
+    if (expires()) std::memcpy(&t, data() + len, sizeof(t));
+    return t;
+  }
+  bool expired(uint64_t now_ms) const { return expires() && expires_at() <= now_ms; }
+  // Allocation size of this record.
+  std::size_t bytes() const { return sizeof(ValueRec) + len + (expires() ? sizeof(uint64_t) : 0); }
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  std::string_view view() const { return {data(), len}; }
+};
+
+// Arena-resident key followed by its bytes. A key record never moves while
+// its entry lives, so pointers to it stay valid (the ordered index holds
+// them) and reach the version chain without another hash probe.
+struct KeyRec {
+  static constexpr uint32_t kVersioned = 1;  // listed for snapshot reclaim
+
+  ValueRec* head;
+  uint32_t len;
+  uint32_t flags;
+
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  std::string_view view() const { return {data(), len}; }
+};
+
+// Newest version of `k` visible at sequence number `at`, or nullptr if the key
+// did not exist (or was deleted) as of `at`.
+inline const ValueRec* visible_at(const KeyRec* k, uint64_t at) {
+  for (const ValueRec* v = k->head; v != nullptr; v = v->prev) {
+    if (v->seq <= at) return v->tombstone() ? nullptr : v;
+  }
+  return nullptr;
+}
+
+// Newest version of `k` with seq <= at, tombstones included (nullptr if none).
+inline const ValueRec* version_at(const KeyRec* k, uint64_t at) {
+  for (const ValueRec* v = k->head; v != nullptr; v = v->prev) {
+    if (v->seq <= at) return v;
+  }
+  return nullptr;
+}
+
+// v0.9: open-addressing hash table for one shard (SwissTable layout).
+//
+// One control byte per slot holds either a state (empty / deleted) or the low
+// 7 bits of the key hash. Lookups load a whole group of control bytes at once
+// (16 with SSE2, 8 with a portable SWAR fallback) and only dereference slots
+// whose 7-bit tag matches. A slot is one pointer to the arena-resident key,
+// which in turn points at the newest value version.
+//
+// Hashes are supplied by the caller (the store hashes once to pick the shard
+// and reuses the value here). Not thread-safe; guarded by the shard lock.
+class FlatTable {
+ public:
+  FlatTable() = default;
+  ~FlatTable();
+
+  FlatTable(const FlatTable&) = delete;
+  FlatTable& operator=(const FlatTable&) = delete;
+
+  // The hash every caller must use (the table rehashes with it on growth).
+  static uint64_t hash(std::string_view key);
+
+  KeyRec* find(std::string_view key, uint64_t hash) const;
+
+  // Entry for `key`, inserted with no versions (head == nullptr) if absent.
+  std::pair<KeyRec*, bool> find_or_insert(std::string_view key, uint64_t hash);
+
+  // Remove the entry and free its key and every version.
+  bool erase(std::string_view key, uint64_t hash);
+
+  // Make a new head version with ValueRec `flags`. With keep_head the current
+  // head stays reachable for snapshots; otherwise it is replaced (in place
+  // when the size class allows) and only its older versions are kept.
+  // A non-zero expires_at (unix ms) adds ValueRec::kExpires.
+  void push_version(KeyRec* k, std::string_view value, uint64_t seq,
+                    uint32_t flags, bool keep_head, uint64_t expires_at = 0);
+
+  // Free versions no snapshot at or after `oldest` can read: everything older
+  // than the newest version with seq <= oldest. kMaxSeq keeps only the head.
+  void prune(KeyRec* k, uint64_t oldest);
+
+  void clear();
+
+  // Grow so that n entries fit without rehashing.
+  void reserve(std::size_t n);
+
+  // Pull the control group a lookup for `hash` starts at into cache.
+  void prefetch(uint64_t hash) const;
+
+  std::size_t size() const { return size_; }
+  std::size_t capacity() const { return capacity_; }
+
+  // Control bytes + slot array + arena slabs and large blocks.
+  std::size_t memory_bytes() const;
+
+  // fn(const KeyRec*) for every entry, in table order.
+  template <class Fn>
+  void for_each(Fn&& fn) const {
+    for (std::size_t i = 0; i < capacity_; ++i) {
+      if (ctrl_[i] >= 0) fn(static_cast<const KeyRec*>(slots_[i]));
+    }
+  }
+
+ private:
+  static constexpr int8_t kEmpty = -128;
+  static constexpr int8_t kDeleted = -2;
+
+  static uint64_t h1(uint64_t hash) { return hash >> 7; }
+  static int8_t h2(uint64_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+
+  // Slot index of `key`, or capacity_ when absent.
+  std::size_t find_index(std::string_view key, uint64_t hash) const;
+  std::size_t find_insert_slot(uint64_t hash) const;
+  void set_ctrl(std::size_t i, int8_t c);
+  void rehash(std::size_t new_capacity);
+
+  KeyRec* make_key(std::string_view key);
+  ValueRec* make_value(std::string_view value, uint64_t seq, uint32_t flags,
+                       uint64_t expires_at);
+  static void set_value(ValueRec* v, std::string_view value, uint64_t expires_at);
+  void free_key(KeyRec* k);
+  void free_value(ValueRec* v);
+  void free_chain(ValueRec* v);
+  // Only blocks above Arena::kMaxSmall outlive arena_.reset().
+  void free_large(KeyRec* k);
+
+  std::unique_ptr<int8_t[]> ctrl_;  // capacity_ + group width (cloned head)
+  std::unique_ptr<KeyRec*[]> slots_;
+  std::size_t capacity_ = 0;        // power of two, or 0
+  std::size_t size_ = 0;
+  std::size_t growth_left_ = 0;     // inserts before the 7/8 load limit
+  Arena arena_;
+};
+
+}  // namespace kv
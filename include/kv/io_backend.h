@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#include "kv/options.h"
+
+namespace kv {
+
+// v0.9: positional file writes for the WAL writer and snapshot saves.
+//
+// SyncIo calls pwrite/fdatasync directly. UringIo (Linux) goes through an
+// io_uring: a write and the fdatasync behind it are submitted as one linked
+// pair, queued writes stay in flight together, and writes from a registered
+// buffer use WRITE_FIXED, skipping the per-I/O page pinning. An instance is
+// not thread-safe; every user owns its own.
+class IoBackend {
+ public:
+  using Kind = Options::IoBackendKind;
+  static constexpr unsigned kBufferSlots = 4;
+
+  virtual ~IoBackend() = default;
+
+  // kIoUring falls back to synchronous I/O (noted once on stderr) where the
+  // kernel has no io_uring or refuses to set one up.
+  static std::unique_ptr<IoBackend> create(Kind kind);
+
+  virtual const char* name() const = 0;
+
+  // Write all `n` bytes at `off`, then fdatasync; true once both are done.
+  virtual bool write_sync(int fd, const void* buf, std::size_t n, uint64_t off) = 0;
+  // The two halves on their own.
+  virtual bool write(int fd, const void* buf, std::size_t n, uint64_t off) = 0;
+  virtual bool sync(int fd) = 0;
+  // Start writeback of [off, off + n) without waiting for it or for the
+  // device cache (sync_file_range where available, else nothing): the data
+  // is not durable until a later sync().
+  virtual void start_writeback(int fd, uint64_t off, std::size_t n);
+
+  // Queue a write of `n` bytes at `off`. `buf` must stay unchanged until
+  // wait_writes() has retired it; writes retire oldest first.
+  virtual bool submit_write(int fd, const void* buf, std::size_t n, uint64_t off) = 0;
+  // Wait until at most `max_in_flight` queued writes are not yet retired.
+  // False if any write so far failed.
+  virtual bool wait_writes(std::size_t max_in_flight) = 0;
+
+  // [base, base + len) will back later writes (an append arena, a staging
+  // buffer); the backend may pin it. Registering a slot again replaces it,
+  // len 0 clears it. Only call with no queued writes.
+  virtual void register_buffer(unsigned slot, const void* base, std::size_t len) {
+    (void)slot;
+    (void)base;
+    (void)len;
+  }
+};
+
+// Buffered sequential file writer over an IoBackend, used as the streambuf
+// of a std::ostream for snapshot saves. kDepth buffers rotate, so with
+// io_uring the filled ones are written while the next one fills.
+class IoFileBuf : public std::streambuf {
+ public:
+  static constexpr std::size_t kBufferBytes = std::size_t{1} << 20;
+  static constexpr std::size_t kDepth = 4;
+  // Writeback of written data is started every this many bytes, so the
+  // final fdatasync does not flush the whole file at once.
+  static constexpr std::size_t kWritebackBytes = std::size_t{8} << 20;
+
+  explicit IoFileBuf(IoBackend::Kind kind);
+  ~IoFileBuf() override;
+
+  IoFileBuf(const IoFileBuf&) = delete;
+  IoFileBuf& operator=(const IoFileBuf&) = delete;
+
+  // Creates or truncates `path`.
+  bool open(const std::string& path);
+  // Write out what is buffered, fdatasync and close. False on any error.
+  bool finish();
+
+ protected:
+  int_type overflow(int_type ch) override;
+
+ private:
+  bool submit_current();
+
+  std::unique_ptr<IoBackend> io_;
+  std::unique_ptr<char[]> bufs_;  // kDepth * kBufferBytes
+  std::size_t current_ = 0;       // buffer being filled
+  int fd_ = -1;
+  uint64_t offset_ = 0;
+  uint64_t written_back_ = 0;  // writeback started below this offset
+  bool ok_ = true;
+};
+
+}  // namespace kv
@@ -1,79 +1,564 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <optional>
+#include <mutex>
+#include <set>
 #include <shared_mutex>
+#include <span>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <cstdint>
 #include <iostream>
 
+#include "kv/flat_table.h"
+#include "kv/lsm_tree.h"
+#include "kv/memtable.h"
+#include "kv/options.h"
+#include "kv/snapshot_image.h"
+#include "kv/timing_wheel.h"
+#include "kv/value_log.h"
 #include "kv/wal.h"
+#include "kv/write_batch.h"
 #include "kv/raft_sm.h"
 
 namespace kv {
 
+// v0.9: pinned, zero-copy view of a stored value. The handle holds the
+// owning shard's shared lock, so view() stays valid until the handle is
+// reset or destroyed; writers to that shard wait meanwhile, so keep it short.
+// Values read from SSTables or the value log are copied into the handle
+// instead, and no lock is held. Values served from a mapped snapshot image
+// point into the mapping, which lives as long as the store; no lock either.
+class ValueHandle {
+ public:
+  ValueHandle() = default;
+
+  explicit operator bool() const { return found_; }
+  std::string_view view() const { return view_; }
+  std::string_view operator*() const { return view_; }
+
+  // Release the pin early.
+  void reset() {
+    found_ = false;
+    view_ = {};
+    if (lock_.owns_lock()) lock_.unlock();
+    owned_.reset();
+  }
+
+ private:
+  friend class KVStore;
+  std::shared_lock<std::shared_mutex> lock_;
+  std::unique_ptr<std::string> owned_;
+  std::string_view view_;
+  bool found_ = false;
+};
+
+// v0.9 MVCC: consistent read view pinned at a sequence number. Reads through
+// it see every write sequenced at or before seq() and none after, while
+// writers carry on. Older versions stay in memory until the last SnapshotPtr
+// referring to them is dropped, so release it once the scan is done. Must not
+// outlive the store.
+class Snapshot {
+ public:
+  uint64_t seq() const { return seq_; }
+
+ private:
+  friend class KVStore;
+  explicit Snapshot(uint64_t seq) : seq_(seq) {}
+  uint64_t seq_;
+};
+
+using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
 class KVStore : public IRaftStateMachine{
 public:
+  static constexpr std::size_t kDefaultShardCount = 16;
+
+  // v0.9: keys hash to `num_shards` independently locked shards.
+  explicit KVStore(std::size_t num_shards = kDefaultShardCount);
+
+  ~KVStore() override;
+
   // v0.2: must be called before PUT/DEL for WAL + recovery
   bool open(const std::string& wal_path);
+  // v0.9: pick the storage engine (Options::Engine::kLsm keeps the dataset
+  // in SSTables under options.lsm_dir, with the shard tables as memtables)
+  // and the value log settings.
+  bool open(const std::string& wal_path, const Options& options);
 
-  void put(std::string key, std::string value);
-  std::optional<std::string> get(const std::string& key) const;
-  bool del(const std::string& key);
+  // v0.9: `durability` overrides the store's mode for this write.
+  void put(std::string key, std::string value, Durability durability = Durability::kDefault);
+  // v0.9 TTL: the key reads as absent once `ttl` (at least 1 ms) has passed
+  // and is then removed by the expiry thread with a logged Expire record.
+  // The deadline is wall-clock time and survives restarts.
+  void put(std::string key, std::string value, std::chrono::milliseconds ttl,
+           Durability durability = Durability::kDefault);
+  std::optional<std::string> get(std::string_view key) const;
+  bool del(std::string_view key, Durability durability = Durability::kDefault);
+  // In-memory engine: keys past their TTL count until the expiry thread
+  // removes them (within a wheel tick). With a mapped snapshot image this
+  // walks the keys written since open().
   std::size_t size() const;
 
+  // v0.9: apply every operation in `batch` atomically. One WAL record (one
+  // CRC) and one acquisition of each touched shard lock per batch; readers
+  // see either none or all of it.
+  bool write(const WriteBatch& batch, Durability durability = Durability::kDefault);
+
+  // v0.9 zero-copy reads. All lookups take std::string_view keys, so callers
+  // holding string_views or literals never build a temporary std::string.
+  bool contains(std::string_view key) const;
+  ValueHandle get_view(std::string_view key) const;
+  // Copy into `out`, reusing its capacity across calls. False if absent.
+  bool get_into(std::string_view key, std::string& out) const;
+  // Call fn(std::string_view value) under the shard's shared lock (values
+  // from SSTables or the value log: on a copy, without the lock). fn must not
+  // write to the store. Returns false (fn not called) if absent.
+  template <class Fn>
+  bool read(std::string_view key, Fn&& fn) const {
+    const uint64_t h = hash_key(key);
+    const Shard& shard = shard_at(h);
+    {
+      std::shared_lock lock(shard.mu);
+      const ValueRec* v = memtable_version(shard, key, h, kMaxSeq);
+      if (v != nullptr && !v->value_ref()) {
+        if (dead(v)) return false;
+        fn(v->view());
+        return true;
+      }
+      if (v == nullptr && tree_ == nullptr) {
+        // Served in place from the mapped snapshot image, if any.
+        SnapshotImage::Entry e;
+        if (!image_get(key, h, &e)) return false;
+        if (!e.value_ref) {
+          fn(e.value);
+          return true;
+        }
+      }
+    }
+    std::string value;
+    if (!get_copy(key, h, kMaxSeq, value)) return false;
+    fn(std::string_view(value));
+    return true;
+  }
+
+  // v0.9 batched point lookups. Keys are sorted by shard, each touched shard
+  // is locked (shared) once, and the table groups for that shard's keys are
+  // prefetched before any of them is probed. result[i] belongs to keys[i].
+  std::vector<std::optional<std::string>>
+  multi_get(std::span<const std::string_view> keys) const;
+
+  // Zero-copy form of multi_get: fn(i, std::string_view value) for every
+  // keys[i] that exists, called under the owning shard's lock in shard order
+  // (not input order); keys found only in SSTables come last, unlocked.
+  // Value-log values are copies. fn must not write to the store.
+  template <class Fn>
+  void multi_read(std::span<const std::string_view> keys, Fn&& fn) const {
+    multi_read_at(keys, kMaxSeq, fn);
+  }
+  std::size_t shard_count() const { return shards_.size(); }
+
+  // v0.9 MVCC snapshot reads. Taking a snapshot is one short critical
+  // section on the sequencing lock; reads through it lock shards as usual.
+  SnapshotPtr snapshot() const;
+  std::optional<std::string> get(std::string_view key, const Snapshot& snap) const;
+  std::vector<std::optional<std::string>>
+  multi_get(std::span<const std::string_view> keys, const Snapshot& snap) const;
+  std::vector<std::string>
+  list_keys_with_prefix(const std::string& prefix, const Snapshot& snap) const;
+  // fn(key, value) for every key in [begin, end) visible in `snap` (empty
+  // `end` = unbounded), shard by shard and in key order within a shard (LSM
+  // engine: in global key order). Shard locks are held for at most
+  // kScanBatch index entries at a time and never while fn runs, so writers
+  // keep going and fn may itself write.
+  void scan(const Snapshot& snap, std::string_view begin, std::string_view end,
+            const std::function<void(std::string_view, std::string_view)>& fn) const;
+
   bool save_to_file(const std::string& path) const;
   bool load_from_file(const std::string& path);
 
-  bool save_snapshot(const std::string& path);  
+  // Snapshot files (v0.9: binary, kv/snapshot_file.h, or images with
+  // Options::snapshot_image; text snapshots of older builds still load).
+  // Loading replaces/extends the shard tables and is only supported by the
+  // in-memory engine, and not while a snapshot image is mapped.
+  bool save_snapshot(const std::string& path);
   bool load_snapshot(const std::string& path);
+  // v0.9: the WAL MANIFEST records snapshot_path and the seq it covers;
+  // open() loads that snapshot (maps it, if an image) and replays only the
+  // WAL after it. A store serving a mapped image keeps serving it: the new
+  // checkpoint is used from the next open().
+  // LSM engine: the SSTables are the checkpoint, so this flushes the
+  // memtables (and their WAL) instead of writing snapshot_path.
   bool checkpoint(const std::string& snapshot_path,
                 const std::string& wal_path);
-  
+  // v0.9: queue checkpoint(snapshot_path) on the background thread and
+  // return at once (the LSM engine requests a memtable flush). A request
+  // made while another is queued but not started is merged into it. False
+  // if not open.
+  bool checkpoint_async(const std::string& snapshot_path);
+  // Wait for every checkpoint queued so far; false if the last one failed.
+  bool wait_checkpoint();
+  // Sequence number covered by the last completed checkpoint (0: none).
+  uint64_t checkpoint_seq() const { return checkpoint_seq_.load(); }
+
   bool flush_wal();
 
-  // v0.7 prefix scan API
+  // v0.9 WAL log cleaning (in-memory engine): rewrite the sealed WAL
+  // segments keeping only the record that decides each key's current state,
+  // without writing a snapshot. Runs in the background once
+  // Options::wal_compact_bytes of sealed log has built up; writers are not
+  // blocked. False on error or in the LSM engine.
+  bool compact_wal();
+  // Bytes of WAL records the store currently keeps.
+  uint64_t wal_bytes() { return wal_.log_bytes(); }
+
+  // v0.9 value log: relocate the live values of the first sealed value log
+  // file that is at least `min_garbage` garbage (by bytes) and delete it
+  // once no snapshot can still read through it. Returns bytes of value log
+  // files deleted by this call (including ones deferred by earlier calls).
+  uint64_t gc_value_log(double min_garbage = 0.5);
+
+  // v0.9 LSM engine: write the memtables to a level-0 SSTable now and drop
+  // the WAL they came from. Returns false in the in-memory engine.
+  bool flush_memtable();
+
+  // v0.7 prefix scan API (v0.9: served from the ordered index, sorted, and
+  // read through an implicit snapshot so long scans do not stall writers)
   std::vector<std::string>
   list_keys_with_prefix(const std::string& prefix) const;
 
+  // Sorted keys in [begin, end); empty `end` = unbounded, limit 0 = no limit.
+  std::vector<std::string>
+  list_keys_in_range(const std::string& begin, const std::string& end,
+                     std::size_t limit = 0) const;
 
+
+  // v0.9 group commit: a write returns once every record but the newest
+  // n-1 is durable (default 1: acknowledged writes are durable). The WAL
+  // writer thread batches concurrent writers into one fsync; waiting never
+  // holds a lock. Shorthand for Durability::kCount (kSync for n <= 1).
   void set_group_commit_every(int n) ;
+  // v0.9: switch the store's durability mode; takes durability,
+  // wal_sync_every, wal_sync_interval_ms and async_flush from `options`.
+  void set_durability(const Options& options);
 
-  // Raft state machine apply (must NOT append to WAL)
+  // Raft state machine apply. Logged like put()/del() (large values to the
+  // value log) but without waiting for durability, which the Raft log
+  // provides; log cleaning needs every version in the WAL.
   void ApplyPut(std::string key, std::string value) override;
   void ApplyDel(const std::string& key) override;
 
 private:
   friend class Wal;
-  bool load_from_file_unlocked(const std::string& path);
-  bool save_to_file_unlocked(const std::string& path) const;
-  int group_commit_every_ = 5;
 
-  
+  // Index entries visited per shard lock acquisition during a scan.
+  static constexpr std::size_t kScanBatch = 256;
+
+  // One lock stripe. Aligned so neighbouring shard locks do not share a
+  // cache line. In the LSM engine `imm` is the frozen memtable being flushed;
+  // it is never modified, and reads check it after `mem`.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mu;
+    std::unique_ptr<Memtable> mem = std::make_unique<Memtable>();
+    std::shared_ptr<const Memtable> imm;
+  };
 
-  // Used ONLY during WAL replay to avoid re-logging.
-  void apply_put_no_log(std::string key, std::string value) {
-    map_[std::move(key)] = std::move(value);
+  // Tombstones and versions past their TTL read as absent. The clock is
+  // only consulted for versions that carry a deadline.
+  static bool dead(const ValueRec* v) {
+    return v->tombstone() || (v->expires() && v->expired(TimingWheel::now_ms()));
   }
-  void apply_del_no_log(const std::string& key) {
-    map_.erase(key);
+
+  // Newest version of `key` at `at` in the shard's memtables, tombstones
+  // included. nullptr means absent in the in-memory engine ("ask the
+  // snapshot image" if one is mapped) and "ask the SSTables" in the LSM
+  // engine. Caller holds shard.mu.
+  static const ValueRec* memtable_version(const Shard& shard, std::string_view key,
+                                          uint64_t hash, uint64_t at) {
+    if (const KeyRec* k = shard.mem->find(key, hash)) {
+      if (const ValueRec* v = version_at(k, at)) return v;
+    }
+    if (shard.imm != nullptr) {
+      if (const KeyRec* k = shard.imm->find(key, hash)) return version_at(k, at);
+    }
+    return nullptr;
   }
 
-  // Used ONLY during KVStore::open() while holding mu_.
-  void apply_put_no_log_unlocked(std::string key, std::string value) {
-    std::cerr << "[apply] PUT " << key << "=" << value << "\n";
-    map_[std::move(key)] = std::move(value);
+  // Copying lookup for what the lock-held fast paths cannot serve: value
+  // log pointers and (LSM engine) keys the memtables do not decide.
+  bool get_copy(std::string_view key, uint64_t hash, uint64_t at, std::string& out) const;
+  // Read the value an encoded ValuePointer refers to.
+  bool read_value_log(std::string_view key, std::string_view encoded, std::string& out) const;
+
+  template <class Fn>
+  void multi_read_at(std::span<const std::string_view> keys, uint64_t at, Fn&& fn) const {
+    const auto plan = plan_lookups(keys);
+    std::vector<const LookupPlan*> misses;  // LSM: keys left to the SSTables
+    std::string value;
+    for (std::size_t begin = 0; begin < plan.size(); ) {
+      const Shard& shard = shards_[plan[begin].shard];
+      std::size_t end = begin;
+      while (end < plan.size() && plan[end].shard == plan[begin].shard) ++end;
+
+      std::shared_lock lock(shard.mu);
+      for (std::size_t i = begin; i < end; ++i) shard.mem->prefetch(plan[i].hash);
+      for (std::size_t i = begin; i < end; ++i) {
+        const std::size_t idx = plan[i].index;
+        const ValueRec* v = memtable_version(shard, keys[idx], plan[i].hash, at);
+        if (v == nullptr) {
+          SnapshotImage::Entry e;
+          if (tree_ != nullptr) {
+            misses.push_back(&plan[i]);
+          } else if (image_get(keys[idx], plan[i].hash, &e)) {
+            if (!e.value_ref) {
+              fn(idx, e.value);
+            } else if (read_value_log(keys[idx], e.value, value)) {
+              fn(idx, std::string_view(value));
+            }
+          }
+        } else if (dead(v)) {
+          continue;
+        } else if (!v->value_ref()) {
+          fn(idx, v->view());
+        } else if (read_value_log(keys[idx], v->view(), value)) {
+          // Under the shard lock, so the record cannot be collected meanwhile.
+          fn(idx, std::string_view(value));
+        }
+      }
+      begin = end;
+    }
+
+    for (const LookupPlan* p : misses) {
+      if (get_copy(keys[p->index], p->hash, at, value)) fn(p->index, std::string_view(value));
+    }
+  }
+
+  // What scans hand to their callback as the value: nothing, the value
+  // itself, or the stored bytes (value-log pointers left encoded, flagged by
+  // fn's third argument) for snapshot files. expires_at is the TTL deadline
+  // (unix ms, 0 for none); it is only filled in for kStored.
+  enum class ScanValues { kNone, kResolved, kStored };
+  using ScanFn = std::function<bool(std::string_view key, std::string_view value, bool value_ref,
+                                    uint64_t expires_at)>;
+
+  // Visit [begin, end) of one shard as of `at` in kScanBatch-sized steps,
+  // copying entries out under the shared lock and calling fn outside it. fn
+  // returns false to stop; so does this.
+  bool scan_shard(const Shard& shard, uint64_t at, std::string_view begin,
+                  std::string_view end, ScanValues values, const ScanFn& fn) const;
+  // Same contract over the whole LSM store, in global key order. kStored
+  // resolves pointers like kResolved (LSM stores write no snapshot files).
+  bool scan_lsm(uint64_t at, std::string_view begin, std::string_view end, ScanValues values,
+                const ScanFn& fn) const;
+  // Engine-independent form used by scan() and the key listings.
+  bool scan_all(uint64_t at, std::string_view begin, std::string_view end, ScanValues values,
+                const ScanFn& fn) const;
+
+  // Caller holds wal_mu_.
+  SnapshotBounds snapshot_bounds_locked() const;
+  SnapshotPtr snapshot_locked() const;
+  void release_snapshot(uint64_t seq) const;
+
+  // One hash per key: the upper half picks the shard, the table probes with
+  // the lower bits.
+  static uint64_t hash_key(std::string_view key) { return FlatTable::hash(key); }
+  // Tags saved images with the hash_key() in use (it depends on the
+  // standard library); never 0, the id of images without one.
+  static uint64_t hash_id() { return hash_key("kv/hash_key") | 1; }
+  struct LookupPlan {
+    uint64_t hash;
+    std::size_t shard;
+    std::size_t index;  // position in the caller's key span
+  };
+  // Hash every key and sort by (shard, hash) so each shard is visited once.
+  std::vector<LookupPlan> plan_lookups(std::span<const std::string_view> keys) const;
+
+  std::size_t shard_index(uint64_t hash) const { return (hash >> 32) % shards_.size(); }
+  Shard& shard_at(uint64_t hash) { return shards_[shard_index(hash)]; }
+  const Shard& shard_at(uint64_t hash) const { return shards_[shard_index(hash)]; }
+
+  // Lock every shard in index order (the only order used for multi-shard
+  // locking, so it cannot deadlock against single-shard writers).
+  std::vector<std::unique_lock<std::shared_mutex>> lock_all_shards() const;
+
+  // Load the snapshot the WAL MANIFEST records (open()); `seq` is the one
+  // it covers, 0 without one. False if a recorded snapshot cannot be loaded.
+  bool load_checkpoint_unlocked(uint64_t& seq);
+  // `seq`: the snapshot's sequence number (0 for a text snapshot).
+  // map_image: serve a snapshot image in place (open() only) rather than
+  // copying it into the shard tables. replace: clear the shard tables once
+  // the file has been checked, so a damaged file leaves them as they were.
+  bool load_from_file_unlocked(const std::string& path, uint64_t* seq = nullptr,
+                               bool map_image = false, bool replace = false);
+  // `image` is open; `started` is when loading began, for the log line.
+  bool load_image_unlocked(std::unique_ptr<SnapshotImage> image, const std::string& path,
+                           std::chrono::steady_clock::time_point started, uint64_t* seq,
+                           bool map_image, bool replace);
+  bool load_text_snapshot_unlocked(const std::string& path);
+  bool save_to_file_unlocked(const std::string& path, const Snapshot& snap) const;
+  // Durability mode and its knobs, guarded by wal_mu_.
+  Durability durability_ = Durability::kSync;
+  uint64_t sync_every_ = 1;
+  std::chrono::microseconds sync_interval_{10000};
+  bool async_writeback_ = false;
+
+  // Right after a write's WAL append, under wal_mu_: returns the LSN the
+  // write has to wait for (0: none), or tells the WAL writer by when the
+  // record must be synced.
+  uint64_t commit_target_locked(Durability durability);
+  void set_durability_locked(const Options& options);
+  // Wait, holding no lock, until the WAL is durable up to `lsn`.
+  bool wait_for_log(uint64_t lsn) { return lsn == 0 || wal_.wait_durable(lsn); }
+
+  // Used ONLY during KVStore::open() / WAL replay while every shard is
+  // locked, to avoid re-logging. No snapshot can be live at that point.
+  // flags: 0 or ValueRec::kValueRef; a non-zero expires_at schedules expiry.
+  void apply_put_no_log_unlocked(std::string_view key, std::string_view value,
+                                 uint64_t seq, uint32_t flags = 0,
+                                 uint64_t expires_at = 0) {
+    const uint64_t h = hash_key(key);
+    shard_at(h).mem->put(key, h, value, seq, SnapshotBounds{}, flags, expires_at);
+    if (expires_at != 0) schedule_expiry(key, expires_at);
   }
-  void apply_del_no_log_unlocked(const std::string& key) {
-    map_.erase(key);
+  void apply_del_no_log_unlocked(std::string_view key, uint64_t seq) {
+    const uint64_t h = hash_key(key);
+    shard_at(h).mem->erase(key, h, seq, SnapshotBounds{});
   }
 
-  mutable std::shared_mutex mu_;
-  std::unordered_map<std::string, std::string> map_;
+  std::vector<Shard> shards_;
 
+  // Sequencing step: seq_ assignment and the WAL append happen under wal_mu_,
+  // and a writer takes its shard lock before releasing it. WAL order therefore
+  // matches apply order for every key while map updates on different shards
+  // run in parallel. Lock order: wal_mu_ -> shard locks (ascending index).
+  mutable std::mutex wal_mu_;
   Wal wal_;
   uint64_t seq_{0};
   bool opened_{false};
 
+  // Live snapshot sequence numbers. Changed only under wal_mu_, so every
+  // writer sees exactly the snapshots sequenced before it.
+  mutable std::multiset<uint64_t> snapshots_;
+  // Oldest live snapshot (kMaxSeq if none), read by reclaim under shard locks.
+  mutable std::atomic<uint64_t> reclaim_floor_{kMaxSeq};
+
+  // ---- v0.9 LSM engine (tree_ == nullptr in the in-memory engine) ----
+
+  // Freeze every shard's memtable and rotate the WAL at one sequence number,
+  // write the frozen memtables to a level-0 table, then drop them and the
+  // rotated log. Serialized by flush_mu_.
+  bool flush_memtables();
+  // Called by writers after applying: request a flush once a shard's
+  // memtable outgrows its share of Options::memtable_bytes, and stall while
+  // it is over twice that and the previous flush has not finished.
+  void note_memtable_size(std::size_t bytes);
+  // Runs requested flushes and then compactions until none is needed.
+  void background_loop();
+  // In-memory engine: runs queued checkpoints, and polls the checkpoint
+  // triggers (Options::checkpoint_*) and the sealed WAL size, running
+  // checkpoint() or compact_wal().
+  void maintenance_loop();
+  // The automatic checkpoint trigger that has fired, nullptr if none.
+  const char* checkpoint_trigger();
+  // Does WAL record `seq` still decide `key`'s state? A put while it is the
+  // newest version; a delete also while the key is gone, since it still
+  // shadows the snapshot file.
+  bool wal_record_live(std::string_view key, uint64_t seq, bool is_delete) const;
+
+  Options options_;
+  std::string wal_path_;
+  std::unique_ptr<LsmTree> tree_;
+  std::size_t flush_trigger_ = 0;  // per-shard memtable bytes
+
+  std::mutex flush_mu_;
+  uint64_t frozen_seq_ = 0;  // seq_ when the current imm memtables were frozen
+  uint64_t frozen_segment_ = 0;  // first WAL segment after the freeze, once known
+  std::mutex bg_mu_;  // guards the fields below
+  std::condition_variable bg_cv_;
+  bool flush_requested_ = false;
+  bool stop_ = false;
+  uint64_t flushes_completed_ = 0;  // by the background thread
+  bool checkpoint_queued_ = false;
+  std::string checkpoint_path_;  // of the queued checkpoint
+  uint64_t checkpoints_requested_ = 0;
+  uint64_t checkpoints_completed_ = 0;  // by the background thread
+  bool checkpoint_ok_ = true;  // result of the last background checkpoint
+  std::thread background_;
+  // Serializes checkpoint() and compact_wal(): both replace WAL segments.
+  std::mutex maintenance_mu_;
+  std::atomic<uint64_t> compacted_bytes_{0};  // kept by the last WAL cleaning
+  std::atomic<uint64_t> checkpoint_seq_{0};
+  double replay_bytes_per_sec_ = 0;  // measured by open(); 0: assumed
+  // WAL records kept since the last checkpoint: those open() replayed, plus
+  // those appended after LSN checkpoint_lsn_ (both guarded by wal_mu_).
+  uint64_t replayed_records_ = 0;
+  uint64_t checkpoint_lsn_ = 0;
+
+  // ---- v0.9 snapshot image (in-memory engine) ----
+
+  // The mapped image entry for `key`, which only counts where the memtables
+  // have no version of it (they then hold tombstones for its deletes).
+  // False without an image or entry.
+  bool image_find(std::string_view key, uint64_t hash, SnapshotImage::Entry* e) const {
+    return image_ != nullptr && image_->find(shard_index(hash), key, hash, e);
+  }
+  // ... and not past its TTL.
+  bool image_get(std::string_view key, uint64_t hash, SnapshotImage::Entry* e) const {
+    return image_find(key, hash, e) &&
+           (e->expires_at == 0 || e->expires_at > TimingWheel::now_ms());
+  }
+
+  // Mapped by open() and kept until the store is destroyed; partition i
+  // underlies shard i.
+  std::unique_ptr<SnapshotImage> image_;
+
+  // ---- v0.9 value log (closed when Options::value_log_threshold is 0) ----
+
+  // Append `value` to the value log if it is large enough, leaving the
+  // encoded pointer in `ref` (left empty for inline values). False only if
+  // the append failed.
+  bool separate_value(std::string_view key, std::string_view value, std::string& ref);
+  // Value log before WAL: a durable pointer must never outlive its record
+  // (the WAL writer thread also syncs the value log ahead of each group).
+  // Needs no lock; under wal_mu_ nothing new can be appended meanwhile.
+  bool flush_logs();
+  // Is the record at `ptr` still what the newest (unexpired) version of
+  // `key` points at? Also yields that version's TTL deadline. Caller holds
+  // the key's shard lock.
+  bool value_log_live(std::string_view key, uint64_t hash, const ValuePointer& ptr,
+                      uint64_t* expires_at = nullptr) const;
+
+  ValueLog vlog_;
+  std::mutex vlog_gc_mu_;  // serializes gc_value_log(); guards the field below
+  // Collected files not yet deleted, with the last seq of their relocations:
+  // a snapshot older than that may still read through them.
+  std::vector<std::pair<uint32_t, uint64_t>> vlog_pending_;
+
+  // ---- v0.9 TTL ----
+
+  // Shared by both put() overloads; expires_at 0 = no TTL.
+  void put_value(std::string_view key, std::string_view value, uint64_t expires_at,
+                 Durability durability);
+  void schedule_expiry(std::string_view key, uint64_t expires_at);
+  // TTL deadline of the newest version of `key` (0 if none, deleted or
+  // absent). Caller holds the key's shard lock.
+  uint64_t current_expiry(std::string_view key, uint64_t hash) const;
+  // Log and apply an Expire for each due key whose current version still
+  // carries the deadline it was scheduled with.
+  void expire_due(const std::vector<TimingWheel::Entry>& due);
+  void expiry_loop();
+
+  std::mutex ttl_mu_;  // guards the fields below
+  std::condition_variable ttl_cv_;
+  TimingWheel wheel_;
+  bool ttl_stop_ = false;
+  std::thread expiry_thread_;  // started by open()
 };
 
-} // namespace kv
\ No newline at end of file
+} // namespace kv
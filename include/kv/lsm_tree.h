@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kv/options.h"
+#include "kv/sstable.h"
+
+namespace kv {
+
+// v0.9: on-disk levels of the LSM engine.
+//
+// Level 0 holds whole memtable flushes, newest first, and its tables may
+// overlap. Levels 1+ are sorted runs of non-overlapping tables. For any key,
+// versions in newer level-0 tables and in lower-numbered levels are newer
+// than those further down, so a lookup stops at the first table that has the
+// key. The MANIFEST lists the live tables of every level and the sequence
+// number covered by flushes; it is rewritten (tmp + rename) on every change.
+//
+// Readers pin an immutable Version and never wait for compaction. Flushes and
+// compactions are run by a single thread (the store's background thread).
+class LsmTree {
+ public:
+  static constexpr int kNumLevels = 7;
+
+  // Create or load `dir`. Table files not listed in the MANIFEST (left by
+  // an interrupted flush or compaction) are deleted.
+  bool open(const std::string& dir, const Options& options);
+
+  // Every WAL record with seq <= flushed_seq() is in some table.
+  uint64_t flushed_seq() const;
+
+  uint64_t new_file_number();
+  std::string table_path(uint64_t number) const;
+
+  // Publish a finished memtable flush as the newest level-0 table.
+  bool install_flush(uint64_t number, uint64_t flushed_seq);
+
+  // Newest version of `key` with seq <= at, across all levels (expiry left
+  // to the caller, as in SSTable::get).
+  SSTable::Lookup get(std::string_view key, uint64_t at, std::string* value,
+                      uint64_t* expires_at = nullptr) const;
+
+  // fn(key, value, type) for every key in [begin, end) that is live at `at`
+  // and not expired by `now_ms` (empty `end` = unbounded), in key order,
+  // until fn returns false. type is Put or Ref.
+  void scan(std::string_view begin, std::string_view end, uint64_t at, uint64_t now_ms,
+            const std::function<bool(std::string_view, std::string_view, EntryType)>& fn) const;
+
+  // Run one compaction if level 0 has too many tables or a level is over
+  // its size budget. Versions a snapshot at or after `oldest_snapshot` can
+  // read are kept; deletes and versions expired by `now_ms` reaching the
+  // last populated level are dropped. False if there was nothing to do or
+  // the compaction failed.
+  bool compact_once(uint64_t oldest_snapshot, uint64_t now_ms);
+
+  // Table count per level.
+  std::vector<std::size_t> level_files() const;
+
+ private:
+  struct Version {
+    std::vector<std::shared_ptr<SSTable>> levels[kNumLevels];
+  };
+
+  std::shared_ptr<const Version> current() const;
+  uint64_t level_target(int level) const;
+  bool write_manifest(const Version& v, uint64_t flushed_seq);
+
+  mutable std::mutex mu_;  // guards the fields below
+  std::shared_ptr<const Version> current_ = std::make_shared<Version>();
+  uint64_t next_file_ = 1;
+  uint64_t flushed_seq_ = 0;
+  // Level 1+: largest key of the last table compacted, for round-robin picks.
+  std::string compact_pointer_[kNumLevels];
+
+  std::string dir_;
+  Options options_;
+};
+
+}  // namespace kv
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kv/flat_table.h"
+#include "kv/ordered_index.h"
+
+namespace kv {
+
+// Live snapshots as seen by one writer at its sequencing step.
+struct SnapshotBounds {
+  bool any = false;
+  uint64_t oldest = kMaxSeq;
+  uint64_t newest = 0;
+};
+
+// v0.9: one shard's in-memory table. The hash table serves point lookups and
+// the ordered index (pointing at the same key records) serves scans.
+//
+// Writes push a new head version. The old head is kept only if a live
+// snapshot could read it; such keys are listed so their chains can be cut
+// back once those snapshots are released. In the in-memory engine a delete
+// nobody can observe removes the entry outright; with keep_tombstones (LSM
+// engine) the tombstone stays so it shadows older SSTable entries until the
+// memtable is flushed.
+//
+// Not thread-safe; guarded by the owning shard's lock.
+class Memtable {
+ public:
+  explicit Memtable(bool keep_tombstones = false) : keep_tombstones_(keep_tombstones) {}
+
+  Memtable(const Memtable&) = delete;
+  Memtable& operator=(const Memtable&) = delete;
+
+  // value_flags is 0 or ValueRec::kValueRef (value is a ValuePointer);
+  // expires_at is the TTL deadline in unix ms, 0 for none.
+  void put(std::string_view key, uint64_t hash, std::string_view value,
+           uint64_t seq, const SnapshotBounds& snaps, uint32_t value_flags = 0,
+           uint64_t expires_at = 0);
+  // False if the key was not live here (the tombstone is still recorded
+  // when keep_tombstones is set).
+  bool erase(std::string_view key, uint64_t hash, uint64_t seq,
+             const SnapshotBounds& snaps);
+
+  // Drop versions no snapshot at or after `oldest` can read.
+  void reclaim(uint64_t oldest);
+  bool has_old_versions() const { return !versioned_.empty(); }
+
+  void clear();
+  // Room for n keys without rehashing (bulk loads).
+  void reserve(std::size_t n) { map_.reserve(n); }
+
+  const KeyRec* find(std::string_view key, uint64_t hash) const { return map_.find(key, hash); }
+  void prefetch(uint64_t hash) const { map_.prefetch(hash); }
+  const OrderedIndex& index() const { return index_; }
+
+  // Keys whose newest version is not a tombstone.
+  std::size_t live() const { return live_; }
+  bool empty() const { return map_.size() == 0; }
+  std::size_t memory_bytes() const { return map_.memory_bytes(); }
+
+ private:
+  void retire_versions(KeyRec* k, uint64_t hash, const SnapshotBounds& snaps);
+  void drop(std::string_view key, uint64_t hash);
+
+  FlatTable map_;
+  OrderedIndex index_;
+  std::size_t live_ = 0;
+  std::vector<std::string> versioned_;  // keys holding older versions
+  bool keep_tombstones_;
+};
+
+}  // namespace kv
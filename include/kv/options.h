@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace kv {
+
+// v0.9: when a write is acknowledged relative to its WAL record reaching
+// disk. Chosen per store (Options::durability) and overridable per write.
+enum class Durability {
+  kDefault,  // per write: the store's mode
+  kSync,     // the write returns once its record is durable
+  kCount,    // ... once all but the newest wal_sync_every - 1 records are
+  kTimed,    // at once; the WAL writer syncs within wal_sync_interval_ms
+  kAsync,    // at once; the record is handed to the kernel right away
+};
+
+// v0.9: storage engine settings chosen at KVStore::open().
+struct Options {
+  enum class Engine {
+    kMemory,  // whole dataset in the shard tables; WAL + binary snapshot
+    kLsm,     // shard tables are memtables flushed to SSTables on disk
+  };
+
+  Engine engine = Engine::kMemory;
+
+  // ---- I/O ----
+
+  enum class IoBackendKind {
+    kSync,     // pwrite + fdatasync on the calling thread
+    kIoUring,  // io_uring where available (Linux), else kSync
+  };
+
+  // Backend for WAL group writes and snapshot saves.
+  IoBackendKind io_backend = IoBackendKind::kSync;
+
+  // Open WAL segments with O_DIRECT. Each group is staged with the segment's
+  // partial last block in an aligned buffer and written as whole 4 KiB
+  // blocks. Ignored (with a note) on filesystems that refuse O_DIRECT.
+  bool wal_direct_io = false;
+
+  // ---- WAL ----
+
+  // Longest the WAL writer thread holds a commit group open waiting for
+  // more concurrent writers (only while groups are larger than one).
+  unsigned wal_group_commit_delay_us = 100;
+
+  // WAL segment size under "<wal_path>.seg/". Segments are preallocated and
+  // zero-filled at this size; a record larger than a segment gets one to
+  // itself.
+  std::size_t wal_segment_bytes = 16u << 20;
+  // In-memory engine: once the sealed WAL segments hold this many bytes (and
+  // twice what the last cleaning kept), a background pass rewrites them
+  // keeping only each key's current record. 0 (the default) disables it;
+  // 64 MiB is a reasonable start.
+  uint64_t wal_compact_bytes = 0;
+
+  // ---- automatic checkpoints (in-memory engine) ----
+
+  // The maintenance thread checkpoints to checkpoint_path (empty:
+  // "<wal_path>.snapshot") once any enabled trigger fires; each is 0 to
+  // disable it, and all are off by default. Checked once a second.
+  std::string checkpoint_path;
+  // WAL bytes kept since the last checkpoint.
+  uint64_t checkpoint_wal_bytes = 0;
+  // WAL records appended since the last checkpoint (a batch counts once).
+  uint64_t checkpoint_wal_records = 0;
+  // Estimated time to replay the kept WAL at the throughput the last open()
+  // measured (an assumed 200 MB/s until a replay of 16 MiB or more).
+  unsigned checkpoint_replay_ms = 0;
+  // Rate limit: an automatic checkpoint starts at least this long after the
+  // previous checkpoint of any kind, and after open().
+  unsigned checkpoint_min_interval_ms = 10000;
+
+  // ---- durability ----
+
+  enum class AsyncFlush {
+    kFdatasync,      // each async group is written and fdatasync'ed
+    kSyncFileRange,  // written, writeback started with sync_file_range; no
+                     // device flush until the next sync, flush or checkpoint
+  };
+
+  Durability durability = Durability::kSync;
+  // kCount: a write waits for everything but the newest wal_sync_every - 1
+  // records, so one sync covers that many writes.
+  unsigned wal_sync_every = 1;
+  // kTimed: upper bound on how long an acknowledged record stays unsynced.
+  // kCount: the same bound for the records a quiet writer leaves behind.
+  unsigned wal_sync_interval_ms = 10;
+  AsyncFlush async_flush = AsyncFlush::kFdatasync;
+
+  // ---- value log (both engines) ----
+
+  // Values of at least this many bytes are written once to a value log
+  // under "<wal_path>.vlog/" and indexed by a 16-byte pointer; the WAL,
+  // snapshots and SSTables carry only the pointer. 0 (the default) keeps
+  // every value inline; 1024 suits object chunks.
+  std::size_t value_log_threshold = 0;
+
+  // Value log files are sealed at roughly this size; GC works per file.
+  std::size_t value_log_file_bytes = 64u << 20;
+
+  // ---- compression ----
+
+  // kLz4 compresses WAL batch records and snapshot files in blocks with the
+  // in-tree LZ4 codec (kv/compression.h); data that does not shrink is kept
+  // raw. Logs and snapshots written with it need a build that knows the
+  // format; either setting reads both.
+  enum class Compression { kNone, kLz4 };
+  Compression compression = Compression::kNone;
+
+  // ---- snapshots (in-memory engine) ----
+
+  // Snapshot files (checkpoints, save_snapshot) are written as snapshot
+  // images (kv/snapshot_image.h) instead of compressed block files. open()
+  // maps a checkpoint image and serves reads from it in place, so a restart
+  // costs no load; writes after that go to the shard tables on top of it.
+  // Either setting loads both formats.
+  bool snapshot_image = false;
+
+  // ---- LSM engine only ----
+
+  // Directory for SSTables and the MANIFEST; empty = "<wal_path>.lsm".
+  std::string lsm_dir;
+
+  // Memtable size (all shards together) that triggers a flush to level 0.
+  // Each shard's share is at least a few arena slabs (1 MiB).
+  std::size_t memtable_bytes = 64u << 20;
+
+  // Uncompressed data block size; one index entry per block.
+  std::size_t block_bytes = 4096;
+
+  // Bloom filter bits per key (~1% false positives at 10).
+  int bloom_bits_per_key = 10;
+
+  // Level 0 files that trigger a compaction into level 1.
+  int l0_compaction_trigger = 4;
+
+  // Level 1 target size; each further level is level_multiplier times larger.
+  std::size_t l1_bytes = 256u << 20;
+  int level_multiplier = 10;
+
+  // Compaction output files are cut at roughly this size.
+  std::size_t sstable_bytes = 32u << 20;
+};
+
+}  // namespace kv
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "kv/flat_table.h"
+
+namespace kv {
+
+// v0.9: sorted secondary index over a shard's keys.
+//
+// Two-level B+tree: sorted leaves of at most kLeafMax keys, plus an array of
+// fence keys (first key of every leaf) that is binary searched to find the
+// leaf. Entries point at key records owned by the shard map, so a key must be
+// erased here before the map entry that owns it goes away. Scans hand out the
+// record, which also reaches the key's version chain.
+class OrderedIndex {
+ public:
+  void insert(const KeyRec* key);
+  void erase(std::string_view key);
+  void clear();
+  std::size_t size() const { return size_; }
+
+  // Visit records with key >= begin in order until fn returns false.
+  template <class Fn>
+  void scan_from(std::string_view begin, Fn&& fn) const {
+    if (leaves_.empty()) return;
+    std::size_t li = find_leaf(begin);
+    std::size_t ki = lower_bound_in(leaves_[li], begin);
+    for (; li < leaves_.size(); ++li, ki = 0) {
+      const auto& keys = leaves_[li];
+      for (; ki < keys.size(); ++ki) {
+        if (!fn(keys[ki])) return;
+      }
+    }
+  }
+
+  // Keys in [begin, end); an empty `end` means unbounded.
+  template <class Fn>
+  void scan_range(std::string_view begin, std::string_view end, Fn&& fn) const {
+    scan_from(begin, [&](const KeyRec* k) {
+      if (!end.empty() && k->view() >= end) return false;
+      return fn(k);
+    });
+  }
+
+  // Keys starting with `prefix`; stops at the first non-matching key.
+  template <class Fn>
+  void scan_prefix(std::string_view prefix, Fn&& fn) const {
+    scan_from(prefix, [&](const KeyRec* k) {
+      if (k->view().substr(0, prefix.size()) != prefix) return false;
+      fn(k);
+      return true;
+    });
+  }
+
+ private:
+  static constexpr std::size_t kLeafMax = 128;
+
+  using Leaf = std::vector<const KeyRec*>;
+
+  std::size_t find_leaf(std::string_view key) const;
+  static std::size_t lower_bound_in(const Leaf& leaf, std::string_view key);
+
+  std::vector<Leaf> leaves_;             // non-empty, globally sorted
+  std::vector<std::string_view> fence_;  // fence_[i] == leaves_[i].front()
+  std::size_t size_ = 0;
+};
+
+}  // namespace kv
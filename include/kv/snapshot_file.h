@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kv/io_backend.h"
+#include "kv/options.h"
+
+namespace kv {
+
+// v0.9: binary snapshot file of the in-memory engine.
+//
+//   header : u32 magic | u32 version
+//   block  : u32 raw_size | u32 stored_size | u32 crc | stored bytes
+//   index  : u32 partitions | { u64 entries | u64 blocks } per partition |
+//            u64 block offsets, partition by partition | u32 crc
+//   footer : u64 entries | u64 seq | u64 blocks | u64 data_end |
+//            u32 crc | u32 magic
+//
+// Stored bytes are LZ4 (Options::compression) when stored_size < raw_size,
+// else the raw block; the block crc (CRC-32C) covers the stored bytes, the
+// index crc the index before it, the footer crc the four u64 before it.
+// Blocks hold whole entries:
+//
+//   repeated { u32 key_len | u32 val_len | u8 flags | key | value |
+//              [u64 expires_at] }
+//
+// flags: kSnapshotRef (value is an encoded ValuePointer), kSnapshotExpires
+// (expires_at follows, unix ms). `seq` is the sequence number the snapshot
+// was taken at; data_end is where the index starts.
+//
+// Each partition holds one shard of the saving store. Partitions are
+// written and read independently, so the blocks of different partitions
+// may interleave; the index lists each partition's blocks in order.
+// Version 1 files have no index (data_end is the footer) and read as one
+// partition.
+inline constexpr uint8_t kSnapshotRef = 1;
+inline constexpr uint8_t kSnapshotExpires = 2;
+
+class SnapshotFileWriter {
+ public:
+  static constexpr std::size_t kBlockBytes = std::size_t{64} << 10;
+
+  SnapshotFileWriter(IoBackend::Kind io, Options::Compression compression,
+                     std::size_t partitions = 1);
+
+  SnapshotFileWriter(const SnapshotFileWriter&) = delete;
+  SnapshotFileWriter& operator=(const SnapshotFileWriter&) = delete;
+
+  // Creates or truncates `path`.
+  bool open(const std::string& path);
+  // Different partitions may be filled from different threads at once; one
+  // partition takes one thread at a time. Blocks are encoded and compressed
+  // by the adding thread, only the append is serialized.
+  void add(std::size_t partition, std::string_view key, std::string_view value,
+           bool value_ref, uint64_t expires_at);
+  // Write the last blocks, the index and the footer, fdatasync and close.
+  // False if any write failed.
+  bool finish(uint64_t seq);
+
+ private:
+  struct Partition {
+    std::string block;
+    std::string packed;
+    uint64_t entries = 0;
+    std::vector<uint64_t> offsets;  // of its blocks
+  };
+
+  bool flush_block(Partition& part);
+  bool append(std::string_view bytes, uint64_t* offset = nullptr);
+
+  IoFileBuf file_;
+  bool compress_;
+  std::vector<Partition> parts_;
+  std::mutex mu_;  // guards file_, offset_ and ok_
+  uint64_t offset_ = 0;
+  uint64_t blocks_ = 0;
+  bool ok_ = true;
+};
+
+class SnapshotFileReader {
+ public:
+  // kText: an older line-based snapshot ("key<TAB>value" lines).
+  enum class Status { kOk, kMissing, kText, kCorrupt };
+
+  SnapshotFileReader() = default;
+  ~SnapshotFileReader();
+
+  SnapshotFileReader(const SnapshotFileReader&) = delete;
+  SnapshotFileReader& operator=(const SnapshotFileReader&) = delete;
+
+  // Maps `path` and checks its header, index and footer.
+  Status open(const std::string& path);
+
+  uint64_t entries() const { return entries_; }
+  uint64_t seq() const { return seq_; }
+  std::size_t partitions() const { return parts_.size(); }
+  uint64_t partition_entries(std::size_t p) const { return parts_[p].entries; }
+
+  // Block crcs, offsets and counts (read() checks them too). The
+  // partitions can be verified from different threads.
+  bool verify() const;
+  bool verify_partition(std::size_t p) const;
+
+  // Calls fn(key, value, value_ref, expires_at) for each entry in file
+  // order; the views are valid during the call only. Every block crc is
+  // checked before the first call, so a damaged file calls fn for nothing.
+  // False if the file is damaged or does not hold the entries its footer
+  // says.
+  template <class Fn>
+  bool read(Fn&& fn) const {
+    if (!verify()) return false;
+    for (std::size_t p = 0; p < parts_.size(); ++p) {
+      if (!read_partition(p, fn)) return false;
+    }
+    return true;
+  }
+
+  // The same for one partition, without checking the block crcs first
+  // (verify_partition() does). Safe to call for different partitions from
+  // different threads.
+  template <class Fn>
+  bool read_partition(std::size_t p, Fn&& fn) const {
+    std::string scratch;
+    std::string_view block;
+    uint64_t entries = 0;
+    for (uint64_t b = 0; b < parts_[p].blocks; ++b) {
+      if (!next_block(block_offset(p, b), scratch, block)) return false;
+      const char* q = block.data();
+      const char* const end = q + block.size();
+      while (q < end) {
+        if (static_cast<std::size_t>(end - q) < kEntryHeader) return false;
+        uint32_t key_len = 0;
+        uint32_t val_len = 0;
+        std::memcpy(&key_len, q, sizeof(key_len));
+        std::memcpy(&val_len, q + 4, sizeof(val_len));
+        const auto flags = static_cast<uint8_t>(q[8]);
+        q += kEntryHeader;
+        const std::size_t tail = (flags & kSnapshotExpires) != 0 ? sizeof(uint64_t) : 0;
+        if (static_cast<std::size_t>(end - q) < std::size_t{key_len} + val_len + tail) {
+          return false;
+        }
+        const std::string_view key(q, key_len);
+        const std::string_view value(q + key_len, val_len);
+        q += std::size_t{key_len} + val_len;
+        uint64_t expires_at = 0;
+        if (tail != 0) std::memcpy(&expires_at, q, sizeof(expires_at));
+        q += tail;
+        fn(key, value, (flags & kSnapshotRef) != 0, expires_at);
+        ++entries;
+      }
+    }
+    return entries == parts_[p].entries;
+  }
+
+ private:
+  static constexpr std::size_t kHeaderBytes = 8;
+  static constexpr std::size_t kEntryHeader = 4 + 4 + 1;
+
+  struct Partition {
+    uint64_t entries = 0;
+    uint64_t blocks = 0;
+    uint64_t first = 0;  // index of its first offset in offsets_
+  };
+
+  // Fill parts_ and offsets_ from the index (version 2) or by walking the
+  // block headers (version 1).
+  Status open_index();
+  uint64_t block_offset(std::size_t p, uint64_t b) const { return offsets_[parts_[p].first + b]; }
+  // The raw bytes of the block at `off` (decompressed into `scratch` if
+  // needed). Assumes a verified block.
+  bool next_block(uint64_t off, std::string& scratch, std::string_view& block) const;
+
+  const char* base_ = nullptr;
+  std::size_t size_ = 0;
+  uint64_t entries_ = 0;
+  uint64_t seq_ = 0;
+  uint64_t blocks_ = 0;
+  uint64_t data_end_ = 0;
+  std::vector<Partition> parts_;
+  std::vector<uint64_t> offsets_;  // block offsets, partition by partition
+};
+
+}  // namespace kv
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "kv/io_backend.h"
+#include "kv/options.h"
+
+namespace kv {
+
+// v0.9: snapshot image of the in-memory engine, served in place from a
+// read-only mapping (Options::snapshot_image).
+//
+//   header    : u32 magic | u32 version
+//   heap      : entries { u32 key_len | u32 val_len | u8 flags | key | value |
+//                         [u64 expires_at] | u32 crc }
+//   per partition, 8-byte aligned:
+//     slots   : u64[capacity] (power of two), 0 = empty, else
+//               hash tag (top 16 bits) | entry offset (low 48 bits)
+//     sorted  : u64[count] entry offsets in key order
+//   ttl       : u64 offsets of the entries with a deadline
+//   directory : { u64 slots | u64 capacity | u64 sorted | u64 count |
+//                 u32 crc } per partition | u64 ttl | u64 ttl_count
+//   footer    : u64 entries | u64 seq | u64 heap_end | u64 directory |
+//               u64 hash id | u32 partitions | u32 crc | u32 magic
+//
+// Entry flags are kSnapshotRef / kSnapshotExpires (kv/snapshot_file.h). The
+// entry crc (CRC-32C) covers the entry before it and is checked on every
+// read. A partition's crc covers its slots and sorted offsets and is only
+// checked by verify(), so opening reads nothing but the footer and the
+// directory (whose crc the footer holds). Offsets read from the index are
+// bounds-checked before use.
+//
+// Partition p holds shard p of the saving store: the store probes it with
+// the hash it already computed for the shard (linear probing from the low
+// bits), and scans merge its sorted offsets with the shard's own index.
+// That hash is the standard library's, so the footer carries an id of the
+// hash function (the saving store's choice); an image is only served in
+// place by a store whose id matches. Version 1 images have none (id 0).
+// Values are stored raw (never compressed) so lookups can return views.
+class SnapshotImageWriter {
+ public:
+  // `hash_id` identifies the function the hashes passed to add() come from.
+  SnapshotImageWriter(IoBackend::Kind io, std::size_t partitions, uint64_t hash_id);
+
+  SnapshotImageWriter(const SnapshotImageWriter&) = delete;
+  SnapshotImageWriter& operator=(const SnapshotImageWriter&) = delete;
+
+  // Creates or truncates `path`.
+  bool open(const std::string& path);
+  // Entries of a partition are added in key order. Different partitions
+  // may be filled from different threads at once.
+  void add(std::size_t partition, std::string_view key, uint64_t hash, std::string_view value,
+           bool value_ref, uint64_t expires_at);
+  // Write the index, directory and footer, fdatasync and close. False if
+  // any write failed.
+  bool finish(uint64_t seq);
+
+ private:
+  static constexpr std::size_t kFlushBytes = std::size_t{64} << 10;
+
+  struct Partition {
+    std::string buffer;  // entries not appended yet
+    std::vector<std::pair<uint64_t, uint64_t>> pending;  // (hash, offset in buffer)
+    std::vector<uint64_t> pending_ttl;                   // offsets in buffer
+    std::vector<std::pair<uint64_t, uint64_t>> entries;  // (hash, file offset), key order
+    std::vector<uint64_t> ttl;                           // file offsets
+  };
+
+  bool flush(Partition& part);
+  bool append(std::string_view bytes, uint64_t* offset = nullptr);
+
+  IoFileBuf file_;
+  std::vector<Partition> parts_;
+  uint64_t hash_id_;
+  std::mutex mu_;  // guards file_, offset_ and ok_
+  uint64_t offset_ = 0;
+  bool ok_ = true;
+};
+
+class SnapshotImage {
+ public:
+  // kOther: not an image (a block or text snapshot file).
+  enum class Status { kOk, kMissing, kOther, kCorrupt };
+
+  struct Entry {
+    std::string_view key;
+    std::string_view value;  // an encoded ValuePointer if value_ref
+    bool value_ref = false;
+    uint64_t expires_at = 0;
+  };
+
+  SnapshotImage() = default;
+  ~SnapshotImage();
+
+  SnapshotImage(const SnapshotImage&) = delete;
+  SnapshotImage& operator=(const SnapshotImage&) = delete;
+
+  // Maps `path` and checks its footer and directory.
+  Status open(const std::string& path);
+
+  uint64_t entries() const { return entries_; }
+  uint64_t seq() const { return seq_; }
+  // The writer's hash id; 0 for a version 1 image.
+  uint64_t hash_id() const { return hash_id_; }
+  std::size_t partitions() const { return parts_.size(); }
+  uint64_t count(std::size_t partition) const { return parts_[partition].count; }
+
+  // Every index crc and entry crc; reads the whole file.
+  bool verify() const;
+
+  // The entry for `key` in `partition` (views into the mapping, valid while
+  // the image is open). False if absent or damaged.
+  bool find(std::size_t partition, std::string_view key, uint64_t hash, Entry* entry) const;
+  // Position of the first key >= `key` in the partition's key order.
+  uint64_t lower_bound(std::size_t partition, std::string_view key) const;
+  // The i-th entry in key order. False if damaged.
+  bool entry_at(std::size_t partition, uint64_t i, Entry* entry) const;
+  // Calls fn(entry) for every entry with a deadline.
+  template <class Fn>
+  void for_each_ttl(Fn&& fn) const {
+    Entry e;
+    for (uint64_t i = 0; i < ttl_count_; ++i) {
+      if (decode(load(ttl_ + i * 8), &e)) fn(e);
+    }
+  }
+
+ private:
+  struct Partition {
+    uint64_t slots = 0;
+    uint64_t capacity = 0;
+    uint64_t sorted = 0;
+    uint64_t count = 0;
+    uint32_t crc = 0;
+  };
+
+  uint64_t load(uint64_t off) const;
+  // Checks bounds and crc; views into the mapping.
+  bool decode(uint64_t off, Entry* entry) const;
+
+  const char* base_ = nullptr;
+  std::size_t size_ = 0;
+  uint64_t entries_ = 0;
+  uint64_t seq_ = 0;
+  uint64_t hash_id_ = 0;
+  uint64_t heap_end_ = 0;  // where the index starts
+  uint64_t ttl_ = 0;
+  uint64_t ttl_count_ = 0;
+  std::vector<Partition> parts_;
+};
+
+}  // namespace kv
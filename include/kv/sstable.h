@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "kv/bloom.h"
+#include "kv/options.h"
+
+namespace kv {
+
+// v0.9: immutable sorted table file of the LSM engine.
+//
+//   data block   : repeated { u32 key_len | u32 val_len | u64 seq | u8 type |
+//                             key | value }, then u32 crc
+//   index block  : u32 smallest_len | smallest key |
+//                  repeated { u32 key_len | u64 offset | u32 size | last key },
+//                  then u32 crc
+//   filter block : bloom filter, then u32 crc
+//   footer       : u64 index_off | u64 index_size | u64 filter_off |
+//                  u64 filter_size | u64 entries | u64 max_seq |
+//                  u32 version | u32 magic
+//
+// Entries are sorted by key, then by descending seq, so the first entry of a
+// key at or below a read sequence number is the visible one. Block sizes in
+// the index exclude the trailing crc.
+// Ref entries hold an encoded ValuePointer into the value log. Entries with a
+// TTL set kExpiresBit in the type byte and end their value with the u64
+// expiry time (unix ms); readers see it through expires_at().
+enum class EntryType : uint8_t { Put = 1, Del = 2, Ref = 3 };
+inline constexpr uint8_t kExpiresBit = 0x80;
+
+class SSTableWriter {
+ public:
+  explicit SSTableWriter(const Options& options);
+  ~SSTableWriter();
+
+  SSTableWriter(const SSTableWriter&) = delete;
+  SSTableWriter& operator=(const SSTableWriter&) = delete;
+
+  bool open(const std::string& path);
+
+  // Keys ascending; versions of one key by descending seq. expires_at is
+  // the TTL deadline (unix ms), 0 for none.
+  bool add(std::string_view key, uint64_t seq, EntryType type, std::string_view value,
+           uint64_t expires_at = 0);
+
+  // Write index, filter and footer, then fsync. False on I/O error.
+  bool finish();
+
+  // Close and delete a table that will not be finished.
+  void abandon();
+
+  uint64_t file_size() const { return offset_ + block_.size(); }
+  uint64_t entries() const { return entries_; }
+  std::string_view last_key() const { return last_key_; }
+
+ private:
+  bool flush_block();
+  bool append(std::string_view bytes);
+
+  std::size_t block_bytes_;
+  BloomBuilder bloom_;
+  int fd_ = -1;
+  std::string path_;
+  std::string block_;
+  std::string index_;
+  std::string smallest_;
+  std::string last_key_;
+  uint64_t offset_ = 0;
+  uint64_t entries_ = 0;
+  uint64_t max_seq_ = 0;
+};
+
+class SSTable {
+ public:
+  // kFoundRef: the value is an encoded ValuePointer.
+  enum class Lookup { kNotFound, kFound, kFoundRef, kDeleted };
+
+  // Reads the footer, index and filter; nullptr if the file is unusable.
+  static std::shared_ptr<SSTable> open(const std::string& path, uint64_t number);
+  ~SSTable();
+
+  SSTable(const SSTable&) = delete;
+  SSTable& operator=(const SSTable&) = delete;
+
+  // Newest version of `key` with seq <= at. Expiry is left to the caller:
+  // *expires_at (if given) is the version's deadline, 0 for none.
+  Lookup get(std::string_view key, uint64_t at, std::string* value,
+             uint64_t* expires_at = nullptr) const;
+
+  uint64_t number() const { return number_; }
+  uint64_t file_size() const { return file_size_; }
+  uint64_t entries() const { return entries_; }
+  uint64_t max_seq() const { return max_seq_; }
+  std::string_view smallest() const { return smallest_; }
+  std::string_view largest() const { return index_.back().last_key; }
+
+  // Key range intersects [begin, end]; an empty `end` means unbounded.
+  bool overlaps(std::string_view begin, std::string_view end) const {
+    return largest() >= begin && (end.empty() || smallest() <= end);
+  }
+
+  // Forward cursor; one data block is held in memory at a time.
+  class Iterator {
+   public:
+    explicit Iterator(const SSTable* table) : table_(table) {}
+
+    void seek_to_first() { seek({}); }
+    // First entry with key >= target.
+    void seek(std::string_view target);
+    void next();
+    bool valid() const { return valid_; }
+    // False once a block failed its checksum.
+    bool ok() const { return ok_; }
+
+    std::string_view key() const { return key_; }
+    std::string_view value() const { return value_; }
+    uint64_t seq() const { return seq_; }
+    EntryType type() const { return type_; }
+    uint64_t expires_at() const { return expires_at_; }
+
+   private:
+    bool load_block(std::size_t i);
+    void parse();
+
+    const SSTable* table_;
+    std::size_t block_ = 0;
+    std::string data_;
+    std::size_t pos_ = 0;
+    std::size_t entry_bytes_ = 0;  // of the current entry, header included
+    bool valid_ = false;
+    bool ok_ = true;
+    std::string_view key_;
+    std::string_view value_;
+    uint64_t seq_ = 0;
+    EntryType type_ = EntryType::Put;
+    uint64_t expires_at_ = 0;
+  };
+
+ private:
+  struct BlockHandle {
+    std::string last_key;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  SSTable() = default;
+  bool read_block(std::size_t i, std::string* out) const;
+
+  int fd_ = -1;
+  std::string path_;
+  uint64_t number_ = 0;
+  uint64_t file_size_ = 0;
+  uint64_t entries_ = 0;
+  uint64_t max_seq_ = 0;
+  std::string smallest_;
+  std::vector<BlockHandle> index_;  // non-empty
+  std::string filter_;
+};
+
+}  // namespace kv
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kv {
+
+// v0.9: hierarchical timing wheel (Varghese & Lauck) scheduling key expiry.
+//
+// kLevels wheels of kSlots slots; a level-L slot spans kSlots^L ticks. An
+// entry goes into the lowest level whose range covers its deadline and
+// cascades one level down each time the wheel below wraps, so scheduling is
+// O(1) and advancing costs O(1) per tick plus O(1) per entry per level. With
+// the default 10 ms tick the wheels cover ~46 hours; later deadlines park in
+// the top level and are re-placed when they come round.
+//
+// Entries are never cancelled: the store re-checks each due key against its
+// current version, so an overwritten or deleted key just fires harmlessly.
+// Not thread-safe.
+class TimingWheel {
+ public:
+  static constexpr int kLevels = 4;
+  static constexpr unsigned kSlotBits = 6;
+  static constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+
+  struct Entry {
+    std::string key;
+    uint64_t expires_at;  // unix ms
+  };
+
+  explicit TimingWheel(uint64_t tick_ms = 10);
+
+  // Wall clock in unix ms; TTL deadlines survive restarts.
+  static uint64_t now_ms();
+
+  void schedule(std::string key, uint64_t expires_at);
+
+  // Move the wheel up to `now_ms`, appending every entry whose deadline has
+  // passed to `due`.
+  void advance(uint64_t now_ms, std::vector<Entry>* due);
+
+  bool empty() const { return size_ == 0; }
+  std::size_t size() const { return size_; }
+  uint64_t tick_ms() const { return tick_ms_; }
+
+ private:
+  uint64_t tick_of(uint64_t ms) const { return (ms + tick_ms_ - 1) / tick_ms_; }
+  // Deadlines before `earliest` (a tick not yet processed) are moved to it.
+  void place(Entry e, uint64_t earliest);
+  void cascade(int level);
+
+  std::vector<Entry> slots_[kLevels][kSlots];
+  uint64_t tick_ms_;
+  uint64_t current_;  // last tick processed
+  std::size_t size_ = 0;
+};
+
+}  // namespace kv
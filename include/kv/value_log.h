@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kv {
+
+// v0.9: where a value-log record lives. The index (shard tables, WAL,
+// snapshots, SSTables) stores this encoding in place of large values.
+struct ValuePointer {
+  static constexpr std::size_t kEncodedSize = 4 + 8 + 4;
+
+  uint32_t file = 0;
+  uint64_t offset = 0;  // start of the record
+  uint32_t len = 0;     // value bytes
+
+  std::string encode() const;
+  static bool decode(std::string_view bytes, ValuePointer* out);
+};
+
+// v0.9: append-only value log (WiscKey-style key/value separation).
+//
+// Values are written here once; everything else refers to them by pointer.
+// Files are "<dir>/NNNNNN.vlog", each a run of records
+//
+//   u32 crc | u32 key_len | u32 val_len | key | value
+//
+// (crc covers everything after it). The key lets garbage collection check
+// whether a record is still the live version of its key. Every open starts a
+// new file; a crash can leave unreferenced records at the tail, which GC
+// treats as garbage.
+//
+// Appends and reads are thread-safe. Records are written straight to the
+// file (no user-space buffer), so they are readable as soon as append()
+// returns; sync() makes them durable and must precede the WAL flush that
+// makes their pointers durable.
+class ValueLog {
+ public:
+  ~ValueLog();
+
+  bool open(const std::string& dir, std::size_t file_bytes);
+  bool is_open() const { return open_; }
+
+  bool append(std::string_view key, std::string_view value, ValuePointer* ptr);
+  bool sync();
+
+  // False if the file is gone (collected) or the record does not check out.
+  bool read(const ValuePointer& ptr, std::string_view key, std::string* value) const;
+
+  // Files no longer appended to, oldest first.
+  std::vector<uint32_t> sealed_files() const;
+  uint64_t file_size(uint32_t file) const;
+
+  // fn(key, pointer) for every intact record of `file`, in file order.
+  bool for_each_record(uint32_t file,
+                       const std::function<void(std::string_view, const ValuePointer&)>& fn) const;
+
+  // Unlink a sealed file. Readers that still resolve pointers into it fail.
+  bool remove_file(uint32_t file);
+
+ private:
+  struct File {
+    ~File();
+    int fd = -1;
+    uint64_t size = 0;
+  };
+
+  std::string path_of(uint32_t file) const;
+  bool open_active_locked(uint32_t number);  // caller holds append_mu_
+  std::shared_ptr<File> find(uint32_t file) const;
+
+  std::string dir_;
+  std::size_t file_bytes_ = 0;
+  bool open_ = false;  // set once by open()
+
+  mutable std::shared_mutex mu_;  // guards files_
+  std::map<uint32_t, std::shared_ptr<File>> files_;
+
+  std::mutex append_mu_;  // guards the fields below and active_->size
+  std::shared_ptr<File> active_;  // replaced under both locks
+  uint32_t active_number_ = 0;
+  bool dirty_ = false;  // appended since the last sync
+};
+
+}  // namespace kv
@@ -1,16 +1,47 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>   // <-- add
 #include <iostream>
+#include <memory>
+
+#include "kv/io_backend.h"
 
 namespace kv {
 
 class Wal {
  public:
-  enum class Type : uint8_t { Put = 1, Del = 2 };
+  // PutRef: the value is an encoded ValuePointer into the value log.
+  // PutTtl: value slot is u64 expires_at (unix ms) | u8 is_ref | value.
+  // Expire: key only; the TTL of the key's current version ran out.
+  // BatchLz4: a Batch whose value slot is u32 payload bytes | LZ4 block; the
+  // CRC covers the compressed bytes.
+  enum class Type : uint8_t {
+    Put = 1, Del = 2, Batch = 3, PutRef = 4, PutTtl = 5, Expire = 6, BatchLz4 = 7
+  };
+
+  // v0.9: the log is a sequence of fixed-size segment files under
+  // "<path>.seg/", each preallocated and zero-filled when created, so
+  // appends never change a file's size and fdatasync skips the metadata
+  // write. A MANIFEST lists the live segments, the sequence-number floor of
+  // each (a recycled file still holds older records, all at or below it) and
+  // where each sealed segment ends. Segments released by a checkpoint are
+  // renamed into a free pool and reused. A single-file log left at `path`
+  // (and "<path>.old") by an older build is replayed ahead of the segments
+  // and removed by the first release. The MANIFEST also records the last
+  // checkpoint (see Checkpoint).
+  static constexpr std::size_t kDefaultSegmentBytes = std::size_t{16} << 20;
+  static constexpr auto kNoDeadline = std::chrono::steady_clock::time_point::max();
+  static constexpr uint64_t kNoRotation = ~uint64_t{0};
 
   Wal() = default;
   ~Wal();
@@ -18,26 +49,235 @@ class Wal {
   Wal(const Wal&) = delete;
   Wal& operator=(const Wal&) = delete;
 
-  bool open(const std::string& path);
+  // v0.9: segment writes and their fdatasync go through an IoBackend
+  // (io_uring: one linked write+fsync submission per group, the arenas
+  // registered as fixed buffers). With `direct_io` segments are opened
+  // O_DIRECT and written in whole blocks from an aligned staging buffer.
+  bool open(const std::string& path, std::size_t segment_bytes = kDefaultSegmentBytes,
+            IoBackend::Kind io = IoBackend::Kind::kSync, bool direct_io = false);
 
   void close();
 
   // Returns false only on hard I/O error. Corrupt/truncated tail is treated as normal boundary.
-  bool replay_into(class KVStore& store, uint64_t& max_seq);
+  // v0.9: every log file is mmap'd and cut into chunks; worker threads find
+  // the record boundaries and verify checksums while this thread applies
+  // the verified chunks in log order. Prints the replay throughput.
+  // Records with seq <= skip_through are read (and count towards max_seq) but
+  // not applied; batches are skipped whole, and so are sealed segments that
+  // hold nothing newer (the next segment's floor says so): those are not
+  // even mapped. max_seq also covers the floors
+  // of the live segments, so sequence numbers never go backwards. Ends by
+  // starting a fresh active segment; appends fail until it has run.
+  bool replay_into(class KVStore& store, uint64_t& max_seq, uint64_t skip_through = 0);
+  // What the last replay_into() read (skipped segments aside) and how long
+  // it took.
+  struct ReplayStats {
+    uint64_t bytes = 0;
+    uint64_t records = 0;  // applied, past skip_through; a batch counts once
+    double seconds = 0;
+  };
+  ReplayStats replay_stats() const { return replay_stats_; }
+
+  // Rotation at a sequence number, without waiting for I/O: the writer
+  // seals the active segment just before the first record above `seq` (the
+  // caller's sequencing lock keeps such records out until this returns).
+  void rotate_after(uint64_t seq);
+  // Completes rotate_after(): seals the active segment now if the writer
+  // has not reached a newer record yet. Returns the number of the segment
+  // that follows, 0 on failure. Every record above `seq` is in that segment
+  // or a later one; records <= seq still queued may follow them there.
+  uint64_t finish_rotation();
+  // v0.9: the snapshot file that holds every record <= seq (an empty path:
+  // no checkpoint yet). Replay can skip the sealed segments it covers.
+  struct Checkpoint {
+    uint64_t seq = 0;
+    std::string snapshot_path;
+  };
+  // As read by open(), or set since.
+  Checkpoint checkpoint();
+  // False after open() when the log predates checkpoint records (a v1
+  // MANIFEST or a single-file log): its snapshot, if any, is wherever the
+  // older build put it.
+  bool checkpoint_recorded() const { return checkpoint_recorded_; }
+  // Recorded with the next MANIFEST write.
+  void set_checkpoint(const Checkpoint& checkpoint);
+
+  // Recycle every segment ahead of `segment` (a finish_rotation() result)
+  // in the log and any legacy single-file log, once their records are
+  // covered elsewhere. With `checkpoint`, the same MANIFEST write records
+  // it.
+  bool release_before(uint64_t segment, const Checkpoint* checkpoint = nullptr);
+
+  // v0.9 log cleaning. Rewrites every sealed segment into one new sealed
+  // segment holding only the records `live(key, seq, is_delete)` accepts.
+  // Batches are split into their operations, and of a key's live deletes
+  // only the newest is kept. Then it makes every appended record durable
+  // (the ones that superseded what was dropped) and swaps the new segment
+  // in with one MANIFEST write. Appends carry on meanwhile. Must not overlap
+  // a rotate_after() ... release_before() sequence; the store serializes
+  // them.
+  struct CompactStats {
+    std::size_t segments = 0;  // sealed segments rewritten
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t records_in = 0;  // operations, batches counted by their size
+    uint64_t records_out = 0;
+  };
+  using LiveFn = std::function<bool(std::string_view key, uint64_t seq, bool is_delete)>;
+  bool compact(const LiveFn& live, CompactStats* stats = nullptr);
+  // Bytes held by the sealed segments.
+  uint64_t sealed_bytes();
+  // Bytes of records in all live segments, the active one included.
+  uint64_t log_bytes();
 
   bool append_put(uint64_t seq, std::string_view key, std::string_view value);
   bool append_del(uint64_t seq, std::string_view key);
+  bool append_put_ref(uint64_t seq, std::string_view key, std::string_view encoded_pointer);
+  // v0.9 TTL: `value` is an encoded ValuePointer when value_ref is set.
+  bool append_put_ttl(uint64_t seq, std::string_view key, std::string_view value,
+                      bool value_ref, uint64_t expires_at);
+  bool append_expire(uint64_t seq, std::string_view key);
+  // v0.9: one framed record (single CRC) for a WriteBatch payload holding
+  // `count` operations with sequence numbers first_seq .. first_seq+count-1.
+  // Replay applies all of them or none.
+  bool append_batch(uint64_t first_seq, uint32_t count, std::string_view payload);
+  // v0.9: with kLz4, batch payloads that shrink are logged as BatchLz4.
+  // Appends are serialized by the caller, so set it between them.
+  void set_compression(Options::Compression c) { compression_ = c; }
 
-  bool truncate_to_last_good();
+  // Make every record appended so far durable and wait for it.
   bool flush();
 
+  // v0.9 group commit. Appends serialize the record into an append arena; a
+  // writer thread (started by the first append) swaps it for its second
+  // arena, writes the group with one write and one fdatasync per segment it
+  // touches, and wakes the writers waiting on it. Records are numbered in append order (LSN); no
+  // caller lock is held for the I/O.
+  //
+  // LSN of the newest appended record. Appends are serialized by the caller.
+  uint64_t last_lsn() const { return appended_.load(std::memory_order_relaxed); }
+  // Block until record `lsn` is durable. False if a group failed to sync
+  // while waiting (the writer keeps retrying) or the log is closed.
+  bool wait_durable(uint64_t lsn);
+  // v0.9 durability modes. The writer thread only writes when there is
+  // something to wait for: a wait_durable() or flush() caller, a sync
+  // deadline set here, or a write_back_soon() request. Appends that nobody
+  // waits for say by when they must be durable instead:
+  //
+  // Sync everything appended so far within `d` (an earlier deadline wins).
+  void sync_within(std::chrono::microseconds d);
+  // Write everything appended so far right away and start its writeback
+  // with sync_file_range instead of fdatasync. It becomes durable with the
+  // next sync (any waiter, deadline, flush or segment seal).
+  void write_back_soon();
+  // With several writers committing, the writer thread holds a group open
+  // for up to this long while it is smaller than recent groups.
+  void set_max_group_delay(std::chrono::microseconds delay);
+  // Runs before each group is written (the store syncs the value log, whose
+  // records the group may point at).
+  void set_before_write(std::function<bool()> fn);
+
  private:
-  bool write_record(Type t, uint64_t seq, std::string_view key, std::string_view value);
-  std::vector<std::string> buffer_;
+  // `prefix` is written in front of `value` as part of the same value slot.
+  bool write_record(Type t, uint64_t seq, std::string_view key, std::string_view value,
+                    uint32_t batch_count = 0, std::string_view prefix = {});
+  void writer_loop();
+  // Writes whole records, rolling over to a new segment when the next one
+  // does not fit, and syncs. `done_bytes`/`done_records` report the prefix
+  // that is durable even on failure; a retry rewrites the rest at the same
+  // offset, so nothing is ever truncated. Caller holds io_mu_.
+  // Without `sync` the records are only written (writeback started), and an
+  // empty group with `sync` syncs what earlier ones left unsynced.
+  bool write_group_locked(std::string_view group, bool sync, std::size_t* done_bytes,
+                          std::size_t* done_records);
+  // Writes `n` bytes at write_off_, and syncs them with `sync`. Caller holds
+  // io_mu_.
+  bool write_out_locked(const char* data, std::size_t n, bool sync);
+  // Registers the writer's arena with the backend when it is new or has
+  // been reallocated. Caller holds io_mu_.
+  void pin_arena_locked(const std::string& arena);
+  void stop_writer();
+
+  struct Segment {
+    uint64_t number;
+    uint64_t floor_seq;  // every record in it has a larger seq
+    uint64_t end;        // sealed length; 0 while active
+  };
+
+  // Applies the already verified records in [from, to) of a mapped log, in
+  // order. A record at or below `floor_seq` (left in a recycled segment by
+  // its previous use) or one that does not decode ends the file. Returns
+  // the offset after the last record applied; `records` counts those
+  // above `skip_through`.
+  uint64_t apply_records(const char* base, uint64_t from, uint64_t to, uint64_t floor_seq,
+                         KVStore& store, uint64_t& max_seq, uint64_t skip_through,
+                         uint64_t& records);
+
+  std::string segment_path(uint64_t number) const;
+  std::string free_path(uint64_t number) const;
+  // Caller holds io_mu_ for all three.
+  bool write_manifest_locked();
+  // Seal the active segment at write_off_ and open a new one from the free
+  // pool (or a newly preallocated file).
+  bool roll_over_locked(uint64_t floor_seq);
+  // Into the free pool if it has room, else deleted (or, with
+  // `unlink_later`, queued for the caller to delete after unlocking).
+  void release_file_locked(uint64_t number, std::vector<std::string>* unlink_later = nullptr);
+  // Run by the writer thread, outside io_mu_, whenever the free pool ran dry.
+  void prepare_spare();
+
+  std::mutex mu_;  // guards the queue state below
+  std::condition_variable work_cv_;  // writer: records queued, flush, stop
+  std::condition_variable done_cv_;  // waiters: a group finished
+  std::string buffer_;  // queued records, serialized back to back
+  std::size_t buffered_ = 0;  // records in buffer_
+  std::atomic<uint64_t> appended_{0};
+  uint64_t written_ = 0;  // records written to a segment, maybe not synced
+  uint64_t durable_ = 0;
+  uint64_t wanted_ = 0;   // highest LSN a wait_durable() caller waits for
+  std::chrono::steady_clock::time_point deadline_ = kNoDeadline;  // sync_within()
+  bool writeback_ = false;  // write_back_soon() since the last group
+  bool gathering_ = false;  // the writer holds a group open for more records
+  uint64_t failures_ = 0;  // failed group writes, for waiters to notice
+  bool flush_requested_ = false;
+  bool stop_ = false;
+  bool writer_idle_ = false;
+  std::size_t group_target_ = 1;  // smoothed recent group size
+  std::chrono::microseconds max_group_delay_{100};
+  std::function<bool()> before_write_;
+  Options::Compression compression_ = Options::Compression::kNone;
+  std::thread writer_;
+
+  std::atomic<bool> ready_{false};  // an active segment is open
+  std::atomic<bool> spare_needed_{false};
 
-  int fd_ = -1;
+  std::mutex io_mu_;  // held for I/O and segment changes; guards the state below
+  int fd_ = -1;        // active segment
+  uint64_t write_off_ = 0;
+  bool unsynced_ = false;  // the active segment has writes not yet synced
+  uint64_t written_seq_ = 0;  // highest seq written to a segment
+  // rotate_after()'s seq until the segment is sealed (kNoRotation: none),
+  // then the segment that followed.
+  std::atomic<uint64_t> rotate_after_{kNoRotation};
+  uint64_t rotated_to_ = 0;
+  std::vector<Segment> live_;  // oldest first; back() is active once ready_
+  std::vector<uint64_t> free_;  // recyclable files, "free-NNNNNN.log"
+  std::vector<std::string> legacy_;  // single-file logs, replayed first
+  Checkpoint checkpoint_;
+  bool checkpoint_recorded_ = true;
+  ReplayStats replay_stats_;
+  uint64_t next_segment_ = 1;
+  std::size_t segment_bytes_ = kDefaultSegmentBytes;
+  std::unique_ptr<IoBackend> io_;
+  const char* pinned_[2] = {nullptr, nullptr};  // arenas registered in slots 0, 1
+  std::size_t pinned_bytes_[2] = {0, 0};
+  unsigned next_pin_ = 0;
+  bool direct_io_ = false;
+  std::unique_ptr<char, void (*)(void*)> direct_buf_{nullptr, std::free};  // block aligned
+  std::size_t direct_bytes_ = 0;
+  std::size_t tail_len_ = 0;  // write_off_ % block, kept at the front of direct_buf_
   std::string path_;
-  uint64_t last_good_offset_ = 0;
+  std::string dir_;
 };
 
 }  // namespace kv
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace kv {
+
+// v0.9: ordered group of puts and deletes applied atomically by
+// KVStore::write().
+//
+// Operations are encoded on the fly into the same byte layout the WAL uses
+// for a batch record payload, so logging a batch is a single copy:
+//
+//   repeated { u8 type | u32 key_len | u32 val_len | key | value }
+class WriteBatch {
+ public:
+  // PutRef (value is an encoded ValuePointer) only appears in batches the
+  // store logs after moving large values to the value log.
+  enum class OpType : uint8_t { Put = 1, Del = 2, PutRef = 3 };
+
+  void put(std::string_view key, std::string_view value) {
+    append(OpType::Put, key, value);
+  }
+  void del(std::string_view key) { append(OpType::Del, key, {}); }
+
+  void clear() {
+    rep_.clear();
+    count_ = 0;
+  }
+
+  uint32_t count() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  // Encoded operations (the WAL batch payload).
+  std::string_view data() const { return rep_; }
+
+  // Calls fn(OpType, key, value) for each operation in order.
+  template <class Fn>
+  void for_each(Fn&& fn) const {
+    (void)for_each_in(rep_, fn);
+  }
+
+  // Decode an encoded payload (e.g. from WAL replay). Returns false without
+  // calling fn if the payload is malformed, so a batch is all or nothing.
+  template <class Fn>
+  static bool for_each_in(std::string_view rep, Fn&& fn) {
+    if (!validate(rep)) return false;
+    std::size_t pos = 0;
+    while (pos < rep.size()) {
+      const auto type = static_cast<OpType>(rep[pos]);
+      uint32_t klen = 0;
+      uint32_t vlen = 0;
+      std::memcpy(&klen, rep.data() + pos + 1, sizeof(klen));
+      std::memcpy(&vlen, rep.data() + pos + 5, sizeof(vlen));
+      pos += kOpHeader;
+      const std::string_view key = rep.substr(pos, klen);
+      const std::string_view value = rep.substr(pos + klen, vlen);
+      pos += static_cast<std::size_t>(klen) + vlen;
+      fn(type, key, value);
+    }
+    return true;
+  }
+
+  // Number of operations in a well-formed payload, 0 otherwise.
+  static uint32_t count_in(std::string_view rep);
+
+ private:
+  friend class KVStore;
+  static constexpr std::size_t kOpHeader = 1 + 4 + 4;
+
+  void put_ref(std::string_view key, std::string_view encoded_pointer) {
+    append(OpType::PutRef, key, encoded_pointer);
+  }
+
+  static bool validate(std::string_view rep);
+  void append(OpType type, std::string_view key, std::string_view value);
+
+  std::string rep_;
+  uint32_t count_ = 0;
+};
+
+}  // namespace kv
@@ -0,0 +1,92 @@
+#include "kv/arena.h"
+
+#include <bit>
+#include <new>
+
+namespace kv {
+
+Arena::~Arena() { reset(); }
+
+std::size_t Arena::class_index(std::size_t n) {
+  if (n == 0) n = 1;
+  if (n <= 128) return (n + 7) / 8 - 1;
+
+  // (base, 2*base] split into four equal steps.
+  const std::size_t p = static_cast<std::size_t>(std::bit_width(n - 1));
+  const std::size_t base = std::size_t{1} << (p - 1);
+  const std::size_t step = base / 4;
+  const std::size_t k = (n - base + step - 1) / step;
+  return 16 + (p - 8) * 4 + (k - 1);
+}
+
+std::size_t Arena::class_size(std::size_t idx) {
+  if (idx < 16) return (idx + 1) * 8;
+  const std::size_t g = (idx - 16) / 4;
+  const std::size_t k = (idx - 16) % 4 + 1;
+  const std::size_t base = std::size_t{128} << g;
+  return base + k * (base / 4);
+}
+
+std::size_t Arena::rounded_size(std::size_t n) {
+  if (n > kMaxSmall) return n;
+  return class_size(class_index(n));
+}
+
+void* Arena::allocate(std::size_t n) {
+  if (n > kMaxSmall) {
+    large_bytes_ += n;
+    in_use_bytes_ += n;
+    return ::operator new(n);
+  }
+
+  const std::size_t idx = class_index(n);
+  const std::size_t size = class_size(idx);
+  in_use_bytes_ += size;
+
+  if (FreeBlock* b = free_[idx]) {
+    free_[idx] = b->next;
+    return b;
+  }
+
+  if (bump_left_ < size) {
+    // The slab tail is too small for this class; it is simply abandoned.
+    slabs_.emplace_back(new char[kSlabBytes]);
+    slab_bytes_ += kSlabBytes;
+    bump_ = slabs_.back().get();
+    bump_left_ = kSlabBytes;
+  }
+
+  void* p = bump_;
+  bump_ += size;
+  bump_left_ -= size;
+  return p;
+}
+
+void Arena::deallocate(void* p, std::size_t n) {
+  if (p == nullptr) return;
+  if (n > kMaxSmall) {
+    large_bytes_ -= n;
+    in_use_bytes_ -= n;
+    ::operator delete(p, n);
+    return;
+  }
+
+  const std::size_t idx = class_index(n);
+  in_use_bytes_ -= class_size(idx);
+  auto* b = static_cast<FreeBlock*>(p);
+  b->next = free_[idx];
+  free_[idx] = b;
+}
+
+void Arena::reset() {
+  // Large blocks are owned by their users (the table frees them before
+  // resetting); only slab memory is released here.
+  for (auto& f : free_) f = nullptr;
+  slabs_.clear();
+  bump_ = nullptr;
+  bump_left_ = 0;
+  slab_bytes_ = 0;
+  in_use_bytes_ = large_bytes_;
+}
+
+}  // namespace kv
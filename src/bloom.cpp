@@ -0,0 +1,61 @@
+#include "kv/bloom.h"
+
+#include <algorithm>
+
+namespace kv {
+
+uint64_t BloomBuilder::hash(std::string_view key) {
+  // FNV-1a with a final avalanche (splitmix64) so both halves are usable.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+std::string BloomBuilder::finish() const {
+  // k = bits_per_key * ln 2, clamped to a sane range.
+  const int k = std::clamp(static_cast<int>(bits_per_key_ * 0.69), 1, 30);
+  std::size_t bits = std::max<std::size_t>(hashes_.size() * bits_per_key_, 64);
+  const std::size_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+
+  std::string filter(bytes + 1, '\0');
+  for (uint64_t h : hashes_) {
+    uint64_t a = h;
+    const uint64_t delta = (h >> 33) | (h << 31);
+    for (int i = 0; i < k; ++i) {
+      const std::size_t bit = a % bits;
+      filter[bit / 8] = static_cast<char>(filter[bit / 8] | (1 << (bit % 8)));
+      a += delta;
+    }
+  }
+  filter[bytes] = static_cast<char>(k);
+  return filter;
+}
+
+bool bloom_may_contain(std::string_view filter, std::string_view key) {
+  if (filter.size() < 2) return true;
+  const std::size_t bytes = filter.size() - 1;
+  const std::size_t bits = bytes * 8;
+  const int k = static_cast<unsigned char>(filter[bytes]);
+  if (k < 1 || k > 30) return true;  // unknown encoding: never rule out
+
+  const uint64_t h = BloomBuilder::hash(key);
+  uint64_t a = h;
+  const uint64_t delta = (h >> 33) | (h << 31);
+  for (int i = 0; i < k; ++i) {
+    const std::size_t bit = a % bits;
+    if ((static_cast<unsigned char>(filter[bit / 8]) & (1 << (bit % 8))) == 0) return false;
+    a += delta;
+  }
+  return true;
+}
+
+}  // namespace kv
@@ -0,0 +1,162 @@
+#include "kv/compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+namespace kv {
+
+namespace {
+
+// LZ4 block format rules: a match is at least kMinMatch bytes, the last
+// kLastLiterals bytes are always literals and no match starts within the
+// last kMatchSearchEnd bytes.
+constexpr std::size_t kMinMatch = 4;
+constexpr std::size_t kLastLiterals = 5;
+constexpr std::size_t kMatchSearchEnd = 12;
+constexpr std::size_t kMaxOffset = 65535;
+constexpr int kMaxHashBits = 14;
+// Every 2^kSkipShift misses in a row widen the search step by one, so
+// incompressible input is skipped over quickly.
+constexpr unsigned kSkipShift = 6;
+
+uint32_t load32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t hash4(uint32_t v, int bits) { return (v * 2654435761u) >> (32 - bits); }
+
+void put_length(std::string& out, std::size_t n) {
+  for (; n >= 255; n -= 255) out.push_back(static_cast<char>(255));
+  out.push_back(static_cast<char>(n));
+}
+
+// One sequence: literals, then a match (none for the last sequence).
+void put_sequence(std::string& out, const uint8_t* literals, std::size_t literal_len,
+                  std::size_t offset, std::size_t match_len) {
+  const std::size_t ml = match_len == 0 ? 0 : match_len - kMinMatch;
+  out.push_back(static_cast<char>((std::min<std::size_t>(literal_len, 15) << 4) |
+                                  std::min<std::size_t>(ml, 15)));
+  if (literal_len >= 15) put_length(out, literal_len - 15);
+  out.append(reinterpret_cast<const char*>(literals), literal_len);
+  if (match_len == 0) return;
+  out.push_back(static_cast<char>(offset & 0xff));
+  out.push_back(static_cast<char>(offset >> 8));
+  if (ml >= 15) put_length(out, ml - 15);
+}
+
+// Reads an extended length (after a nibble of 15). False if cut short.
+bool get_length(const uint8_t* in, std::size_t n, std::size_t& ip, std::size_t& len) {
+  uint8_t b = 0;
+  do {
+    if (ip >= n) return false;
+    b = in[ip++];
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+}  // namespace
+
+bool lz4_compress(std::string_view in, std::string& out) {
+  const std::size_t n = in.size();
+  if (n <= kMatchSearchEnd || n > std::numeric_limits<uint32_t>::max()) return false;
+  const auto* src = reinterpret_cast<const uint8_t*>(in.data());
+  const std::size_t start = out.size();
+  const std::size_t budget = n - n / 8;
+
+  // Small inputs get a small table: clearing it is a per-call cost.
+  int bits = 8;
+  while (bits < kMaxHashBits && (std::size_t{1} << bits) < n) ++bits;
+  std::unique_ptr<uint32_t[]> table(new uint32_t[std::size_t{1} << bits]());
+
+  const std::size_t search_end = n - kMatchSearchEnd;
+  const std::size_t match_end = n - kLastLiterals;
+  std::size_t anchor = 0;
+  std::size_t ip = 0;
+  while (ip < search_end) {
+    std::size_t ref = 0;
+    bool found = false;
+    for (unsigned misses = 1u << kSkipShift; ip < search_end; ip += misses++ >> kSkipShift) {
+      const uint32_t v = load32(src + ip);
+      uint32_t& slot = table[hash4(v, bits)];
+      ref = slot;
+      slot = static_cast<uint32_t>(ip);
+      if (ref < ip && ip - ref <= kMaxOffset && load32(src + ref) == v) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) break;
+
+    while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+      --ip;
+      --ref;
+    }
+    std::size_t len = kMinMatch;
+    while (ip + len < match_end && src[ip + len] == src[ref + len]) ++len;
+
+    put_sequence(out, src + anchor, ip - anchor, ip - ref, len);
+    if (out.size() - start >= budget) {
+      out.resize(start);
+      return false;
+    }
+    ip += len;
+    anchor = ip;
+    if (ip < search_end) table[hash4(load32(src + ip - 2), bits)] = static_cast<uint32_t>(ip - 2);
+  }
+  put_sequence(out, src + anchor, n - anchor, 0, 0);
+  if (out.size() - start >= budget) {
+    out.resize(start);
+    return false;
+  }
+  return true;
+}
+
+bool lz4_decompress(std::string_view in, std::size_t raw_len, std::string& out) {
+  const std::size_t base = out.size();
+  out.resize(base + raw_len);
+  auto* dst = reinterpret_cast<uint8_t*>(out.data() + base);
+  const auto* src = reinterpret_cast<const uint8_t*>(in.data());
+  const std::size_t n = in.size();
+  std::size_t ip = 0;
+  std::size_t op = 0;
+  auto fail = [&] {
+    out.resize(base);
+    return false;
+  };
+
+  while (ip < n) {
+    const uint8_t token = src[ip++];
+    std::size_t literal_len = token >> 4;
+    if (literal_len == 15 && !get_length(src, n, ip, literal_len)) return fail();
+    if (literal_len > n - ip || literal_len > raw_len - op) return fail();
+    std::memcpy(dst + op, src + ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+    if (ip == n) break;  // the last sequence has no match
+
+    if (n - ip < 2) return fail();
+    const std::size_t offset = src[ip] | static_cast<std::size_t>(src[ip + 1]) << 8;
+    ip += 2;
+    if (offset == 0 || offset > op) return fail();
+    std::size_t match_len = token & 15;
+    if (match_len == 15 && !get_length(src, n, ip, match_len)) return fail();
+    match_len += kMinMatch;
+    if (match_len > raw_len - op) return fail();
+    // The match may overlap what it produces: copy in runs of `offset`.
+    for (std::size_t done = 0; done < match_len;) {
+      const std::size_t run = std::min(offset, match_len - done);
+      std::memcpy(dst + op + done, dst + op + done - offset, run);
+      done += run;
+    }
+    op += match_len;
+  }
+  return op == raw_len ? true : fail();
+}
+
+}  // namespace kv
@@ -0,0 +1,172 @@
+#include "kv/crc32.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KV_CRC32C_X86 1
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace kv {
+namespace {
+
+constexpr uint32_t kIeeePoly = 0xEDB88320u;
+constexpr uint32_t kCastagnoliPoly = 0x82F63B78u;
+
+using SliceTables = std::array<std::array<uint32_t, 256>, 8>;
+
+// tables[0] is the classic byte table; tables[k][b] is the CRC of byte b
+// followed by k zero bytes, so eight bytes fold in with eight lookups.
+constexpr SliceTables make_tables(uint32_t poly) {
+  SliceTables t{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? (poly ^ (c >> 1)) : (c >> 1);
+    t[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    for (std::size_t k = 1; k < 8; ++k) t[k][i] = t[0][t[k - 1][i] & 0xFFu] ^ (t[k - 1][i] >> 8);
+  }
+  return t;
+}
+
+constexpr SliceTables kIeeeTables = make_tables(kIeeePoly);
+constexpr SliceTables kCastagnoliTables = make_tables(kCastagnoliPoly);
+
+// Raw (non-inverted) state in, raw state out. Little-endian word loads.
+uint32_t slice_by_8(const SliceTables& t, uint32_t crc, const uint8_t* p, std::size_t n) {
+  while (n >= 8) {
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    std::memcpy(&lo, p, 4);
+    std::memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFFu] ^ t[6][(lo >> 8) & 0xFFu] ^ t[5][(lo >> 16) & 0xFFu] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xFFu] ^ t[2][(hi >> 8) & 0xFFu] ^
+          t[1][(hi >> 16) & 0xFFu] ^ t[0][hi >> 24];
+    p += 8;
+    n -= 8;
+  }
+  while (n-- > 0) crc = t[0][(crc ^ *p++) & 0xFFu] ^ (crc >> 8);
+  return crc;
+}
+
+uint32_t crc32c_portable(uint32_t crc, const uint8_t* p, std::size_t n) {
+  return ~slice_by_8(kCastagnoliTables, ~crc, p, n);
+}
+
+#ifdef KV_CRC32C_X86
+
+// GF(2) arithmetic modulo the Castagnoli polynomial in the reflected
+// representation (bit 31 is x^0), for the stream-joining constants.
+constexpr uint32_t mult_mod_p(uint32_t a, uint32_t b) {
+  uint32_t p = 0;
+  for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+    if (a & m) p ^= b;
+    b = (b & 1) ? (b >> 1) ^ kCastagnoliPoly : b >> 1;
+  }
+  return p;
+}
+
+constexpr uint32_t x_pow_mod_p(uint64_t n) {
+  uint32_t r = 1u << 31;  // x^0
+  uint32_t sq = 1u << 30;  // x^1
+  for (; n != 0; n >>= 1) {
+    if (n & 1) r = mult_mod_p(r, sq);
+    sq = mult_mod_p(sq, sq);
+  }
+  return r;
+}
+
+// The crc32 instruction has a 3-cycle latency but issues every cycle, so
+// long buffers run as three independent streams of kLane bytes. A stream's
+// state is moved past the kLane * k bytes after it by a carry-less multiply
+// with x^(8 * kLane * k - 33): the reflected 64-bit product gains a factor
+// of x, and crc32(0, .) multiplies by x^32 while reducing it.
+constexpr std::size_t kLane = 1024;
+constexpr uint32_t kShift1 = x_pow_mod_p(8 * kLane - 33);
+constexpr uint32_t kShift2 = x_pow_mod_p(8 * 2 * kLane - 33);
+
+__attribute__((target("sse4.2"))) uint32_t crc32c_words(uint32_t crc, const uint8_t*& p,
+                                                        std::size_t& n) {
+  uint64_t c = crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t w = 0;
+    std::memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+  }
+  return static_cast<uint32_t>(c);
+}
+
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p,
+                                                        std::size_t n) {
+  crc = ~crc;
+  crc = crc32c_words(crc, p, n);
+  while (n-- > 0) crc = _mm_crc32_u8(crc, *p++);
+  return ~crc;
+}
+
+__attribute__((target("sse4.2,pclmul"))) uint32_t shift_state(uint32_t crc, uint32_t k) {
+  const __m128i prod =
+      _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                           _mm_cvtsi32_si128(static_cast<int>(k)), 0x00);
+  return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(prod))));
+}
+
+__attribute__((target("sse4.2,pclmul"))) uint32_t crc32c_sse42_pclmul(uint32_t crc,
+                                                                      const uint8_t* p,
+                                                                      std::size_t n) {
+  crc = ~crc;
+  while (n >= 3 * kLane) {
+    uint64_t a = crc;
+    uint64_t b = 0;
+    uint64_t c = 0;
+    for (std::size_t i = 0; i < kLane; i += 8) {
+      uint64_t wa = 0;
+      uint64_t wb = 0;
+      uint64_t wc = 0;
+      std::memcpy(&wa, p + i, 8);
+      std::memcpy(&wb, p + kLane + i, 8);
+      std::memcpy(&wc, p + 2 * kLane + i, 8);
+      a = _mm_crc32_u64(a, wa);
+      b = _mm_crc32_u64(b, wb);
+      c = _mm_crc32_u64(c, wc);
+    }
+    crc = shift_state(static_cast<uint32_t>(a), kShift2) ^
+          shift_state(static_cast<uint32_t>(b), kShift1) ^ static_cast<uint32_t>(c);
+    p += 3 * kLane;
+    n -= 3 * kLane;
+  }
+  crc = crc32c_words(crc, p, n);
+  while (n-- > 0) crc = _mm_crc32_u8(crc, *p++);
+  return ~crc;
+}
+
+#endif  // KV_CRC32C_X86
+
+using Crc32cFn = uint32_t (*)(uint32_t, const uint8_t*, std::size_t);
+
+Crc32cFn pick_crc32c() {
+#ifdef KV_CRC32C_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    return __builtin_cpu_supports("pclmul") ? crc32c_sse42_pclmul : crc32c_sse42;
+  }
+#endif
+  return crc32c_portable;
+}
+
+}  // namespace
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, std::size_t n) {
+  return ~slice_by_8(kIeeeTables, ~crc, data, n);
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, std::size_t n) {
+  static const Crc32cFn fn = pick_crc32c();  // initialized once, thread-safe
+  return fn(crc, data, n);
+}
+
+}  // namespace kv
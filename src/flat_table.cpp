@@ -0,0 +1,309 @@
+#include "kv/flat_table.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace kv {
+namespace {
+
+constexpr int8_t kCtrlEmpty = -128;
+
+#if defined(__SSE2__)
+
+// 16 control bytes compared with one SSE2 instruction; one result bit per slot.
+struct Group {
+  static constexpr std::size_t kWidth = 16;
+
+  explicit Group(const int8_t* p)
+      : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+
+  uint32_t match(int8_t tag) const {
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl)));
+  }
+  uint32_t match_empty() const { return match(kCtrlEmpty); }
+  // Empty (-128) and deleted (-2) are the only negative control bytes.
+  uint32_t match_empty_or_deleted() const {
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_setzero_si128(), ctrl)));
+  }
+
+  static std::size_t lowest(uint64_t bits) {
+    return static_cast<std::size_t>(std::countr_zero(bits));
+  }
+
+  __m128i ctrl;
+};
+
+#else
+
+// Portable fallback: 8 control bytes per 64-bit word (SWAR). Result bits are
+// the high bit of each matching byte. match() may report false positives,
+// which the key comparison filters out.
+struct Group {
+  static constexpr std::size_t kWidth = 8;
+  static constexpr uint64_t kLsbs = 0x0101010101010101ULL;
+  static constexpr uint64_t kMsbs = 0x8080808080808080ULL;
+
+  explicit Group(const int8_t* p) { std::memcpy(&ctrl, p, sizeof(ctrl)); }
+
+  uint64_t match(int8_t tag) const {
+    const uint64_t x = ctrl ^ (kLsbs * static_cast<uint8_t>(tag));
+    return (x - kLsbs) & ~x & kMsbs;
+  }
+  uint64_t match_empty() const { return (ctrl & ~(ctrl << 6)) & kMsbs; }
+  uint64_t match_empty_or_deleted() const { return ctrl & kMsbs; }
+
+  static std::size_t lowest(uint64_t bits) {
+    return static_cast<std::size_t>(std::countr_zero(bits)) >> 3;
+  }
+
+  uint64_t ctrl;
+};
+
+#endif
+
+constexpr std::size_t kMinCapacity = 16;
+static_assert(kMinCapacity >= Group::kWidth);
+
+std::size_t max_load(std::size_t capacity) { return capacity - capacity / 8; }
+
+}  // namespace
+
+uint64_t FlatTable::hash(std::string_view key) {
+  return std::hash<std::string_view>{}(key);
+}
+
+FlatTable::~FlatTable() { clear(); }
+
+KeyRec* FlatTable::make_key(std::string_view key) {
+  void* p = arena_.allocate(sizeof(KeyRec) + key.size());
+  auto* k = new (p) KeyRec{nullptr, static_cast<uint32_t>(key.size()), 0};
+  if (!key.empty()) std::memcpy(const_cast<char*>(k->data()), key.data(), key.size());
+  return k;
+}
+
+ValueRec* FlatTable::make_value(std::string_view value, uint64_t seq, uint32_t flags,
+                                uint64_t expires_at) {
+  const std::size_t extra = expires_at != 0 ? sizeof(uint64_t) : 0;
+  void* p = arena_.allocate(sizeof(ValueRec) + value.size() + extra);
+  auto* v = new (p) ValueRec{seq, nullptr, 0, flags};
+  set_value(v, value, expires_at);
+  return v;
+}
+
+void FlatTable::set_value(ValueRec* v, std::string_view value, uint64_t expires_at) {
+  v->len = static_cast<uint32_t>(value.size());
+  if (!value.empty()) std::memcpy(v->data(), value.data(), value.size());
+  if (expires_at != 0) std::memcpy(v->data() + v->len, &expires_at, sizeof(expires_at));
+}
+
+void FlatTable::free_key(KeyRec* k) {
+  arena_.deallocate(k, sizeof(KeyRec) + k->len);
+}
+
+void FlatTable::free_value(ValueRec* v) {
+  arena_.deallocate(v, v->bytes());
+}
+
+void FlatTable::free_chain(ValueRec* v) {
+  while (v != nullptr) {
+    ValueRec* prev = v->prev;
+    free_value(v);
+    v = prev;
+  }
+}
+
+void FlatTable::free_large(KeyRec* k) {
+  for (ValueRec* v = k->head; v != nullptr; ) {
+    ValueRec* prev = v->prev;
+    if (v->bytes() > Arena::kMaxSmall) free_value(v);
+    v = prev;
+  }
+  if (sizeof(KeyRec) + k->len > Arena::kMaxSmall) free_key(k);
+}
+
+void FlatTable::set_ctrl(std::size_t i, int8_t c) {
+  ctrl_[i] = c;
+  // Mirror the first group past the end so unaligned group loads wrap.
+  if (i < Group::kWidth) ctrl_[capacity_ + i] = c;
+}
+
+std::size_t FlatTable::find_index(std::string_view key, uint64_t hash) const {
+  if (capacity_ == 0) return 0;
+
+  const std::size_t mask = capacity_ - 1;
+  const int8_t tag = h2(hash);
+  std::size_t offset = h1(hash) & mask;
+
+  // Triangular probing over group-sized steps visits every slot once.
+  for (std::size_t step = 0; step <= capacity_; ) {
+    Group g(ctrl_.get() + offset);
+    for (auto bits = g.match(tag); bits != 0; bits &= bits - 1) {
+      const std::size_t i = (offset + Group::lowest(bits)) & mask;
+      const KeyRec* k = slots_[i];
+      if (k->len == key.size() &&
+          std::memcmp(k->data(), key.data(), key.size()) == 0) {
+        return i;
+      }
+    }
+    if (g.match_empty() != 0) break;
+    step += Group::kWidth;
+    offset = (offset + step) & mask;
+  }
+  return capacity_;
+}
+
+std::size_t FlatTable::find_insert_slot(uint64_t hash) const {
+  const std::size_t mask = capacity_ - 1;
+  std::size_t offset = h1(hash) & mask;
+  for (std::size_t step = 0;; ) {
+    Group g(ctrl_.get() + offset);
+    if (auto bits = g.match_empty_or_deleted(); bits != 0) {
+      return (offset + Group::lowest(bits)) & mask;
+    }
+    step += Group::kWidth;
+    offset = (offset + step) & mask;
+  }
+}
+
+KeyRec* FlatTable::find(std::string_view key, uint64_t hash) const {
+  const std::size_t i = find_index(key, hash);
+  return i == capacity_ ? nullptr : slots_[i];
+}
+
+std::pair<KeyRec*, bool> FlatTable::find_or_insert(std::string_view key, uint64_t hash) {
+  std::size_t i = find_index(key, hash);
+  if (i != capacity_) return {slots_[i], false};
+
+  if (growth_left_ == 0) {
+    // Full of live entries -> double; mostly tombstones -> rebuild in place.
+    const std::size_t target =
+        capacity_ == 0 ? kMinCapacity
+                       : (size_ * 2 < max_load(capacity_) ? capacity_ : capacity_ * 2);
+    rehash(target);
+  }
+
+  i = find_insert_slot(hash);
+  if (ctrl_[i] == kEmpty) --growth_left_;
+  set_ctrl(i, h2(hash));
+  slots_[i] = make_key(key);
+  ++size_;
+  return {slots_[i], true};
+}
+
+void FlatTable::push_version(KeyRec* k, std::string_view value, uint64_t seq,
+                             uint32_t flags, bool keep_head, uint64_t expires_at) {
+  if (expires_at != 0) flags |= ValueRec::kExpires;
+  const std::size_t bytes =
+      sizeof(ValueRec) + value.size() + (expires_at != 0 ? sizeof(uint64_t) : 0);
+  ValueRec* head = k->head;
+  if (head != nullptr && !keep_head) {
+    if (Arena::rounded_size(head->bytes()) == Arena::rounded_size(bytes)) {
+      // Same size class: overwrite in place, keeping the older versions.
+      head->seq = seq;
+      head->flags = flags;
+      set_value(head, value, expires_at);
+      return;
+    }
+    ValueRec* fresh = make_value(value, seq, flags, expires_at);
+    fresh->prev = head->prev;
+    free_value(head);
+    k->head = fresh;
+    return;
+  }
+  ValueRec* fresh = make_value(value, seq, flags, expires_at);
+  fresh->prev = head;
+  k->head = fresh;
+}
+
+void FlatTable::prune(KeyRec* k, uint64_t oldest) {
+  for (ValueRec* v = k->head; v != nullptr; v = v->prev) {
+    // v is what the oldest snapshot reads; nothing behind it is reachable.
+    if (v->seq <= oldest) {
+      free_chain(v->prev);
+      v->prev = nullptr;
+      return;
+    }
+  }
+}
+
+bool FlatTable::erase(std::string_view key, uint64_t hash) {
+  const std::size_t i = find_index(key, hash);
+  if (i == capacity_) return false;
+
+  free_chain(slots_[i]->head);
+  free_key(slots_[i]);
+  slots_[i] = nullptr;
+  // A tombstone keeps probe chains through this slot intact; rehash drops it.
+  set_ctrl(i, kDeleted);
+  --size_;
+  return true;
+}
+
+void FlatTable::clear() {
+  for (std::size_t i = 0; i < capacity_; ++i) {
+    // Slab blocks go away with the arena; only exact-size blocks need freeing.
+    if (ctrl_[i] >= 0) free_large(slots_[i]);
+  }
+  arena_.reset();
+  ctrl_.reset();
+  slots_.reset();
+  capacity_ = 0;
+  size_ = 0;
+  growth_left_ = 0;
+}
+
+void FlatTable::rehash(std::size_t new_capacity) {
+  if (new_capacity > (std::size_t{1} << 40)) throw std::length_error("FlatTable too large");
+  const std::size_t ctrl_bytes = new_capacity + Group::kWidth;
+  auto new_ctrl = std::make_unique<int8_t[]>(ctrl_bytes);
+  std::fill(new_ctrl.get(), new_ctrl.get() + ctrl_bytes, kEmpty);
+  auto new_slots = std::make_unique<KeyRec*[]>(new_capacity);
+
+  auto old_ctrl = std::move(ctrl_);
+  auto old_slots = std::move(slots_);
+  const std::size_t old_capacity = capacity_;
+
+  ctrl_ = std::move(new_ctrl);
+  slots_ = std::move(new_slots);
+  capacity_ = new_capacity;
+
+  for (std::size_t i = 0; i < old_capacity; ++i) {
+    if (old_ctrl[i] < 0) continue;
+    const uint64_t hash = FlatTable::hash(old_slots[i]->view());
+    const std::size_t j = find_insert_slot(hash);
+    set_ctrl(j, h2(hash));
+    slots_[j] = old_slots[i];
+  }
+  growth_left_ = max_load(capacity_) - size_;
+}
+
+void FlatTable::reserve(std::size_t n) {
+  std::size_t cap = capacity_ == 0 ? kMinCapacity : capacity_;
+  while (max_load(cap) < n) cap *= 2;
+  if (cap > capacity_) rehash(cap);
+}
+
+void FlatTable::prefetch(uint64_t hash) const {
+  if (capacity_ == 0) return;
+  const std::size_t i = h1(hash) & (capacity_ - 1);
+  __builtin_prefetch(ctrl_.get() + i);
+  __builtin_prefetch(&slots_[i]);
+}
+
+std::size_t FlatTable::memory_bytes() const {
+  const std::size_t table =
+      capacity_ == 0 ? 0 : capacity_ * sizeof(KeyRec*) + capacity_ + Group::kWidth;
+  return table + arena_.bytes_reserved();
+}
+
+}  // namespace kv
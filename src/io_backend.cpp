@@ -0,0 +1,462 @@
+#include "kv/io_backend.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_util.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define KV_HAVE_IO_URING 1
+#include <atomic>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace kv {
+namespace {
+
+bool datasync(int fd) {
+#if defined(__APPLE__)
+  return ::fsync(fd) == 0;
+#else
+  return ::fdatasync(fd) == 0;
+#endif
+}
+
+class SyncIo final : public IoBackend {
+ public:
+  const char* name() const override { return "sync"; }
+
+  bool write_sync(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    return pwrite_all(fd, static_cast<const char*>(buf), n, off) && datasync(fd);
+  }
+
+  bool write(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    return pwrite_all(fd, static_cast<const char*>(buf), n, off);
+  }
+
+  bool sync(int fd) override { return datasync(fd); }
+
+  bool submit_write(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    if (!pwrite_all(fd, static_cast<const char*>(buf), n, off)) failed_ = true;
+    return !failed_;
+  }
+
+  bool wait_writes(std::size_t) override { return !failed_; }
+
+ private:
+  bool failed_ = false;
+};
+
+#ifdef KV_HAVE_IO_URING
+
+// Talks to the kernel through the raw syscalls, so there is no liburing
+// dependency. All of its requests are the caller's own, so every completion
+// belongs either to the write_sync() pair or to a queued write.
+class UringIo final : public IoBackend {
+ public:
+  ~UringIo() override {
+    if (ring_fd_ < 0) return;
+    if (sqes_ != nullptr) ::munmap(sqes_, sqes_bytes_);
+    if (cq_map_ != nullptr && cq_map_ != sq_map_) ::munmap(cq_map_, cq_map_bytes_);
+    if (sq_map_ != nullptr) ::munmap(sq_map_, sq_map_bytes_);
+    ::close(ring_fd_);
+  }
+
+  bool init(unsigned entries, std::string& error) {
+    io_uring_params p{};
+    const long fd = ::syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+      error = std::strerror(errno);
+      return false;
+    }
+    ring_fd_ = static_cast<int>(fd);
+
+    sq_map_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single_map = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map) sq_map_bytes_ = cq_map_bytes_ = std::max(sq_map_bytes_, cq_map_bytes_);
+
+    sq_map_ = map(sq_map_bytes_, IORING_OFF_SQ_RING);
+    if (sq_map_ == nullptr) return fail(error);
+    cq_map_ = single_map ? sq_map_ : map(cq_map_bytes_, IORING_OFF_CQ_RING);
+    if (cq_map_ == nullptr) return fail(error);
+    sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(map(sqes_bytes_, IORING_OFF_SQES));
+    if (sqes_ == nullptr) return fail(error);
+
+    char* sq = static_cast<char*>(sq_map_);
+    char* cq = static_cast<char*>(cq_map_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    sq_entries_ = p.sq_entries;
+    return true;
+  }
+
+  const char* name() const override { return "io_uring"; }
+
+  bool write_sync(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    return run(fd, static_cast<const char*>(buf), n, off, true);
+  }
+
+  bool write(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    return n == 0 || run(fd, static_cast<const char*>(buf), n, off, false);
+  }
+
+  bool sync(int fd) override { return run(fd, nullptr, 0, 0, true); }
+
+  bool submit_write(int fd, const void* buf, std::size_t n, uint64_t off) override {
+    Queued q{fd, static_cast<const char*>(buf), n, off, false};
+    queued_.push_back(q);
+    const uint64_t ticket = first_ticket_ + queued_.size() - 1;
+    if (!submit_queued(ticket)) {
+      queued_.back().done = true;
+      failed_ = true;
+    }
+    return !failed_;
+  }
+
+  bool wait_writes(std::size_t max_in_flight) override {
+    while (queued_.size() > max_in_flight) {
+      if (!queued_.front().done) {
+        if (!enter(1)) {
+          failed_ = true;
+          break;
+        }
+        reap([&](uint64_t tag, int res) { complete_queued(tag, res); });
+      }
+      while (!queued_.empty() && queued_.front().done) {
+        queued_.pop_front();
+        ++first_ticket_;
+      }
+    }
+    return !failed_;
+  }
+
+  void register_buffer(unsigned slot, const void* base, std::size_t len) override {
+    if (slot >= kBufferSlots) return;
+    slots_[slot] = {const_cast<void*>(base), len};
+    if (registered_ > 0) {
+      ::syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+      registered_ = 0;
+    }
+    std::array<iovec, kBufferSlots> iovs{};
+    for (unsigned i = 0; i < kBufferSlots; ++i) {
+      if (slots_[i].iov_len == 0) continue;
+      index_[i] = registered_;
+      iovs[registered_++] = slots_[i];
+    }
+    if (registered_ == 0) return;
+    // Pinned pages count against RLIMIT_MEMLOCK; without the pin the writes
+    // are merely not fixed.
+    if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iovs.data(),
+                  registered_) < 0) {
+      registered_ = 0;
+    }
+  }
+
+ private:
+  static constexpr uint64_t kSyncWrite = ~uint64_t{0};
+  static constexpr uint64_t kSyncFsync = ~uint64_t{0} - 1;
+  static constexpr std::size_t kMaxIo = std::size_t{1} << 30;
+
+  struct Queued {
+    int fd;
+    const char* p;
+    std::size_t n;
+    uint64_t off;
+    bool done;
+  };
+
+  // Writes [p, p + n) at `off` and, with `with_sync`, fdatasyncs after it
+  // (n == 0: only the fdatasync). The fsync is linked behind the write: the
+  // kernel starts it only once the write has completed in full and cancels
+  // it otherwise, in which case the rest is written and synced again.
+  bool run(int fd, const char* p, std::size_t n, uint64_t off, bool with_sync) {
+    while (true) {
+      const std::size_t len = std::min(n, kMaxIo);
+      const int ops = (len > 0 ? 1 : 0) + (with_sync ? 1 : 0);
+      io_uring_sqe* w = len > 0 ? next_sqe() : nullptr;
+      io_uring_sqe* s = with_sync ? next_sqe() : nullptr;
+      if ((len > 0 && w == nullptr) || (with_sync && s == nullptr)) return false;
+      if (w != nullptr) {
+        prep_write(w, fd, p, len, off, kSyncWrite);
+        if (s != nullptr) w->flags |= IOSQE_IO_LINK;
+      }
+      if (s != nullptr) {
+        s->opcode = IORING_OP_FSYNC;
+        s->fd = fd;
+        s->fsync_flags = IORING_FSYNC_DATASYNC;
+        s->user_data = kSyncFsync;
+      }
+
+      int write_res = 0;
+      int fsync_res = 0;
+      int seen = 0;
+      while (seen < ops) {
+        if (!enter(1)) return false;
+        reap([&](uint64_t tag, int res) {
+          if (tag == kSyncWrite) {
+            write_res = res;
+            ++seen;
+          } else if (tag == kSyncFsync) {
+            fsync_res = res;
+            ++seen;
+          } else {
+            complete_queued(tag, res);
+          }
+        });
+      }
+      if (write_res < 0) return false;
+      const auto wrote = static_cast<std::size_t>(write_res);
+      if (wrote == n && fsync_res >= 0) return true;
+      if (wrote == len && fsync_res < 0 && fsync_res != -ECANCELED) return false;
+      if (wrote == 0) return false;
+      // Short write (the fsync was cancelled) or a capped chunk: go on with
+      // the rest.
+      p += wrote;
+      n -= wrote;
+      off += wrote;
+    }
+  }
+
+  void* map(std::size_t bytes, uint64_t offset) {
+    void* m = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring_fd_, static_cast<off_t>(offset));
+    return m == MAP_FAILED ? nullptr : m;
+  }
+
+  bool fail(std::string& error) {
+    error = std::strerror(errno);
+    return false;
+  }
+
+  io_uring_sqe* next_sqe() {
+    const unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+    if (local_tail_ - head >= sq_entries_) return nullptr;
+    const unsigned idx = local_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++local_tail_;
+    ++to_submit_;
+    return sqe;
+  }
+
+  void prep_write(io_uring_sqe* sqe, int fd, const char* p, std::size_t n, uint64_t off,
+                  uint64_t tag) {
+    sqe->opcode = IORING_OP_WRITE;
+    for (unsigned i = 0; i < kBufferSlots && registered_ > 0; ++i) {
+      const auto* base = static_cast<const char*>(slots_[i].iov_base);
+      if (slots_[i].iov_len != 0 && p >= base && p + n <= base + slots_[i].iov_len) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = static_cast<uint16_t>(index_[i]);
+        break;
+      }
+    }
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(p);
+    sqe->len = static_cast<uint32_t>(n);
+    sqe->off = off;
+    sqe->user_data = tag;
+  }
+
+  // Publishes the prepared entries and waits for `min_complete` completions.
+  bool enter(unsigned min_complete) {
+    std::atomic_ref<unsigned>(*sq_tail_).store(local_tail_, std::memory_order_release);
+    while (true) {
+      const long r = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete,
+                               IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r >= 0) {
+        to_submit_ -= static_cast<unsigned>(r);
+        if (to_submit_ == 0) return true;
+        continue;
+      }
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+    }
+  }
+
+  template <typename Fn>
+  void reap(Fn&& fn) {
+    std::atomic_ref<unsigned> tail_ref(*cq_tail_);
+    std::atomic_ref<unsigned> head_ref(*cq_head_);
+    unsigned head = head_ref.load(std::memory_order_relaxed);
+    const unsigned tail = tail_ref.load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      fn(cqe.user_data, cqe.res);
+    }
+    head_ref.store(head, std::memory_order_release);
+  }
+
+  bool submit_queued(uint64_t ticket) {
+    const Queued& q = queued_[ticket - first_ticket_];
+    io_uring_sqe* sqe = next_sqe();
+    if (sqe == nullptr) {
+      // Ring full: let the oldest finish first.
+      if (!enter(1)) return false;
+      reap([&](uint64_t tag, int res) { complete_queued(tag, res); });
+      sqe = next_sqe();
+      if (sqe == nullptr) return false;
+    }
+    prep_write(sqe, q.fd, q.p, std::min(q.n, kMaxIo), q.off, ticket);
+    return true;
+  }
+
+  void complete_queued(uint64_t ticket, int res) {
+    if (ticket < first_ticket_ || ticket - first_ticket_ >= queued_.size()) return;
+    Queued& q = queued_[ticket - first_ticket_];
+    if (res <= 0 && q.n > 0) {
+      q.done = true;
+      failed_ = true;
+      return;
+    }
+    const auto wrote = static_cast<std::size_t>(res);
+    q.p += wrote;
+    q.n -= wrote;
+    q.off += wrote;
+    if (q.n == 0) {
+      q.done = true;
+    } else if (!submit_queued(ticket)) {
+      q.done = true;
+      failed_ = true;
+    }
+  }
+
+  int ring_fd_ = -1;
+  void* sq_map_ = nullptr;
+  void* cq_map_ = nullptr;
+  std::size_t sq_map_bytes_ = 0;
+  std::size_t cq_map_bytes_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_bytes_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  unsigned local_tail_ = 0;
+  unsigned to_submit_ = 0;
+
+  std::array<iovec, kBufferSlots> slots_{};
+  std::array<unsigned, kBufferSlots> index_{};
+  unsigned registered_ = 0;
+
+  std::deque<Queued> queued_;  // not yet retired, oldest first
+  uint64_t first_ticket_ = 0;  // ticket of queued_.front()
+  bool failed_ = false;
+};
+
+#endif  // KV_HAVE_IO_URING
+
+}  // namespace
+
+void IoBackend::start_writeback(int fd, uint64_t off, std::size_t n) {
+#ifdef __linux__
+  (void)::sync_file_range(fd, static_cast<off_t>(off), static_cast<off_t>(n),
+                          SYNC_FILE_RANGE_WRITE);
+#else
+  (void)fd;
+  (void)off;
+  (void)n;
+#endif
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(Kind kind) {
+  if (kind == Kind::kIoUring) {
+    std::string error = "not supported on this platform";
+#ifdef KV_HAVE_IO_URING
+    auto ring = std::make_unique<UringIo>();
+    if (ring->init(16, error)) return ring;
+#endif
+    static std::once_flag noted;
+    std::call_once(noted, [&] {
+      std::cerr << "[io] io_uring unavailable (" << error << "), using synchronous I/O\n";
+    });
+  }
+  return std::make_unique<SyncIo>();
+}
+
+IoFileBuf::IoFileBuf(IoBackend::Kind kind)
+    : io_(IoBackend::create(kind)), bufs_(new char[kDepth * kBufferBytes]) {
+  for (std::size_t i = 0; i < kDepth; ++i) {
+    io_->register_buffer(static_cast<unsigned>(i), bufs_.get() + i * kBufferBytes, kBufferBytes);
+  }
+  setp(bufs_.get(), bufs_.get() + kBufferBytes);
+}
+
+IoFileBuf::~IoFileBuf() {
+  if (fd_ < 0) return;
+  io_->wait_writes(0);  // the buffers must outlive the writes
+  ::close(fd_);
+}
+
+bool IoFileBuf::open(const std::string& path) {
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  offset_ = 0;
+  written_back_ = 0;
+  return fd_ >= 0;
+}
+
+bool IoFileBuf::submit_current() {
+  const std::size_t n = static_cast<std::size_t>(pptr() - pbase());
+  if (n > 0) {
+    if (!io_->submit_write(fd_, pbase(), n, offset_)) ok_ = false;
+    offset_ += n;
+  }
+  // The next buffer is reused once the write issued from it kDepth - 1
+  // submissions ago has retired.
+  if (!io_->wait_writes(kDepth - 1)) ok_ = false;
+  // Everything but the kDepth - 1 writes still in flight has reached the
+  // page cache.
+  const uint64_t retired = offset_ - std::min<uint64_t>(offset_, (kDepth - 1) * kBufferBytes);
+  if (retired - written_back_ >= kWritebackBytes) {
+    io_->start_writeback(fd_, written_back_, retired - written_back_);
+    written_back_ = retired;
+  }
+  current_ = (current_ + 1) % kDepth;
+  char* next = bufs_.get() + current_ * kBufferBytes;
+  setp(next, next + kBufferBytes);
+  return ok_;
+}
+
+IoFileBuf::int_type IoFileBuf::overflow(int_type ch) {
+  if (fd_ < 0 || !submit_current()) return traits_type::eof();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+bool IoFileBuf::finish() {
+  if (fd_ < 0) return false;
+  submit_current();
+  if (!io_->wait_writes(0)) ok_ = false;
+  if (ok_ && !datasync(fd_)) ok_ = false;
+  if (::close(fd_) != 0) ok_ = false;
+  fd_ = -1;
+  return ok_;
+}
+
+}  // namespace kv
@@ -0,0 +1,76 @@
+#pragma once
+
+// v0.9: file and encoding helpers shared by the storage sources. Internal:
+// not installed with include/kv.
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kv {
+
+// Little-endian (host order) fixed-width fields.
+template <class T>
+void put_fixed(std::string& dst, T v) {
+  dst.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <class T>
+void put_fixed(char* p, T v) {
+  std::memcpy(p, &v, sizeof(v));
+}
+
+template <class T>
+T get_fixed(const char* p) {
+  T v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Retry short transfers and EINTR. pread_all fails at end of file.
+inline bool pread_all(int fd, void* buf, std::size_t n, uint64_t off) {
+  char* p = static_cast<char*>(buf);
+  while (n > 0) {
+    const ssize_t r = ::pread(fd, p, n, static_cast<off_t>(off));
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (r == 0) return false;
+    p += r;
+    n -= static_cast<std::size_t>(r);
+    off += static_cast<uint64_t>(r);
+  }
+  return true;
+}
+
+inline bool pwrite_all(int fd, const void* buf, std::size_t n, uint64_t off) {
+  const char* p = static_cast<const char*>(buf);
+  while (n > 0) {
+    const ssize_t w = ::pwrite(fd, p, n, static_cast<off_t>(off));
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= static_cast<std::size_t>(w);
+    off += static_cast<uint64_t>(w);
+  }
+  return true;
+}
+
+// Make renames, creations and unlinks in `dir` durable.
+inline bool sync_dir(const std::string& dir) {
+  const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return false;
+  const bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+
+}  // namespace kv
@@ -0,0 +1,850 @@
+#include "kv/compression.h"
+#include "kv/crc32.h"
+#include "kv/flat_table.h"
+#include "kv/kv_store.h"
+#include "kv/object_store.h"
+#include "kv/snapshot_file.h"
+#include "kv/snapshot_image.h"
+#include "kv/write_batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Engine micro-benchmarks.
+//
+//   kv_bench threads [ops_per_thread] [read_pct]
+//     put/get throughput from 1 to 32 threads, single lock vs sharded store.
+//   kv_bench map [entries] [value_bytes]
+//     bytes/entry and lookup latency, std::unordered_map vs FlatTable.
+//   kv_bench lsm [entries] [value_bytes] [memtable_mb]
+//     load and random-read rates of the LSM engine, heap vs on-disk bytes.
+//   kv_bench compress [objects] [object_bytes]
+//     object-store puts with and without LZ4: WAL and snapshot bytes, write
+//     rate, and the codec's own speed.
+//   kv_bench checkpoint [entries] [value_bytes]
+//     put rate and worst put latency of a writer while a background
+//     checkpoint of the store runs.
+//   kv_bench check
+//     storage round trips (torn batch tail, v1 log, LZ4, damaged snapshot
+//     and image, snapshot isolation); exits non-zero on any mismatch.
+
+namespace {
+
+constexpr int kKeySpace = 100000;
+
+std::vector<std::string> make_keys(int n) {
+  std::vector<std::string> keys;
+  keys.reserve(static_cast<std::size_t>(n));
+  for (int i = 0; i < n; i++) keys.push_back("key" + std::to_string(i));
+  return keys;
+}
+
+double run_threads(std::size_t shards, int threads, int ops_per_thread,
+                   int read_pct, const std::vector<std::string>& keys) {
+  const std::string wal_path = "/tmp/kv_bench.wal";
+  std::filesystem::remove_all(wal_path + ".seg");
+
+  kv::KVStore store(shards);
+  if (!store.open(wal_path)) {
+    std::cerr << "failed to open " << wal_path << "\n";
+    std::exit(1);
+  }
+  // Measure lock scaling, not fsync latency.
+  store.set_group_commit_every(1 << 30);
+
+  const std::string value(32, 'v');
+  for (const auto& k : keys) store.put(k, value);
+
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> workers;
+  workers.reserve(static_cast<std::size_t>(threads));
+
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937 rng(static_cast<uint32_t>(t + 1));
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+      for (int i = 0; i < ops_per_thread; i++) {
+        const auto& k = keys[rng() % keys.size()];
+        if (static_cast<int>(rng() % 100) < read_pct) {
+          auto v = store.get(k);
+          if (!v) std::abort();
+        } else {
+          store.put(k, value);
+        }
+      }
+    });
+  }
+
+  while (ready.load() < threads) std::this_thread::yield();
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& w : workers) w.join();
+  auto end = std::chrono::steady_clock::now();
+
+  std::filesystem::remove_all(wal_path + ".seg");
+
+  const double secs = std::chrono::duration<double>(end - start).count();
+  const double total = static_cast<double>(threads) * ops_per_thread;
+  return secs > 0 ? total / secs : 0.0;
+}
+
+int bench_threads(int ops_per_thread, int read_pct) {
+  const auto keys = make_keys(kKeySpace);
+  const std::size_t shard_configs[] = {1, kv::KVStore::kDefaultShardCount};
+
+  std::cout << "threads benchmark: keys=" << kKeySpace
+            << " ops_per_thread=" << ops_per_thread
+            << " read_pct=" << read_pct
+            << " hw_threads=" << std::thread::hardware_concurrency() << "\n";
+  std::cout << std::left << std::setw(8) << "threads";
+  for (auto s : shard_configs) {
+    std::cout << std::setw(20) << ("shards=" + std::to_string(s) + " ops/s");
+  }
+  std::cout << "\n";
+
+  for (int threads = 1; threads <= 32; threads *= 2) {
+    std::cout << std::setw(8) << threads;
+    for (auto s : shard_configs) {
+      const double ops = run_threads(s, threads, ops_per_thread, read_pct, keys);
+      std::cout << std::setw(20) << static_cast<uint64_t>(ops);
+    }
+    std::cout << "\n" << std::flush;
+  }
+  return 0;
+}
+
+// Live heap bytes, so both containers are measured the same way.
+std::size_t heap_in_use() {
+#if defined(__GLIBC__)
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+template <class LookupFn>
+double lookup_ns(const std::vector<std::string>& keys, LookupFn&& lookup) {
+  constexpr int kLookups = 2000000;
+  std::mt19937 rng(7);
+  std::size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLookups; i++) {
+    found += lookup(keys[rng() % keys.size()]);
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (found != kLookups) std::abort();
+  return std::chrono::duration<double, std::nano>(end - start).count() / kLookups;
+}
+
+int bench_map(int entries, int value_bytes) {
+  const auto keys = make_keys(entries);
+  const std::string value(static_cast<std::size_t>(value_bytes), 'v');
+  const double raw = static_cast<double>(
+      keys.empty() ? 0 : keys.back().size() + value.size());
+
+  std::cout << "map benchmark: entries=" << entries
+            << " value_bytes=" << value_bytes
+            << " raw_bytes_per_entry~" << raw << "\n";
+
+  {
+    const std::size_t before = heap_in_use();
+    std::unordered_map<std::string, std::string> m;
+    for (const auto& k : keys) m[k] = value;
+    const std::size_t bytes = heap_in_use() - before;
+
+    const double ns = lookup_ns(keys, [&](const std::string& k) {
+      return m.find(k) != m.end() ? 1 : 0;
+    });
+    std::cout << "  unordered_map  bytes/entry=" << std::fixed << std::setprecision(1)
+              << static_cast<double>(bytes) / entries
+              << " lookup_ns=" << ns << "\n";
+  }
+
+  {
+    const std::size_t before = heap_in_use();
+    kv::FlatTable t;
+    uint64_t seq = 0;
+    for (const auto& k : keys) {
+      kv::KeyRec* rec = t.find_or_insert(k, kv::FlatTable::hash(k)).first;
+      t.push_version(rec, value, ++seq, 0, false);
+    }
+    const std::size_t bytes = heap_in_use() - before;
+
+    const double ns = lookup_ns(keys, [&](const std::string& k) {
+      return t.find(k, kv::FlatTable::hash(k)) != nullptr ? 1 : 0;
+    });
+    std::cout << "  FlatTable      bytes/entry=" << std::fixed << std::setprecision(1)
+              << static_cast<double>(bytes) / entries
+              << " lookup_ns=" << ns
+              << " (self-reported " << static_cast<double>(t.memory_bytes()) / entries
+              << ")\n";
+  }
+  return 0;
+}
+
+int bench_lsm(int entries, int value_bytes, int memtable_mb) {
+  namespace fs = std::filesystem;
+  const std::string wal_path = "/tmp/kv_bench_lsm.wal";
+  fs::remove_all(wal_path + ".seg");
+  fs::remove_all(wal_path + ".lsm");
+
+  kv::Options options;
+  options.engine = kv::Options::Engine::kLsm;
+  options.memtable_bytes = static_cast<std::size_t>(memtable_mb) << 20;
+
+  const std::size_t heap_before = heap_in_use();
+  kv::KVStore store;
+  if (!store.open(wal_path, options)) {
+    std::cerr << "failed to open " << wal_path << "\n";
+    return 1;
+  }
+  store.set_group_commit_every(1 << 30);
+
+  // Random insertion order so flushes overlap and compaction has work.
+  std::vector<int> order(static_cast<std::size_t>(entries));
+  for (int i = 0; i < entries; i++) order[static_cast<std::size_t>(i)] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(3));
+  const std::string value(static_cast<std::size_t>(value_bytes), 'v');
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i : order) store.put("key" + std::to_string(i), value);
+  store.flush_memtable();
+  auto end = std::chrono::steady_clock::now();
+  const double load_s = std::chrono::duration<double>(end - start).count();
+
+  constexpr int kReads = 200000;
+  std::mt19937 rng(7);
+  std::string out;
+  int found = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kReads; i++) {
+    found += store.get_into("key" + std::to_string(rng() % entries), out) ? 1 : 0;
+  }
+  end = std::chrono::steady_clock::now();
+  const double read_s = std::chrono::duration<double>(end - start).count();
+  if (found != kReads) {
+    std::cerr << "lsm bench: " << kReads - found << " keys missing\n";
+    return 1;
+  }
+
+  std::uintmax_t disk = 0;
+  for (const auto& f : fs::directory_iterator(wal_path + ".lsm")) disk += f.file_size();
+
+  std::cout << "lsm benchmark: entries=" << entries << " value_bytes=" << value_bytes
+            << " memtable_mb=" << memtable_mb << "\n"
+            << std::fixed << std::setprecision(0)
+            << "  load  ops/s=" << entries / load_s << "\n"
+            << "  get   ops/s=" << kReads / read_s << "\n"
+            << std::setprecision(1)
+            << "  heap_mb=" << static_cast<double>(heap_in_use() - heap_before) / (1 << 20)
+            << " sstable_mb=" << static_cast<double>(disk) / (1 << 20) << "\n";
+  return 0;
+}
+
+// Small JSON event records, the kind of object the object store holds
+// many of: repeated field names, a few distinct values.
+std::vector<std::uint8_t> make_object(std::mt19937& rng, int bytes) {
+  static const char* const kEvents[] = {"page_view", "add_to_cart", "checkout", "login"};
+  std::string doc = "[";
+  while (doc.size() < static_cast<std::size_t>(bytes)) {
+    doc += "{\"user\":\"user-" + std::to_string(rng() % 5000) + "\",\"event\":\"" +
+           kEvents[rng() % 4] + "\",\"path\":\"/products/" + std::to_string(rng() % 200) +
+           "\",\"ts\":" + std::to_string(1700000000000ull + rng() % 100000) + "},";
+  }
+  doc.back() = ']';
+  return {doc.begin(), doc.end()};
+}
+
+int bench_compress(int objects, int object_bytes) {
+  namespace fs = std::filesystem;
+  const std::string wal_path = "/tmp/kv_bench_z.wal";
+  const std::string snapshot_path = "/tmp/kv_bench_z.snapshot";
+
+  std::cout << "compress benchmark: objects=" << objects << " object_bytes~" << object_bytes
+            << " (one batch + WAL flush per object)\n";
+  std::string sample;  // every object, for the codec's own speed
+  for (auto codec : {kv::Options::Compression::kNone, kv::Options::Compression::kLz4}) {
+    fs::remove_all(wal_path + ".seg");
+    fs::remove_all(wal_path + ".vlog");
+    std::remove(snapshot_path.c_str());
+
+    kv::Options options;
+    options.compression = codec;
+    kv::KVStore store;
+    if (!store.open(wal_path, options)) {
+      std::cerr << "failed to open " << wal_path << "\n";
+      return 1;
+    }
+    kv::ObjectStore objects_store(store);
+    objects_store.CreateBucket("events");
+
+    std::mt19937 rng(9);
+    uint64_t raw = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < objects; i++) {
+      kv::PutObjectRequest req;
+      req.bucket = "events";
+      req.key = "2024/06/" + std::to_string(i % 30) + "/batch-" + std::to_string(i) + ".json";
+      req.content_type = "application/json";
+      req.data = make_object(rng, object_bytes);
+      raw += req.data.size();
+      if (codec == kv::Options::Compression::kNone && sample.size() < (64u << 20)) {
+        sample.append(req.data.begin(), req.data.end());
+      }
+      if (!objects_store.PutObject(req).ok) {
+        std::cerr << "put failed\n";
+        return 1;
+      }
+    }
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t wal = store.wal_bytes();
+    if (!store.checkpoint(snapshot_path, wal_path)) {
+      std::cerr << "checkpoint failed\n";
+      return 1;
+    }
+
+    std::cout << (codec == kv::Options::Compression::kNone ? "  none" : "  lz4 ")
+              << std::fixed << std::setprecision(0) << "  objects/s=" << objects / secs
+              << std::setprecision(1) << " MB/s=" << static_cast<double>(raw) / secs / 1e6
+              << " wal_mb=" << static_cast<double>(wal) / 1e6
+              << " snapshot_mb=" << static_cast<double>(fs::file_size(snapshot_path)) / 1e6
+              << "\n";
+  }
+
+  // The codec alone, on 64 KiB blocks of the same data.
+  constexpr std::size_t kBlock = 64u << 10;
+  std::vector<std::string> packed;
+  std::size_t packed_bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t off = 0; off < sample.size(); off += kBlock) {
+    const std::string_view block = std::string_view(sample).substr(off, kBlock);
+    packed.emplace_back();
+    if (!kv::lz4_compress(block, packed.back())) packed.back().assign(block);
+    packed_bytes += packed.back().size();
+  }
+  const double c_secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::string unpacked;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < packed.size(); i++) {
+    const std::size_t raw_len = std::min(kBlock, sample.size() - i * kBlock);
+    unpacked.clear();
+    if (packed[i].size() < raw_len && !kv::lz4_decompress(packed[i], raw_len, unpacked)) {
+      std::cerr << "codec round trip failed\n";
+      return 1;
+    }
+  }
+  const double d_secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const double mb = static_cast<double>(sample.size()) / 1e6;
+  std::cout << std::setprecision(2) << "  codec ratio=" << mb * 1e6 / packed_bytes
+            << std::setprecision(0) << " compress MB/s=" << mb / c_secs
+            << " decompress MB/s=" << mb / d_secs << "\n";
+  fs::remove_all(wal_path + ".seg");
+  fs::remove_all(wal_path + ".vlog");
+  std::remove(snapshot_path.c_str());
+  return 0;
+}
+
+int bench_checkpoint(int entries, int value_bytes) {
+  namespace fs = std::filesystem;
+  const std::string wal_path = "/tmp/kv_bench_ckpt.wal";
+  const std::string snapshot_path = "/tmp/kv_bench_ckpt.snapshot";
+  fs::remove_all(wal_path + ".seg");
+  std::remove(snapshot_path.c_str());
+
+  kv::Options options;
+  kv::KVStore store;
+  if (!store.open(wal_path, options)) {
+    std::cerr << "failed to open " << wal_path << "\n";
+    return 1;
+  }
+  const std::string value(static_cast<std::size_t>(value_bytes), 'v');
+  store.set_group_commit_every(1 << 30);
+  for (int i = 0; i < entries; i++) store.put("key" + std::to_string(i), value);
+  store.set_group_commit_every(1);
+
+  // One writer overwriting random keys; each phase reports its put rate and
+  // slowest put.
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> puts{0};
+  std::atomic<int64_t> worst_us{0};
+  std::thread writer([&] {
+    std::mt19937 rng(5);
+    while (!stop.load(std::memory_order_relaxed)) {
+      const auto t = std::chrono::steady_clock::now();
+      store.put("key" + std::to_string(rng() % entries), value);
+      const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - t)
+                             .count();
+      if (us > worst_us.load(std::memory_order_relaxed)) worst_us = us;
+      puts.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  auto phase = [&](const char* name, auto&& body) {
+    puts = 0;
+    worst_us = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const int64_t caller_us = body();
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << name << std::fixed << std::setprecision(0)
+              << " ms=" << secs * 1000 << " caller_blocked_us=" << caller_us
+              << " writer_puts/s=" << static_cast<double>(puts.load()) / secs
+              << " worst_put_us=" << worst_us.load() << "\n";
+  };
+  auto elapsed_us = [](auto since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - since)
+        .count();
+  };
+
+  std::cout << "checkpoint benchmark: entries=" << entries << " value_bytes=" << value_bytes
+            << "\n";
+  bool ok = true;
+  phase("no checkpoint", [&] {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    return int64_t{0};
+  });
+  phase("checkpoint()  ", [&] {
+    const auto t = std::chrono::steady_clock::now();
+    ok = ok && store.checkpoint(snapshot_path, wal_path);
+    return elapsed_us(t);
+  });
+  phase("background    ", [&] {
+    const auto t = std::chrono::steady_clock::now();
+    ok = ok && store.checkpoint_async(snapshot_path);
+    const int64_t us = elapsed_us(t);
+    ok = ok && store.wait_checkpoint();
+    return us;
+  });
+  stop = true;
+  writer.join();
+  std::remove(snapshot_path.c_str());
+  if (!ok) {
+    std::cerr << "checkpoint failed\n";
+    return 1;
+  }
+  return 0;
+}
+
+// ---- kv_bench check: round trips that must hold exactly ----
+
+// Prints a failed expectation; each check returns false if any failed.
+bool expect(bool ok, const std::string& what) {
+  if (!ok) std::cerr << "  mismatch: " << what << "\n";
+  return ok;
+}
+
+void remove_store_files(const std::string& wal_path) {
+  namespace fs = std::filesystem;
+  fs::remove_all(wal_path + ".seg");
+  fs::remove_all(wal_path + ".vlog");
+  fs::remove(wal_path);
+  fs::remove(wal_path + ".old");
+}
+
+// Newest segment file ("NNNNNN.log") of the store at `wal_path`.
+std::string newest_segment(const std::string& wal_path) {
+  std::string newest;
+  for (const auto& entry : std::filesystem::directory_iterator(wal_path + ".seg")) {
+    const std::string name = entry.path().filename().string();
+    if (name.size() == 10 && name.ends_with(".log") && name > newest) newest = name;
+  }
+  return wal_path + ".seg/" + newest;
+}
+
+void overwrite_file(const std::string& path, uint64_t off, const std::string& bytes) {
+  std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+  f.seekp(static_cast<std::streamoff>(off));
+  f.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// Ten batches are logged; the last one is torn halfway (its bytes zeroed,
+// as a crash mid-write leaves a preallocated segment). Reopening keeps the
+// first nine whole and none of the tenth, and later writes still recover.
+bool check_batch_torn_tail() {
+  bool ok = true;
+  for (auto codec : {kv::Options::Compression::kNone, kv::Options::Compression::kLz4}) {
+    const std::string wal_path = "/tmp/kv_check_batch.wal";
+    remove_store_files(wal_path);
+    kv::Options options;
+    options.compression = codec;
+    const std::string tag = codec == kv::Options::Compression::kLz4 ? " (lz4)" : "";
+    auto key = [](int b, int i) { return "b" + std::to_string(b) + "/" + std::to_string(i); };
+    auto value = [](int b) { return std::string(64, static_cast<char>('a' + b)); };
+
+    uint64_t torn_from = 0, torn_to = 0;
+    {
+      kv::KVStore store;
+      if (!store.open(wal_path, options)) return expect(false, "open" + tag);
+      store.put(key(0, 0), "before");
+      for (int b = 0; b < 10; ++b) {
+        kv::WriteBatch batch;
+        for (int i = 0; i < 50; ++i) batch.put(key(b, i), value(b));
+        batch.del(key(b, 49));
+        if (b == 9) torn_from = store.wal_bytes();
+        ok &= expect(store.write(batch), "write batch " + std::to_string(b) + tag);
+      }
+      torn_to = store.wal_bytes();
+    }
+    const uint64_t mid = torn_from + (torn_to - torn_from) / 2;
+    overwrite_file(newest_segment(wal_path), mid, std::string(torn_to - mid, '\0'));
+
+    for (int round = 0; round < 2; ++round) {
+      kv::KVStore store;
+      if (!store.open(wal_path, options)) return expect(false, "reopen" + tag);
+      for (int b = 0; b < 10; ++b) {
+        for (int i = 0; i < 50; ++i) {
+          const auto v = store.get(key(b, i));
+          const bool want = b < 9 ? i != 49 : b == 0 && i == 0;
+          if (want != v.has_value() || (b < 9 && v && *v != value(b))) {
+            ok &= expect(false, "key " + key(b, i) + " after torn batch" + tag);
+          }
+        }
+      }
+      if (round == 0) store.put("after", "x");
+      ok &= expect(store.get("after") == std::optional<std::string>("x"),
+                   "write after the torn tail" + tag);
+    }
+    remove_store_files(wal_path);
+  }
+  return ok;
+}
+
+// A record as a v1 build wrote it to the single-file log: the same header
+// with version 1, and an IEEE CRC-32 instead of CRC-32C.
+void append_v1_record(std::string& log, uint8_t type, uint64_t seq, std::string_view key,
+                      std::string_view value) {
+  std::string rec;
+  auto put = [&](auto v) { rec.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+  put(uint32_t{0x474C564Bu});  // 'K''V''L''G'
+  put(uint16_t{1});
+  put(type);
+  put(static_cast<uint32_t>(key.size()));
+  put(static_cast<uint32_t>(value.size()));
+  put(seq);
+  rec.append(key);
+  rec.append(value);
+  put(kv::crc32_update(0, reinterpret_cast<const uint8_t*>(rec.data()), rec.size()));
+  log += rec;
+}
+
+// A v1 log is replayed by this build, keeps its records next to the new
+// segments across a reopen, and is retired by the next checkpoint.
+bool check_v1_log() {
+  namespace fs = std::filesystem;
+  const std::string wal_path = "/tmp/kv_check_v1.wal";
+  const std::string snapshot_path = "/tmp/kv_check_v1.snapshot";
+  remove_store_files(wal_path);
+  std::string log;
+  uint64_t seq = 0;
+  for (int i = 0; i < 100; ++i) {
+    append_v1_record(log, 1, ++seq, "v1/" + std::to_string(i), "old" + std::to_string(i));
+  }
+  for (int i = 0; i < 100; i += 10) append_v1_record(log, 2, ++seq, "v1/" + std::to_string(i), "");
+  append_v1_record(log, 1, ++seq, "v1/5", "newer");
+  {
+    std::ofstream out(wal_path, std::ios::binary);
+    out.write(log.data(), static_cast<std::streamsize>(log.size()));
+  }
+
+  bool ok = true;
+  auto expect_contents = [&](kv::KVStore& store, const std::string& when) {
+    for (int i = 0; i < 100; ++i) {
+      const auto v = store.get("v1/" + std::to_string(i));
+      const std::optional<std::string> want =
+          i % 10 == 0 ? std::nullopt
+          : i == 5    ? std::optional<std::string>("newer")
+                      : std::optional<std::string>("old" + std::to_string(i));
+      if (v != want) ok &= expect(false, "v1/" + std::to_string(i) + " " + when);
+    }
+    ok &= expect(store.get("v2") == std::optional<std::string>("new"), "v2 record " + when);
+  };
+  for (int round = 0; round < 3; ++round) {
+    kv::KVStore store;
+    if (!store.open(wal_path)) return expect(false, "open v1 log");
+    if (round == 0) store.put("v2", "new");
+    expect_contents(store, round == 0 ? "after replay" : "after reopen");
+    if (round == 1) {
+      ok &= expect(store.checkpoint(snapshot_path, wal_path), "checkpoint");
+      ok &= expect(!fs::exists(wal_path), "v1 log retired by the checkpoint");
+    }
+  }
+  remove_store_files(wal_path);
+  fs::remove(snapshot_path);
+  return ok;
+}
+
+// LZ4 blocks decode to exactly their input, incompressible input is left
+// uncompressed, and a wrong length or a cut block is rejected.
+bool check_lz4() {
+  std::mt19937_64 rng(7);
+  bool ok = true;
+  const char* kinds[] = {"random bytes", "4 symbols", "repeated phrases"};
+  for (std::size_t n : {0, 1, 15, 16, 64, 1000, 4096, 65536, 1 << 20}) {
+    for (int kind = 0; kind < 3; ++kind) {
+      std::string in(n, '\0');
+      for (std::size_t i = 0; i < n; ++i) {
+        if (kind == 0) in[i] = static_cast<char>(rng());
+        if (kind == 1) in[i] = "ACGT"[rng() % 4];
+        if (kind == 2) {
+          in[i] = i >= 32 && rng() % 8 != 0 ? in[i - 32 + rng() % 16] : "xyz"[rng() % 3];
+        }
+      }
+      const std::string what = std::string(kinds[kind]) + ", " + std::to_string(n) + " bytes";
+      std::string packed = "#";  // appended to, never replaced
+      if (!kv::lz4_compress(in, packed)) {
+        ok &= expect(packed == "#", what + ": output changed on refusal");
+        ok &= expect(kind == 0 || n < 1000, what + ": not compressed");
+        continue;
+      }
+      ok &= expect(kind != 0, what + ": compressed random bytes");
+      const std::string_view block = std::string_view(packed).substr(1);
+      std::string out = "#";
+      ok &= expect(kv::lz4_decompress(block, n, out) && out == "#" + in, what + ": round trip");
+      std::string bad;
+      ok &= expect(!kv::lz4_decompress(block, n + 1, bad) && bad.empty(), what + ": long raw_len");
+      if (n > 0) {
+        ok &= expect(!kv::lz4_decompress(block, n - 1, bad) && bad.empty(),
+                     what + ": short raw_len");
+        ok &= expect(!kv::lz4_decompress(block.substr(0, block.size() - 1), n, bad) && bad.empty(),
+                     what + ": cut block");
+      }
+    }
+  }
+  return ok;
+}
+
+// One byte flipped inside the entries of a checkpoint: the file no longer
+// verifies, load_snapshot() refuses it and keeps what the store held, and
+// reopening either refuses the snapshot (block file) or maps the image and
+// reads the damaged entry as absent, never as a wrong value.
+bool check_snapshot_corruption() {
+  namespace fs = std::filesystem;
+  bool ok = true;
+  for (bool image : {false, true}) {
+    const std::string wal_path = "/tmp/kv_check_snap.wal";
+    const std::string other_wal = "/tmp/kv_check_snap_other.wal";
+    const std::string snapshot_path = "/tmp/kv_check_snap.snapshot";
+    remove_store_files(wal_path);
+    remove_store_files(other_wal);
+    kv::Options options;
+    options.snapshot_image = image;
+    const std::string tag = image ? " (image)" : " (block file)";
+    const int entries = 2000;
+    auto value = [](int i) { return std::string(100, static_cast<char>('a' + i % 26)); };
+    {
+      kv::KVStore store;
+      if (!store.open(wal_path, options)) return expect(false, "open" + tag);
+      for (int i = 0; i < entries; ++i) store.put("s" + std::to_string(i), value(i));
+      ok &= expect(store.checkpoint(snapshot_path, wal_path), "checkpoint" + tag);
+    }
+    const uint64_t size = fs::file_size(snapshot_path);
+    std::string byte(1, '\0');
+    {
+      std::ifstream in(snapshot_path, std::ios::binary);
+      in.seekg(static_cast<std::streamoff>(size / 3));
+      in.read(byte.data(), 1);
+    }
+    byte[0] = static_cast<char>(byte[0] ^ 0x5A);
+    overwrite_file(snapshot_path, size / 3, byte);
+
+    if (image) {
+      kv::SnapshotImage file;
+      ok &= expect(file.open(snapshot_path) == kv::SnapshotImage::Status::kOk && !file.verify(),
+                   "damaged image verifies");
+    } else {
+      kv::SnapshotFileReader file;
+      ok &= expect(file.open(snapshot_path) == kv::SnapshotFileReader::Status::kOk &&
+                       !file.verify(),
+                   "damaged snapshot verifies");
+    }
+    {
+      kv::KVStore other;
+      if (!other.open(other_wal)) return expect(false, "open second store" + tag);
+      other.put("kept", "yes");
+      ok &= expect(!other.load_snapshot(snapshot_path), "damaged snapshot loaded" + tag);
+      ok &= expect(other.get("kept") == std::optional<std::string>("yes") && other.size() == 1,
+                   "contents kept after a refused load" + tag);
+    }
+    {
+      kv::KVStore store;
+      const bool opened = store.open(wal_path, options);
+      if (!image) {
+        ok &= expect(!opened, "reopened on a damaged checkpoint");
+      } else if (expect(opened, "map a damaged image")) {
+        int missing = 0;
+        for (int i = 0; i < entries; ++i) {
+          const auto v = store.get("s" + std::to_string(i));
+          if (!v) {
+            ++missing;
+          } else if (*v != value(i)) {
+            ok &= expect(false, "wrong value for s" + std::to_string(i) + tag);
+          }
+        }
+        ok &= expect(missing >= 1 && missing < entries, "damaged image entries read as absent");
+      } else {
+        ok = false;
+      }
+    }
+    remove_store_files(wal_path);
+    remove_store_files(other_wal);
+    fs::remove(snapshot_path);
+  }
+  return ok;
+}
+
+// A snapshot keeps reading the values of its point in time while keys are
+// overwritten, deleted and added, through a checkpoint, with values inline
+// and in the value log; the store reads the new state throughout.
+bool check_snapshot_isolation() {
+  bool ok = true;
+  for (std::size_t threshold : {std::size_t{0}, std::size_t{64}}) {
+    const std::string wal_path = "/tmp/kv_check_mvcc.wal";
+    const std::string snapshot_path = "/tmp/kv_check_mvcc.snapshot";
+    remove_store_files(wal_path);
+    kv::Options options;
+    options.value_log_threshold = threshold;
+    const std::string tag = threshold != 0 ? " (value log)" : "";
+    // Odd keys get values past the threshold.
+    auto old_value = [](int i) { return "old" + std::to_string(i) + std::string(i % 2 * 99, '.'); };
+    auto new_value = [](int i) { return "new" + std::to_string(i) + std::string(i % 2 * 99, '.'); };
+    const int keys = 1000;
+
+    kv::KVStore store;
+    if (!store.open(wal_path, options)) return expect(false, "open" + tag);
+    for (int i = 0; i < keys; ++i) store.put("m/" + std::to_string(i), old_value(i));
+    kv::SnapshotPtr snap = store.snapshot();
+    for (int i = 0; i < keys; ++i) {
+      const std::string k = "m/" + std::to_string(i);
+      if (i % 3 == 0) {
+        store.del(k);
+      } else if (i % 3 == 1) {
+        store.put(k, new_value(i));
+      }
+      store.put("n/" + std::to_string(i), new_value(i));
+    }
+
+    auto expect_views = [&](const std::string& when) {
+      for (int i = 0; i < keys; ++i) {
+        const std::string k = "m/" + std::to_string(i);
+        if (store.get(k, *snap) != std::optional<std::string>(old_value(i))) {
+          ok &= expect(false, "snapshot read of " + k + " " + when + tag);
+        }
+        const std::optional<std::string> now =
+            i % 3 == 0   ? std::nullopt
+            : i % 3 == 1 ? std::optional<std::string>(new_value(i))
+                         : std::optional<std::string>(old_value(i));
+        if (store.get(k) != now) ok &= expect(false, "current read of " + k + " " + when + tag);
+      }
+      ok &= expect(store.list_keys_with_prefix("m/", *snap).size() == keys &&
+                       store.list_keys_with_prefix("n/", *snap).empty(),
+                   "snapshot key listing " + when + tag);
+      ok &= expect(store.list_keys_with_prefix("m/").size() == keys - (keys + 2) / 3 &&
+                       store.list_keys_with_prefix("n/").size() == keys,
+                   "current key listing " + when + tag);
+    };
+    expect_views("after writes");
+    ok &= expect(store.checkpoint(snapshot_path, wal_path), "checkpoint" + tag);
+    expect_views("after a checkpoint");
+    snap.reset();
+    for (int i = 0; i < keys; i += 3) {
+      ok &= expect(!store.get("m/" + std::to_string(i)), "deleted key back after release" + tag);
+    }
+    remove_store_files(wal_path);
+    std::filesystem::remove(snapshot_path);
+  }
+  return ok;
+}
+
+int run_checks() {
+  struct Check {
+    const char* name;
+    bool (*run)();
+  };
+  const Check checks[] = {
+      {"batch replay with a torn tail", check_batch_torn_tail},
+      {"v1 log read by this build", check_v1_log},
+      {"lz4 round trips", check_lz4},
+      {"snapshot and image with a damaged block", check_snapshot_corruption},
+      {"snapshot isolation across overwrite and delete", check_snapshot_isolation},
+  };
+  int failed = 0;
+  for (const Check& check : checks) {
+    const bool ok = check.run();
+    std::cout << (ok ? "ok      " : "FAILED  ") << check.name << std::endl;
+    if (!ok) ++failed;
+  }
+  std::cout << (failed == 0 ? "all checks passed" : std::to_string(failed) + " check(s) failed")
+            << "\n";
+  return failed == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::string mode = argc >= 2 ? argv[1] : "threads";
+
+  if (mode == "threads") {
+    const int ops = argc >= 3 ? std::atoi(argv[2]) : 200000;
+    const int read_pct = argc >= 4 ? std::atoi(argv[3]) : 90;
+    return bench_threads(ops, read_pct);
+  }
+
+  if (mode == "map") {
+    const int entries = argc >= 3 ? std::atoi(argv[2]) : 1000000;
+    const int value_bytes = argc >= 4 ? std::atoi(argv[3]) : 16;
+    return bench_map(entries, value_bytes);
+  }
+
+  if (mode == "lsm") {
+    const int entries = argc >= 3 ? std::atoi(argv[2]) : 1000000;
+    const int value_bytes = argc >= 4 ? std::atoi(argv[3]) : 100;
+    const int memtable_mb = argc >= 5 ? std::atoi(argv[4]) : 16;
+    return bench_lsm(entries, value_bytes, memtable_mb);
+  }
+
+  if (mode == "compress") {
+    const int objects = argc >= 3 ? std::atoi(argv[2]) : 20000;
+    const int object_bytes = argc >= 4 ? std::atoi(argv[3]) : 768;
+    return bench_compress(objects, object_bytes);
+  }
+
+  if (mode == "checkpoint") {
+    const int entries = argc >= 3 ? std::atoi(argv[2]) : 1000000;
+    const int value_bytes = argc >= 4 ? std::atoi(argv[3]) : 100;
+    return bench_checkpoint(entries, value_bytes);
+  }
+
+  if (mode == "check") return run_checks();
+
+  std::cerr << "usage: kv_bench threads [ops_per_thread] [read_pct]\n"
+            << "       kv_bench map [entries] [value_bytes]\n"
+            << "       kv_bench lsm [entries] [value_bytes] [memtable_mb]\n"
+            << "       kv_bench compress [objects] [object_bytes]\n"
+            << "       kv_bench checkpoint [entries] [value_bytes]\n"
+            << "       kv_bench check\n";
+  return 1;
+}
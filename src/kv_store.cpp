@@ -1,10 +1,125 @@
 #include "kv/kv_store.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <utility>
+
+#include "kv/io_backend.h"
+#include "kv/snapshot_file.h"
+#include "kv/sstable.h"
+#include "io_util.h"
+
 namespace kv {
 
+namespace {
+
+// Text snapshots (written before the binary format) are "key<TAB>value"
+// lines; a value kept in the value log is "key<TAB><hex pointer><TAB>vlog".
+// A key with a TTL gets a final "<TAB>expires=<unix ms>".
+constexpr std::string_view kRefTag = "vlog";
+constexpr std::string_view kExpiresTag = "expires=";
+
+// Where builds before the checkpoint record kept the in-memory snapshot.
+constexpr const char* kLegacySnapshotPath = "/tmp/kv.snapshot";
+
+bool parse_snapshot_line(const std::string& line, std::string& k, std::string& v,
+                         bool& value_ref, uint64_t& expires_at) {
+  const std::size_t tab = line.find('\t');
+  if (tab == std::string::npos) return false;
+  k.assign(line, 0, tab);
+  v.assign(line, tab + 1);
+  value_ref = false;
+  expires_at = 0;
+
+  const std::size_t last = v.rfind('\t');
+  if (last != std::string::npos && v.compare(last + 1, kExpiresTag.size(), kExpiresTag) == 0) {
+    char* end = nullptr;
+    const char* digits = v.c_str() + last + 1 + kExpiresTag.size();
+    const unsigned long long t = std::strtoull(digits, &end, 10);
+    if (end != digits && *end == '\0') {
+      expires_at = t;
+      v.resize(last);
+    }
+  }
+
+  const std::size_t tag = v.rfind('\t');
+  if (tag == std::string::npos || std::string_view(v).substr(tag + 1) != kRefTag ||
+      tag != 2 * ValuePointer::kEncodedSize) {
+    return true;
+  }
+  std::string raw(ValuePointer::kEncodedSize, '\0');
+  for (std::size_t i = 0; i < raw.size(); ++i) {
+    unsigned byte = 0;
+    if (std::sscanf(v.c_str() + 2 * i, "%2x", &byte) != 1) return true;
+    raw[i] = static_cast<char>(byte);
+  }
+  v = std::move(raw);
+  value_ref = true;
+  return true;
+}
+
+// v0.9: snapshots are saved and loaded a shard at a time on up to this many
+// threads.
+constexpr unsigned kMaxSnapshotThreads = 16;
+
+// Calls fn(i) for each i < n, spread over the calling thread and up to
+// kMaxSnapshotThreads - 1 more. Returns the number of threads used.
+unsigned for_each_parallel(std::size_t n, const std::function<void(std::size_t)>& fn) {
+  const auto threads = static_cast<unsigned>(std::min<std::size_t>(
+      std::clamp(std::thread::hardware_concurrency(), 1u, kMaxSnapshotThreads), n));
+  std::atomic<std::size_t> next{0};
+  auto work = [&] {
+    for (std::size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) fn(i);
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work);
+  work();
+  for (auto& t : pool) t.join();
+  return std::max(threads, 1u);
+}
+
+// v0.9 checkpoint_replay_ms: the replay throughput assumed until open() has
+// timed a replay at least this large.
+constexpr uint64_t kMinMeasuredReplayBytes = uint64_t{16} << 20;
+constexpr double kAssumedReplayBytesPerSec = 200e6;
+
+}  // namespace
+
+KVStore::KVStore(std::size_t num_shards)
+    : shards_(num_shards == 0 ? 1 : num_shards) {}
+
+KVStore::~KVStore() {
+  {
+    std::lock_guard lock(bg_mu_);
+    stop_ = true;
+  }
+  bg_cv_.notify_all();
+  if (background_.joinable()) background_.join();
+  {
+    std::lock_guard lock(ttl_mu_);
+    ttl_stop_ = true;
+  }
+  ttl_cv_.notify_all();
+  if (expiry_thread_.joinable()) expiry_thread_.join();
+  // The WAL writer thread outlives vlog_ (declared later); drain it now.
+  (void)flush_logs();
+  wal_.set_before_write({});
+}
+
+std::vector<std::unique_lock<std::shared_mutex>> KVStore::lock_all_shards() const {
+  std::vector<std::unique_lock<std::shared_mutex>> locks;
+  locks.reserve(shards_.size());
+  for (const auto& shard : shards_) locks.emplace_back(shard.mu);
+  return locks;
+}
+
 /*bool KVStore::open(const std::string& wal_path) {
   std::unique_lock lock(mu_);
   if (opened_) return true;
@@ -30,31 +145,113 @@ namespace kv {
 
 
 bool KVStore::open(const std::string& wal_path) {
-  std::unique_lock lock(mu_);
+  return open(wal_path, Options{});
+}
+
+bool KVStore::open(const std::string& wal_path, const Options& options) {
+  std::lock_guard wal_lock(wal_mu_);
+  auto shard_locks = lock_all_shards();
   //std::cerr << "[open] start\n";
 
   if (opened_) return true;
 
-  //std::cerr << "[open] load snapshot\n";
-  (void)load_from_file_unlocked("/tmp/kv.snapshot"); // <-- NO DEADLOCK
+  options_ = options;
+  wal_path_ = wal_path;
+  if (options.value_log_threshold != 0 &&
+      !vlog_.open(wal_path + ".vlog", options.value_log_file_bytes)) {
+    return false;
+  }
+  uint64_t skip_through = 0;
+  if (options.engine == Options::Engine::kLsm) {
+    tree_ = std::make_unique<LsmTree>();
+    const std::string dir = options.lsm_dir.empty() ? wal_path + ".lsm" : options.lsm_dir;
+    if (!tree_->open(dir, options)) {
+      tree_.reset();
+      return false;
+    }
+    // Deletes must stay in the memtable to shadow older table entries.
+    for (auto& shard : shards_) shard.mem = std::make_unique<Memtable>(true);
+    // Memtables grow a whole arena slab at a time.
+    flush_trigger_ = std::max(options.memtable_bytes / shards_.size(), 4 * Arena::kSlabBytes);
+    skip_through = tree_->flushed_seq();
+  }
 
+  // A checkpoint (or memtable flush) that died before it completed leaves its
+  // segments live; they replay ahead of the newer ones.
   //std::cerr << "[open] wal open: " << wal_path << "\n";
-  if (!wal_.open(wal_path)) return false;
+  if (!wal_.open(wal_path, options.wal_segment_bytes, options.io_backend,
+                 options.wal_direct_io)) {
+    return false;
+  }
+  if (tree_ == nullptr && !load_checkpoint_unlocked(skip_through)) return false;
+  wal_.set_max_group_delay(std::chrono::microseconds(options.wal_group_commit_delay_us));
+  wal_.set_compression(options.compression);
+  set_durability_locked(options);
+  if (vlog_.is_open()) wal_.set_before_write([this] { return vlog_.sync(); });
 
   //std::cerr << "[open] wal replay\n";
-  uint64_t max_seq = 0;
-  if (!wal_.replay_into(*this, max_seq)) return false;
+  uint64_t wal_seq = 0;
+  if (!wal_.replay_into(*this, wal_seq, skip_through)) return false;
 
-  seq_ = max_seq;
+  seq_ = std::max(skip_through, wal_seq);
+  checkpoint_seq_ = skip_through;
+  const Wal::ReplayStats replay = wal_.replay_stats();
+  if (replay.bytes >= kMinMeasuredReplayBytes && replay.seconds > 0) {
+    replay_bytes_per_sec_ = static_cast<double>(replay.bytes) / replay.seconds;
+  }
+  replayed_records_ = replay.records;
+  checkpoint_lsn_ = wal_.last_lsn();
   opened_ = true;
+  if (tree_ != nullptr) {
+    background_ = std::thread([this] { background_loop(); });
+  } else {
+    background_ = std::thread([this] { maintenance_loop(); });
+  }
+  expiry_thread_ = std::thread([this] { expiry_loop(); });
   std::cerr << "[open] done (seq=" << seq_ << ")\n";
   //std::cerr << "[open] map size after replay = " << map_.size() << "\n";
   return true;
 }
 
 void KVStore::set_group_commit_every(int n) {
-  std::unique_lock lock(mu_);
-  group_commit_every_ = (n <= 0) ? 1 : n;
+  std::lock_guard wal_lock(wal_mu_);
+  sync_every_ = n <= 1 ? 1 : static_cast<uint64_t>(n);
+  durability_ = n <= 1 ? Durability::kSync : Durability::kCount;
+}
+
+void KVStore::set_durability(const Options& options) {
+  std::lock_guard wal_lock(wal_mu_);
+  set_durability_locked(options);
+}
+
+void KVStore::set_durability_locked(const Options& options) {
+  durability_ = options.durability == Durability::kDefault ? Durability::kSync
+                                                           : options.durability;
+  sync_every_ = std::max(options.wal_sync_every, 1u);
+  sync_interval_ = std::chrono::milliseconds(options.wal_sync_interval_ms);
+  async_writeback_ = options.async_flush == Options::AsyncFlush::kSyncFileRange;
+}
+
+uint64_t KVStore::commit_target_locked(Durability durability) {
+  const uint64_t lsn = wal_.last_lsn();
+  switch (durability == Durability::kDefault ? durability_ : durability) {
+    case Durability::kCount:
+      // A quiet writer must not leave its last records unsynced for long.
+      wal_.sync_within(sync_interval_);
+      return lsn >= sync_every_ ? lsn - (sync_every_ - 1) : 0;
+    case Durability::kTimed:
+      wal_.sync_within(sync_interval_);
+      return 0;
+    case Durability::kAsync:
+      if (async_writeback_) {
+        wal_.write_back_soon();
+      } else {
+        wal_.sync_within(std::chrono::microseconds(0));
+      }
+      return 0;
+    default:
+      return lsn;
+  }
 }
 /*void KVStore::put(std::string key, std::string value) {
   std::unique_lock lock(mu_);
@@ -70,139 +267,1067 @@ void KVStore::set_group_commit_every(int n) {
   }
   }*/
 
- void KVStore::put(std::string key, std::string value) {
-  std::unique_lock lock(mu_);
-  if (!opened_) return; // or throw
+ void KVStore::put(std::string key, std::string value, Durability durability) {
+  put_value(key, value, 0, durability);
+}
 
-  uint64_t s = ++seq_;
+void KVStore::put(std::string key, std::string value, std::chrono::milliseconds ttl,
+                  Durability durability) {
+  const auto ms = static_cast<uint64_t>(std::max<int64_t>(ttl.count(), 1));
+  put_value(key, value, TimingWheel::now_ms() + ms, durability);
+}
+
+void KVStore::put_value(std::string_view key, std::string_view value, uint64_t expires_at,
+                        Durability durability) {
+  const uint64_t h = hash_key(key);
+  Shard& shard = shard_at(h);
+  std::unique_lock shard_lock(shard.mu, std::defer_lock);
+  uint64_t s = 0;
+  SnapshotBounds snaps;
+
+  // 0) Large values go to the value log (outside the sequencing lock); the
+  // WAL and the index only carry the pointer.
+  std::string ref;
+  if (!separate_value(key, value, ref)) return;
+  const bool is_ref = !ref.empty();
+  uint64_t lsn = 0;
 
-  // 1) WAL first (write-ahead)
-  if (!wal_.append_put(s, key, value)) return;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return; // or throw
 
-  // 2) Apply to in-memory state immediately
-  map_[key] = value;  // keep it simple and correct
+    s = ++seq_;
+    snaps = snapshot_bounds_locked();
 
-  // 3) Durability boundary: flush periodically (group commit)
+    // 1) WAL first (write-ahead)
+    const bool logged = expires_at != 0 ? wal_.append_put_ttl(s, key, is_ref ? ref : value,
+                                                              is_ref, expires_at)
+                        : is_ref        ? wal_.append_put_ref(s, key, ref)
+                                        : wal_.append_put(s, key, value);
+    if (!logged) return;
+    lsn = commit_target_locked(durability);
 
-  if ((s % group_commit_every_) == 0) {
-      if (!wal_.flush()) return;
+    // Take the shard lock before leaving the sequencing step so a later
+    // write to the same key cannot be applied ahead of this one.
+    shard_lock.lock();
   }
-  /*if ((s % 5) == 0) {
-    if (!wal_.flush()) return;
-  }*/
+
+  // 3) Apply to in-memory state; only this shard is blocked.
+  if (is_ref) {
+    shard.mem->put(key, h, ref, s, snaps, ValueRec::kValueRef, expires_at);
+  } else {
+    shard.mem->put(key, h, value, s, snaps, 0, expires_at);
+  }
+  const std::size_t bytes = shard.mem->memory_bytes();
+  shard_lock.unlock();
+  if (expires_at != 0) schedule_expiry(key, expires_at);
+  if (tree_ != nullptr) note_memtable_size(bytes);
+
+  // 4) Durability boundary (group commit): the WAL thread writes and syncs
+  // this record together with whatever else queued meanwhile. A failed
+  // sync is retried by the WAL thread. Timed and async writes skip this.
+  (void)wait_for_log(lsn);
 }
 
-std::optional<std::string> KVStore::get(const std::string& key) const {
-  std::shared_lock lock(mu_);
-  auto it = map_.find(key);
-  if (it == map_.end()) return std::nullopt;
-  return it->second;
+std::optional<std::string> KVStore::get(std::string_view key) const {
+  std::optional<std::string> result;
+  read(key, [&](std::string_view v) { result.emplace(v); });
+  return result;
 }
 
-bool KVStore::del(const std::string& key) {
-  std::unique_lock lock(mu_);
-  if (!opened_) return false; // or throw
+bool KVStore::contains(std::string_view key) const {
+  return read(key, [](std::string_view) {});
+}
 
-  uint64_t s = ++seq_;
-  if (!wal_.append_del(s, key)) return false;
+ValueHandle KVStore::get_view(std::string_view key) const {
+  const uint64_t h = hash_key(key);
+  const Shard& shard = shard_at(h);
+  ValueHandle handle;
+  handle.lock_ = std::shared_lock(shard.mu);
+  const ValueRec* v = memtable_version(shard, key, h, kMaxSeq);
+  if (v != nullptr && !v->value_ref()) {
+    if (dead(v)) {
+      handle.lock_.unlock();
+      return handle;
+    }
+    handle.view_ = v->view();
+    handle.found_ = true;
+    return handle;
+  }
 
-  if ((s % group_commit_every_) == 0) {
-     if (!wal_.flush()) return false;
+  handle.lock_.unlock();
+  if (v == nullptr && tree_ == nullptr) {
+    SnapshotImage::Entry e;
+    if (!image_get(key, h, &e)) return handle;
+    if (!e.value_ref) {
+      handle.view_ = e.value;
+      handle.found_ = true;
+      return handle;
+    }
   }
-  return map_.erase(key) > 0;
+  auto value = std::make_unique<std::string>();
+  if (!get_copy(key, h, kMaxSeq, *value)) return handle;
+  handle.owned_ = std::move(value);
+  handle.view_ = *handle.owned_;
+  handle.found_ = true;
+  return handle;
 }
 
-std::size_t KVStore::size() const {
-  std::shared_lock lock(mu_);
-  return map_.size();
+bool KVStore::get_copy(std::string_view key, uint64_t hash, uint64_t at,
+                       std::string& out) const {
+  const Shard& shard = shard_at(hash);
+  // A table lookup runs without the shard lock, so value log GC can relocate
+  // the value and delete its file in between; the relocated copy is then a
+  // newer version, found on the next attempt.
+  for (int attempt = 0; attempt < 3; ++attempt) {
+    {
+      std::shared_lock lock(shard.mu);
+      if (const ValueRec* v = memtable_version(shard, key, hash, at)) {
+        if (dead(v)) return false;
+        if (!v->value_ref()) {
+          out.assign(v->view());
+          return true;
+        }
+        // GC cannot relocate it while the shard lock is held.
+        return read_value_log(key, v->view(), out);
+      }
+      if (tree_ == nullptr) {
+        SnapshotImage::Entry e;
+        if (!image_get(key, hash, &e)) return false;
+        if (!e.value_ref) {
+          out.assign(e.value);
+          return true;
+        }
+        return read_value_log(key, e.value, out);
+      }
+    }
+    uint64_t expires_at = 0;
+    const auto found = tree_->get(key, at, &out, &expires_at);
+    if (expires_at != 0 && expires_at <= TimingWheel::now_ms()) return false;
+    switch (found) {
+      case SSTable::Lookup::kFound:
+        return true;
+      case SSTable::Lookup::kFoundRef: {
+        const std::string encoded = out;
+        if (read_value_log(key, encoded, out)) return true;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return false;
 }
 
-bool KVStore::save_snapshot(const std::string& path) {
-  std::shared_lock lock(mu_);
+bool KVStore::read_value_log(std::string_view key, std::string_view encoded,
+                             std::string& out) const {
+  ValuePointer ptr;
+  return ValuePointer::decode(encoded, &ptr) && vlog_.read(ptr, key, &out);
+}
 
-  std::string tmp = path + ".tmp";
+bool KVStore::get_into(std::string_view key, std::string& out) const {
+  return read(key, [&](std::string_view v) { out.assign(v.data(), v.size()); });
+}
+
+std::vector<KVStore::LookupPlan>
+KVStore::plan_lookups(std::span<const std::string_view> keys) const {
+  std::vector<LookupPlan> plan;
+  plan.reserve(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const uint64_t h = hash_key(keys[i]);
+    plan.push_back(LookupPlan{h, shard_index(h), i});
+  }
+  std::sort(plan.begin(), plan.end(), [](const LookupPlan& a, const LookupPlan& b) {
+    return a.shard != b.shard ? a.shard < b.shard : a.hash < b.hash;
+  });
+  return plan;
+}
+
+std::vector<std::optional<std::string>>
+KVStore::multi_get(std::span<const std::string_view> keys) const {
+  std::vector<std::optional<std::string>> result(keys.size());
+  multi_read(keys, [&](std::size_t i, std::string_view v) {
+    result[i].emplace(v);
+  });
+  return result;
+}
+
+SnapshotBounds KVStore::snapshot_bounds_locked() const {
+  SnapshotBounds b;
+  if (!snapshots_.empty()) {
+    b.any = true;
+    b.oldest = *snapshots_.begin();
+    b.newest = *snapshots_.rbegin();
+  }
+  return b;
+}
+
+SnapshotPtr KVStore::snapshot() const {
+  std::lock_guard wal_lock(wal_mu_);
+  return snapshot_locked();
+}
 
-  std::ofstream out(tmp);
-  if (!out) return false;
+SnapshotPtr KVStore::snapshot_locked() const {
+  // Every write sequenced at or before seq_ already holds its shard lock, so
+  // a reader through the snapshot waits for it rather than missing it.
+  snapshots_.insert(seq_);
+  reclaim_floor_.store(*snapshots_.begin(), std::memory_order_relaxed);
+  return SnapshotPtr(new Snapshot(seq_), [this](const Snapshot* snap) {
+    release_snapshot(snap->seq());
+    delete snap;
+  });
+}
 
-  for (const auto& [k, v] : map_) {
-    out << k << '\t' << v << '\n';
+void KVStore::release_snapshot(uint64_t seq) const {
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    snapshots_.erase(snapshots_.find(seq));
+    reclaim_floor_.store(snapshots_.empty() ? kMaxSeq : *snapshots_.begin(),
+                         std::memory_order_relaxed);
+  }
+
+  // The floor is re-read under each shard lock: a snapshot taken since then
+  // can only need heads, which reclaim never drops, and writers sequenced
+  // after it wait for this lock before applying.
+  // Reclaiming only frees versions no reader can reach, so it is allowed
+  // from const readers that happened to hold the last reference. Shards
+  // without old versions are skipped under the shared lock, so readers and
+  // writers there are not stalled.
+  for (auto& shard : const_cast<std::vector<Shard>&>(shards_)) {
+    {
+      std::shared_lock lock(shard.mu);
+      if (!shard.mem->has_old_versions()) continue;
+    }
+    std::unique_lock lock(shard.mu);
+    if (!shard.mem->has_old_versions()) continue;
+    shard.mem->reclaim(reclaim_floor_.load(std::memory_order_relaxed));
   }
+}
 
-  out.close();
+std::optional<std::string> KVStore::get(std::string_view key, const Snapshot& snap) const {
+  const uint64_t h = hash_key(key);
+  const Shard& shard = shard_at(h);
+  {
+    std::shared_lock lock(shard.mu);
+    const ValueRec* v = memtable_version(shard, key, h, snap.seq());
+    if (v != nullptr && !v->value_ref()) {
+      if (dead(v)) return std::nullopt;
+      return std::string(v->view());
+    }
+    if (v == nullptr && tree_ == nullptr) {
+      // The image predates every snapshot.
+      SnapshotImage::Entry e;
+      if (!image_get(key, h, &e)) return std::nullopt;
+      if (!e.value_ref) return std::string(e.value);
+    }
+  }
+  std::string value;
+  if (!get_copy(key, h, snap.seq(), value)) return std::nullopt;
+  return value;
+}
 
-  // atomic replace
-  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
-    return false;
+std::vector<std::optional<std::string>>
+KVStore::multi_get(std::span<const std::string_view> keys, const Snapshot& snap) const {
+  std::vector<std::optional<std::string>> result(keys.size());
+  multi_read_at(keys, snap.seq(), [&](std::size_t i, std::string_view v) {
+    result[i].emplace(v);
+  });
+  return result;
+}
+
+bool KVStore::scan_shard(const Shard& shard, uint64_t at, std::string_view begin,
+                         std::string_view end, ScanValues values, const ScanFn& fn) const {
+  struct Entry {
+    std::string key;
+    std::string value;
+    bool value_ref;
+    uint64_t expires_at;
+  };
+  std::vector<Entry> batch;
+  // Memtable keys with a version at `at`; they hide the image's entry.
+  std::vector<std::string> shadowed;
+  const auto part = static_cast<std::size_t>(&shard - shards_.data());
+  std::string resume(begin);
+  bool after_resume = false;  // resume names a key already visited
+
+  for (;;) {
+    batch.clear();
+    shadowed.clear();
+    bool more = false;
+    std::string bound;  // with more: the batch covers the keys up to here
+    {
+      std::shared_lock lock(shard.mu);
+      const uint64_t now = TimingWheel::now_ms();
+      auto collect = [&](std::string_view key, std::string_view value, bool value_ref,
+                         uint64_t expires_at) {
+        Entry& e = batch.emplace_back(Entry{std::string(key), {}, false, 0});
+        if (values == ScanValues::kNone) return;
+        if (value_ref && values == ScanValues::kResolved) {
+          // Under the lock, so GC cannot move the record meanwhile.
+          if (!read_value_log(e.key, value, e.value)) batch.pop_back();
+          return;
+        }
+        e.value.assign(value);
+        e.value_ref = value_ref;
+        e.expires_at = expires_at;
+      };
+
+      std::size_t seen = 0;
+      const KeyRec* last = nullptr;
+      shard.mem->index().scan_range(resume, end, [&](const KeyRec* k) {
+        if (after_resume && k->view() == resume) return true;
+        if (seen == kScanBatch) {
+          more = true;
+          return false;
+        }
+        ++seen;
+        last = k;
+        const ValueRec* v = version_at(k, at);
+        if (v == nullptr) return true;
+        if (image_ != nullptr) shadowed.emplace_back(k->view());
+        if (v->tombstone() || v->expired(now)) return true;
+        collect(k->view(), v->view(), v->value_ref(), v->expires_at());
+        return true;
+      });
+      // Re-seek from the last visited key next time; the index may change
+      // while the lock is dropped, but keys are never visited twice.
+      if (more) bound.assign(last->view());
+
+      if (image_ != nullptr) {
+        // Merge up to kScanBatch image entries from the same position. The
+        // batch then ends at whichever side ran out of its share first.
+        std::size_t from_memtable = batch.size();
+        std::string_view last_image;
+        bool image_more = false;
+        std::size_t taken = 0;
+        SnapshotImage::Entry e;
+        for (uint64_t i = image_->lower_bound(part, resume); i < image_->count(part); ++i) {
+          if (!image_->entry_at(part, i, &e)) continue;  // damaged: skipped
+          if (after_resume && e.key == resume) continue;
+          if ((!end.empty() && e.key >= end) || (more && e.key > bound)) break;
+          if (taken == kScanBatch) {
+            image_more = true;
+            break;
+          }
+          ++taken;
+          last_image = e.key;
+          if (std::binary_search(shadowed.begin(), shadowed.end(), e.key, std::less<>()) ||
+              (e.expires_at != 0 && e.expires_at <= now)) {
+            continue;
+          }
+          collect(e.key, e.value, e.value_ref, e.expires_at);
+        }
+        if (image_more) {
+          if (!more || last_image < bound) bound.assign(last_image);
+          more = true;
+          // Memtable keys past the bound come again with the next batch.
+          const auto memtable_end = batch.begin() + from_memtable;
+          const auto past = std::partition_point(batch.begin(), memtable_end, [&](const Entry& x) {
+            return x.key <= bound;
+          });
+          from_memtable = static_cast<std::size_t>(past - batch.begin());
+          batch.erase(past, memtable_end);
+        }
+        std::inplace_merge(batch.begin(), batch.begin() + from_memtable, batch.end(),
+                           [](const Entry& a, const Entry& b) { return a.key < b.key; });
+      }
+      if (more) resume = bound;
+    }
+
+    for (const auto& e : batch) {
+      if (!fn(e.key, e.value, e.value_ref, e.expires_at)) return false;
+    }
+    if (!more) return true;
+    after_resume = true;
+  }
+}
+
+bool KVStore::scan_lsm(uint64_t at, std::string_view begin, std::string_view end,
+                       ScanValues values, const ScanFn& fn) const {
+  const bool with_values = values != ScanValues::kNone;
+  const uint64_t now = TimingWheel::now_ms();
+  // Memtable overlay for the range: the newest version at `at` per key, mem
+  // over imm (nullopt = deleted). Copied out so no lock is held while the
+  // tables are read or fn runs.
+  std::map<std::string, std::optional<std::string>, std::less<>> overlay;
+  for (const auto& shard : shards_) {
+    std::shared_lock lock(shard.mu);
+    auto collect = [&](const Memtable& mem) {
+      mem.index().scan_range(begin, end, [&](const KeyRec* k) {
+        const ValueRec* v = version_at(k, at);
+        if (v == nullptr) return true;
+        // emplace keeps an entry already taken from the newer memtable.
+        auto [it, inserted] = overlay.try_emplace(std::string(k->view()));
+        if (!inserted || v->tombstone() || v->expired(now)) return true;
+        it->second.emplace();
+        if (!with_values) return true;
+        if (!v->value_ref()) {
+          it->second->assign(v->view());
+        } else if (!read_value_log(it->first, v->view(), *it->second)) {
+          it->second.reset();
+        }
+        return true;
+      });
+    };
+    collect(*shard.mem);
+    if (shard.imm != nullptr) collect(*shard.imm);
   }
 
+  // Merge the overlay into the tables' (already ordered) output.
+  auto next = overlay.begin();
+  auto emit_overlay_before = [&](std::string_view key) {
+    for (; next != overlay.end() && next->first < key; ++next) {
+      if (next->second.has_value() && !fn(next->first, *next->second, false, 0)) return false;
+    }
+    return true;
+  };
+
+  bool go = true;
+  std::string resolved;
+  tree_->scan(begin, end, at, now, [&](std::string_view k, std::string_view v, EntryType type) {
+    if (!emit_overlay_before(k)) return go = false;
+    if (next != overlay.end() && next->first == k) return true;  // shadowed
+    if (!with_values) {
+      v = {};
+    } else if (type == EntryType::Ref) {
+      // Callers scan at a pinned snapshot, so the record cannot be deleted.
+      if (!read_value_log(k, v, resolved)) return true;
+      v = resolved;
+    }
+    if (!fn(k, v, false, 0)) return go = false;
+    return true;
+  });
+  if (!go) return false;
+  for (; next != overlay.end(); ++next) {
+    if (next->second.has_value() && !fn(next->first, *next->second, false, 0)) return false;
+  }
   return true;
 }
 
-bool KVStore::load_snapshot(const std::string& path) {
-  std::unique_lock lock(mu_);
+bool KVStore::scan_all(uint64_t at, std::string_view begin, std::string_view end,
+                       ScanValues values, const ScanFn& fn) const {
+  if (tree_ != nullptr) return scan_lsm(at, begin, end, values, fn);
+  for (const auto& shard : shards_) {
+    if (!scan_shard(shard, at, begin, end, values, fn)) return false;
+  }
+  return true;
+}
 
-  std::ifstream in(path);
-  if (!in) return false;
+void KVStore::scan(const Snapshot& snap, std::string_view begin, std::string_view end,
+                   const std::function<void(std::string_view, std::string_view)>& fn) const {
+  scan_all(snap.seq(), begin, end, ScanValues::kResolved,
+           [&](std::string_view k, std::string_view v, bool, uint64_t) {
+             fn(k, v);
+             return true;
+           });
+}
+
+bool KVStore::del(std::string_view key, Durability durability) {
+  const uint64_t h = hash_key(key);
+  Shard& shard = shard_at(h);
+  std::unique_lock shard_lock(shard.mu, std::defer_lock);
+  uint64_t s = 0;
+  SnapshotBounds snaps;
+  uint64_t lsn = 0;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false; // or throw
+
+    s = ++seq_;
+    snaps = snapshot_bounds_locked();
+    if (!wal_.append_del(s, key)) return false;
+    lsn = commit_target_locked(durability);
+    shard_lock.lock();
+  }
+  // With no version in the memtables, the key may still be live in the
+  // mapped image or (LSM engine) an SSTable; the tombstone hides it there.
+  // Expired entries are not live (image_get() skips them).
+  bool below = false;
+  if (memtable_version(shard, key, h, kMaxSeq) == nullptr) {
+    if (tree_ != nullptr) {
+      std::string stored;
+      uint64_t expires_at = 0;
+      const auto found = tree_->get(key, kMaxSeq, &stored, &expires_at);
+      below = (found == SSTable::Lookup::kFound || found == SSTable::Lookup::kFoundRef) &&
+              (expires_at == 0 || expires_at > TimingWheel::now_ms());
+    } else {
+      SnapshotImage::Entry e;
+      below = image_ != nullptr && image_get(key, h, &e);
+    }
+  }
+  const bool erased = shard.mem->erase(key, h, s, snaps) || below;
+  const std::size_t bytes = shard.mem->memory_bytes();
+  shard_lock.unlock();
+  if (tree_ != nullptr) note_memtable_size(bytes);
+  return wait_for_log(lsn) && erased;
+}
+
+bool KVStore::write(const WriteBatch& batch, Durability durability) {
+  if (batch.empty()) return true;
+
+  // Hash every key once and work out which shards the batch touches.
+  std::vector<uint64_t> hashes;
+  hashes.reserve(batch.count());
+  std::vector<std::size_t> touched;
+  touched.reserve(batch.count());
+  batch.for_each([&](WriteBatch::OpType, std::string_view key, std::string_view) {
+    hashes.push_back(hash_key(key));
+    touched.push_back(shard_index(hashes.back()));
+  });
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
 
-  map_.clear();
+  // Move large values to the value log; the logged batch carries pointers.
+  const WriteBatch* logged = &batch;
+  WriteBatch separated;
+  if (vlog_.is_open()) {
+    bool any = false;
+    bool ok = true;
+    std::string ref;
+    batch.for_each([&](WriteBatch::OpType op, std::string_view key, std::string_view value) {
+      if (!ok) return;
+      if (op == WriteBatch::OpType::Put) {
+        ok = separate_value(key, value, ref);
+        if (!ref.empty()) {
+          separated.put_ref(key, ref);
+          any = true;
+          return;
+        }
+      }
+      separated.append(op, key, value);
+    });
+    if (!ok) return false;
+    if (any) logged = &separated;
+  }
+
+  std::vector<std::unique_lock<std::shared_mutex>> shard_locks;
+  shard_locks.reserve(touched.size());
+  uint64_t first = 0;
+  SnapshotBounds snaps;
+  uint64_t lsn = 0;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false;
+
+    first = seq_ + 1;
+    snaps = snapshot_bounds_locked();
+    if (!wal_.append_batch(first, logged->count(), logged->data())) return false;
+    seq_ += logged->count();
+    lsn = commit_target_locked(durability);
+
+    // Ascending shard order, same as lock_all_shards().
+    for (std::size_t idx : touched) shard_locks.emplace_back(shards_[idx].mu);
+  }
 
-  std::string k, v;
-  while (in >> k >> v) {
-    map_[k] = v;
+  std::size_t i = 0;
+  logged->for_each([&](WriteBatch::OpType op, std::string_view key, std::string_view value) {
+    const uint64_t s = first + i;
+    const uint64_t h = hashes[i++];
+    if (op == WriteBatch::OpType::Put) {
+      shard_at(h).mem->put(key, h, value, s, snaps);
+    } else if (op == WriteBatch::OpType::PutRef) {
+      shard_at(h).mem->put(key, h, value, s, snaps, ValueRec::kValueRef);
+    } else {
+      shard_at(h).mem->erase(key, h, s, snaps);
+    }
+  });
+
+  std::size_t bytes = 0;
+  for (std::size_t idx : touched) {
+    bytes = std::max(bytes, shards_[idx].mem->memory_bytes());
+  }
+  shard_locks.clear();
+  if (tree_ != nullptr) note_memtable_size(bytes);
+  return wait_for_log(lsn);
+}
+
+std::size_t KVStore::size() const {
+  if (tree_ != nullptr) {
+    // Live keys are only known by merging the memtables with every level.
+    const SnapshotPtr snap = snapshot();
+    std::size_t n = 0;
+    scan_lsm(snap->seq(), {}, {}, ScanValues::kNone,
+             [&](std::string_view, std::string_view, bool, uint64_t) {
+               ++n;
+               return true;
+             });
+    return n;
+  }
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < shards_.size(); ++i) {
+    const Shard& shard = shards_[i];
+    std::shared_lock lock(shard.mu);
+    n += shard.mem->live();
+    if (image_ == nullptr) continue;
+    // Image keys the memtable has a version of were counted above, if live.
+    n += image_->count(i);
+    SnapshotImage::Entry e;
+    shard.mem->index().scan_range({}, {}, [&](const KeyRec* k) {
+      if (image_->find(i, k->view(), hash_key(k->view()), &e)) --n;
+      return true;
+    });
+  }
+  return n;
+}
+
+bool KVStore::save_snapshot(const std::string& path) {
+  // Serialized from an MVCC snapshot, so writers are never blocked for more
+  // than one scan batch.
+  const SnapshotPtr snap = snapshot();
+
+  std::string tmp = path + ".tmp";
+  if (!save_to_file_unlocked(tmp, *snap)) return false;
+
+  // atomic replace
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    return false;
   }
 
   return true;
 }
 
+bool KVStore::load_snapshot(const std::string& path) {
+  if (tree_ != nullptr || image_ != nullptr) return false;
+  auto shard_locks = lock_all_shards();
+  // Keeps the current contents when the file is missing or damaged: the
+  // loader checks every block before it clears the shards.
+  return load_from_file_unlocked(path, nullptr, false, true);
+}
+
 // Keep snapshot utilities if you want, but note:
 // v0.2 correctness is via WAL; snapshot is optional.
 bool KVStore::load_from_file(const std::string& path) {
-  std::unique_lock lock(mu_);
+  if (tree_ != nullptr || image_ != nullptr) return false;
+  auto shard_locks = lock_all_shards();
   return load_from_file_unlocked(path);
 }
 
 bool KVStore::save_to_file(const std::string& path) const {
-  std::shared_lock lock(mu_);
-  return save_to_file_unlocked(path);
+  const SnapshotPtr snap = snapshot();
+  return save_to_file_unlocked(path, *snap);
 }
 
 
 
 bool KVStore::checkpoint(const std::string& snapshot_path,
-                         const std::string& wal_path) {
-  std::unique_lock lock(mu_);
-  if (!opened_) return false;
+                         const std::string& /*wal_path*/) {
+  // v0.9: rotate the WAL and pin a snapshot at the same sequence number, then
+  // serialize the snapshot while writers append to the fresh segment.
+  if (tree_ != nullptr) return flush_memtable();
 
-  // 1. Save snapshot
-  if (!save_to_file_unlocked(snapshot_path)) return false;
+  std::lock_guard maintenance(maintenance_mu_);
+  const auto started = std::chrono::steady_clock::now();
+  auto locked = started;
+  SnapshotPtr snap;
+  uint64_t lsn = 0;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false;
 
-  // 2. Rotate WAL
-  wal_.close();
-  std::remove(wal_path.c_str());
+    // 1. Pin a snapshot at seq_ and have the WAL writer start a new segment
+    // at the first record after it; no I/O under the sequencing lock.
+    locked = std::chrono::steady_clock::now();
+    snap = snapshot_locked();
+    lsn = wal_.last_lsn();
+    wal_.rotate_after(snap->seq());
+  }
+  const auto pinned = std::chrono::steady_clock::now();
 
-  if (!wal_.open(wal_path)) return false;
+  // 2. Save snapshot (atomically replaced), then recycle the segments before
+  // the rotation. Value-log records the snapshot points at must be durable
+  // first.
+  const std::string tmp = snapshot_path + ".tmp";
+  const auto discard = [&] {
+    std::remove(tmp.c_str());
+    return false;
+  };
+  if (!save_to_file_unlocked(tmp, *snap)) return discard();
+  if (!vlog_.sync()) return discard();
+  const uint64_t segment = wal_.finish_rotation();
+  if (segment == 0) return discard();
+  if (std::rename(tmp.c_str(), snapshot_path.c_str()) != 0) return discard();
+  // The rename must be durable before the segments it replaces are dropped.
+  const std::string dir = std::filesystem::path(snapshot_path).parent_path().string();
+  if (!sync_dir(dir.empty() ? "." : dir)) return false;
+  // The MANIFEST names the snapshot from here on: open() loads it and
+  // replays only the WAL after snap->seq().
+  std::error_code ec;
+  const Wal::Checkpoint recorded{snap->seq(), std::filesystem::absolute(snapshot_path, ec).string()};
+  if (ec || !wal_.release_before(segment, &recorded)) return false;
+  compacted_bytes_ = 0;
+  checkpoint_seq_ = snap->seq();
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    replayed_records_ = 0;
+    checkpoint_lsn_ = lsn;
+  }
+
+  const auto us = [](auto d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+  const auto bytes = std::filesystem::file_size(snapshot_path, ec);
+  std::cerr << "[checkpoint] seq " << snap->seq() << ": " << (ec ? 0 : bytes) / 1e6
+            << " MB in " << us(std::chrono::steady_clock::now() - started) / 1000
+            << " ms (writes paused " << us(pinned - locked) << " us)\n";
+  return true;
+}
+
+bool KVStore::checkpoint_async(const std::string& snapshot_path) {
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false;
+  }
+  std::lock_guard lock(bg_mu_);
+  if (tree_ != nullptr) {
+    flush_requested_ = true;
+  } else {
+    checkpoint_path_ = snapshot_path;
+    // One still queued (not yet started) covers this request too.
+    if (!checkpoint_queued_) ++checkpoints_requested_;
+    checkpoint_queued_ = true;
+  }
+  bg_cv_.notify_all();
+  return true;
+}
+
+bool KVStore::wait_checkpoint() {
+  // A flush may already be past its freeze point: run one that covers
+  // everything written so far instead of waiting for it.
+  if (tree_ != nullptr) return flush_memtables();
+  std::unique_lock lock(bg_mu_);
+  const uint64_t target = checkpoints_requested_;
+  bg_cv_.wait(lock, [&] { return stop_ || checkpoints_completed_ >= target; });
+  return checkpoints_completed_ >= target && checkpoint_ok_;
+}
+
+bool KVStore::compact_wal() {
+  if (tree_ != nullptr) return false;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false;
+  }
+  std::lock_guard maintenance(maintenance_mu_);
+  Wal::CompactStats stats;
+  const bool ok = wal_.compact(
+      [this](std::string_view key, uint64_t seq, bool is_delete) {
+        return wal_record_live(key, seq, is_delete);
+      },
+      &stats);
+  if (ok && stats.segments != 0) compacted_bytes_ = stats.bytes_out;
+  return ok;
+}
+
+bool KVStore::wal_record_live(std::string_view key, uint64_t seq, bool is_delete) const {
+  const uint64_t h = hash_key(key);
+  const Shard& shard = shard_at(h);
+  std::shared_lock lock(shard.mu);
+  const ValueRec* v = memtable_version(shard, key, h, kMaxSeq);
+  if (v == nullptr) return is_delete;
+  return v->seq == seq;
+}
+
+void KVStore::maintenance_loop() {
+  const std::string checkpoint_path =
+      options_.checkpoint_path.empty() ? wal_path_ + ".snapshot" : options_.checkpoint_path;
+  const auto min_interval = std::chrono::milliseconds(options_.checkpoint_min_interval_ms);
+  // Since the last checkpoint seen, of any kind (or open()).
+  auto checkpointed_at = std::chrono::steady_clock::now();
+  uint64_t checkpointed_seq = checkpoint_seq_.load();
+
+  std::unique_lock lock(bg_mu_);
+  for (;;) {
+    bg_cv_.wait_for(lock, std::chrono::seconds(1), [&] { return stop_ || checkpoint_queued_; });
+    if (stop_) return;
+    if (checkpoint_queued_) {
+      checkpoint_queued_ = false;
+      const std::string path = checkpoint_path_;
+      const uint64_t target = checkpoints_requested_;
+      lock.unlock();
+      const bool ok = checkpoint(path, wal_path_);
+      lock.lock();
+      checkpoint_ok_ = ok;
+      checkpoints_completed_ = target;
+      bg_cv_.notify_all();
+      continue;
+    }
+    lock.unlock();
+    if (checkpoint_seq_.load() != checkpointed_seq) {
+      checkpointed_seq = checkpoint_seq_.load();
+      checkpointed_at = std::chrono::steady_clock::now();
+    }
+    // A checkpoint drops the whole log, so it goes ahead of cleaning.
+    const char* reason = nullptr;
+    if (std::chrono::steady_clock::now() - checkpointed_at >= min_interval &&
+        (reason = checkpoint_trigger()) != nullptr) {
+      std::cerr << "[checkpoint] automatic (" << reason << ")\n";
+      if (!checkpoint(checkpoint_path, wal_path_)) {
+        std::cerr << "[checkpoint] automatic checkpoint to " << checkpoint_path << " failed\n";
+      }
+      // Failures wait out the interval too.
+      checkpointed_seq = checkpoint_seq_.load();
+      checkpointed_at = std::chrono::steady_clock::now();
+    } else if (options_.wal_compact_bytes != 0) {
+      const uint64_t trigger = std::max(options_.wal_compact_bytes, 2 * compacted_bytes_.load());
+      if (wal_.sealed_bytes() >= trigger) (void)compact_wal();
+    }
+    lock.lock();
+  }
+}
+
+const char* KVStore::checkpoint_trigger() {
+  const bool by_bytes = options_.checkpoint_wal_bytes != 0 || options_.checkpoint_replay_ms != 0;
+  const uint64_t bytes = by_bytes ? wal_.log_bytes() : 0;
+  if (options_.checkpoint_wal_bytes != 0 && bytes >= options_.checkpoint_wal_bytes) {
+    return "WAL bytes";
+  }
+  if (options_.checkpoint_wal_records != 0) {
+    uint64_t records = 0;
+    {
+      std::lock_guard wal_lock(wal_mu_);
+      records = replayed_records_ + (wal_.last_lsn() - checkpoint_lsn_);
+    }
+    if (records >= options_.checkpoint_wal_records) return "WAL records";
+  }
+  if (options_.checkpoint_replay_ms != 0) {
+    const double rate =
+        replay_bytes_per_sec_ > 0 ? replay_bytes_per_sec_ : kAssumedReplayBytesPerSec;
+    if (static_cast<double>(bytes) / rate * 1e3 >= options_.checkpoint_replay_ms) {
+      return "replay time";
+    }
+  }
+  return nullptr;
+}
 
+bool KVStore::load_checkpoint_unlocked(uint64_t& seq) {
+  const Wal::Checkpoint cp = wal_.checkpoint();
+  if (!wal_.checkpoint_recorded()) {
+    // Written by a build that always checkpointed to one fixed file; keep
+    // using it, and record it with the next MANIFEST write. As before, a
+    // damaged one is left out.
+    std::error_code ec;
+    if (std::filesystem::exists(kLegacySnapshotPath, ec) &&
+        load_from_file_unlocked(kLegacySnapshotPath, &seq, true)) {
+      wal_.set_checkpoint({seq, kLegacySnapshotPath});
+    }
+    return true;
+  }
+  if (cp.snapshot_path.empty()) return true;
+  // The WAL before cp.seq is gone: without the snapshot the store would
+  // come up silently missing data.
+  if (!load_from_file_unlocked(cp.snapshot_path, &seq, true)) {
+    std::cerr << "[open] checkpoint " << cp.snapshot_path << " (seq " << cp.seq
+              << ") could not be loaded\n";
+    return false;
+  }
+  // The footer seq wins: a checkpoint that died between its rename and the
+  // MANIFEST write leaves a newer snapshot than recorded, and the WAL after
+  // it still live.
+  if (seq < cp.seq) {
+    std::cerr << "[open] checkpoint " << cp.snapshot_path << " is older (seq " << seq
+              << ") than recorded (seq " << cp.seq << ")\n";
+    return false;
+  }
   return true;
 }
 
-bool KVStore::load_from_file_unlocked(const std::string& path) {
+bool KVStore::load_from_file_unlocked(const std::string& path, uint64_t* seq,
+                                      bool map_image, bool replace) {
+  if (seq != nullptr) *seq = 0;
+  const auto started = std::chrono::steady_clock::now();
+  auto image = std::make_unique<SnapshotImage>();
+  switch (image->open(path)) {
+    case SnapshotImage::Status::kMissing:
+      return false;
+    case SnapshotImage::Status::kCorrupt:
+      std::cerr << "[snapshot] " << path << ": bad image footer or directory, not loaded\n";
+      return false;
+    case SnapshotImage::Status::kOk:
+      return load_image_unlocked(std::move(image), path, started, seq, map_image, replace);
+    case SnapshotImage::Status::kOther:
+      break;
+  }
+  SnapshotFileReader file;
+  switch (file.open(path)) {
+    case SnapshotFileReader::Status::kMissing:
+      return false;
+    case SnapshotFileReader::Status::kText:
+      if (replace) {
+        for (auto& shard : shards_) shard.mem->clear();
+      }
+      return load_text_snapshot_unlocked(path);
+    case SnapshotFileReader::Status::kCorrupt:
+      std::cerr << "[snapshot] " << path << ": bad header or footer, not loaded\n";
+      return false;
+    case SnapshotFileReader::Status::kOk:
+      break;
+  }
+  // Every block crc is checked before anything is applied.
+  std::atomic<bool> ok{true};
+  unsigned threads = for_each_parallel(file.partitions(), [&](std::size_t p) {
+    if (!file.verify_partition(p)) ok = false;
+  });
+  if (!ok) {
+    std::cerr << "[snapshot] " << path << ": damaged, not loaded\n";
+    return false;
+  }
+  if (replace) {
+    for (auto& shard : shards_) shard.mem->clear();
+  }
+
+  const uint64_t now = TimingWheel::now_ms();
+  // One partition per shard (a file saved with as many shards as this
+  // store): each thread fills whole shards, without locks.
+  const bool by_shard = file.partitions() == shards_.size();
+  // Size every shard table up front: no rehash while loading.
+  for (std::size_t i = 0; i < shards_.size(); ++i) {
+    const uint64_t n = by_shard ? file.partition_entries(i) : file.entries() / shards_.size();
+    shards_[i].mem->reserve(n + n / 8 + 16);
+  }
+
+  if (by_shard) {
+    // Keys another shard owns (a file saved with another hash) are left
+    // for a sequential pass below.
+    std::vector<char> stray(file.partitions(), 0);
+    threads = for_each_parallel(file.partitions(), [&](std::size_t p) {
+      Memtable& mem = *shards_[p].mem;
+      const bool read = file.read_partition(p, [&](std::string_view k, std::string_view v,
+                                                   bool value_ref, uint64_t expires_at) {
+        const uint64_t h = hash_key(k);
+        if (shard_index(h) != p) {
+          stray[p] = 1;
+          return;
+        }
+        if (expires_at != 0 && expires_at <= now) return;
+        mem.put(k, h, v, 0, SnapshotBounds{}, value_ref ? ValueRec::kValueRef : 0, expires_at);
+        if (expires_at != 0) schedule_expiry(k, expires_at);
+      });
+      if (!read) ok = false;
+    });
+    for (std::size_t p = 0; p < file.partitions() && ok; ++p) {
+      if (!stray[p]) continue;
+      ok = file.read_partition(p, [&](std::string_view k, std::string_view v, bool value_ref,
+                                      uint64_t expires_at) {
+        if (shard_index(hash_key(k)) == p) return;
+        if (expires_at != 0 && expires_at <= now) return;
+        apply_put_no_log_unlocked(k, v, 0, value_ref ? ValueRec::kValueRef : 0, expires_at);
+      });
+    }
+  } else {
+    threads = 1;
+    for (std::size_t p = 0; p < file.partitions() && ok; ++p) {
+      ok = file.read_partition(p, [&](std::string_view k, std::string_view v, bool value_ref,
+                                      uint64_t expires_at) {
+        if (expires_at != 0 && expires_at <= now) return;
+        apply_put_no_log_unlocked(k, v, 0, value_ref ? ValueRec::kValueRef : 0, expires_at);
+      });
+    }
+  }
+  if (!ok) {
+    std::cerr << "[snapshot] " << path << ": damaged, not loaded\n";
+    return false;
+  }
+  const double ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  std::cerr << "[snapshot] loaded " << file.entries() << " entries (seq " << file.seq()
+            << ") in " << ms << " ms (" << file.partitions() << " partition(s), " << threads
+            << " thread(s))\n";
+  if (seq != nullptr) *seq = file.seq();
+  return true;
+}
+
+bool KVStore::load_image_unlocked(std::unique_ptr<SnapshotImage> image, const std::string& path,
+                                  std::chrono::steady_clock::time_point started, uint64_t* seq,
+                                  bool map_image, bool replace) {
+  // Mapped, the image is served in place: nothing is read up front, and
+  // each entry's crc is checked when it is read. Partition i has to be
+  // shard i, probed with this store's hash, so a store with another shard
+  // count or hash (another standard library) copies it in instead.
+  const bool mapped = map_image && image->partitions() == shards_.size() &&
+                      image->hash_id() == hash_id();
+  if (mapped) {
+    // Deletes of image keys are kept as tombstones to hide them.
+    for (auto& shard : shards_) shard.mem = std::make_unique<Memtable>(true);
+    // Past deadlines too: expire_due() removes those with a logged Expire.
+    image->for_each_ttl([&](const SnapshotImage::Entry& e) {
+      schedule_expiry(e.key, e.expires_at);
+    });
+  } else {
+    if (!image->verify()) {
+      std::cerr << "[snapshot] " << path << ": damaged, not loaded\n";
+      return false;
+    }
+    if (replace) {
+      for (auto& shard : shards_) shard.mem->clear();
+    }
+    const uint64_t now = TimingWheel::now_ms();
+    SnapshotImage::Entry e;
+    for (std::size_t p = 0; p < image->partitions(); ++p) {
+      for (uint64_t i = 0; i < image->count(p); ++i) {
+        if (!image->entry_at(p, i, &e)) return false;
+        if (e.expires_at != 0 && e.expires_at <= now) continue;
+        apply_put_no_log_unlocked(e.key, e.value, 0, e.value_ref ? ValueRec::kValueRef : 0,
+                                  e.expires_at);
+      }
+    }
+  }
+  const double ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  std::cerr << "[snapshot] " << (mapped ? "mapped " : "loaded ") << image->entries()
+            << " entries (seq " << image->seq() << ") in " << ms << " ms ("
+            << image->partitions() << " partition(s), image)\n";
+  if (seq != nullptr) *seq = image->seq();
+  if (mapped) image_ = std::move(image);
+  return true;
+}
+
+bool KVStore::load_text_snapshot_unlocked(const std::string& path) {
   std::ifstream in(path);
   if (!in) return false;
-  std::string k, v;
-  while (in >> k >> v) {
-    map_[k] = v;
+  std::string line, k, v;
+  bool value_ref = false;
+  uint64_t expires_at = 0;
+  const uint64_t now = TimingWheel::now_ms();
+  while (std::getline(in, line)) {
+    if (!parse_snapshot_line(line, k, v, value_ref, expires_at)) continue;
+    if (expires_at != 0 && expires_at <= now) continue;
+    apply_put_no_log_unlocked(k, v, 0, value_ref ? ValueRec::kValueRef : 0, expires_at);
   }
   return true;
 }
 
-bool KVStore::save_to_file_unlocked(const std::string& path) const {
-  std::ofstream out(path);
-  if (!out) return false;
-  for (const auto& [k, v] : map_) {
-    out << k << '\t' << v << '\n';
+bool KVStore::save_to_file_unlocked(const std::string& path, const Snapshot& snap) const {
+  // v0.9: written through the configured I/O backend and fdatasync'ed, so
+  // the rename that publishes it never exposes a partly written file.
+  // One partition per shard, encoded and compressed in parallel (the LSM
+  // engine scans in key order, into one). Value-log pointers are saved as
+  // pointers, so snapshots stay metadata-sized.
+  if (options_.snapshot_image && tree_ == nullptr) {
+    SnapshotImageWriter image(options_.io_backend, shards_.size(), hash_id());
+    if (!image.open(path)) return false;
+    for_each_parallel(shards_.size(), [&](std::size_t i) {
+      scan_shard(shards_[i], snap.seq(), {}, {}, ScanValues::kStored,
+                 [&](std::string_view k, std::string_view v, bool value_ref, uint64_t expires_at) {
+                   image.add(i, k, hash_key(k), v, value_ref, expires_at);
+                   return true;
+                 });
+    });
+    return image.finish(snap.seq());
   }
-  return true;
+  const std::size_t partitions = tree_ != nullptr ? 1 : shards_.size();
+  SnapshotFileWriter file(options_.io_backend, options_.compression, partitions);
+  if (!file.open(path)) return false;
+  for_each_parallel(partitions, [&](std::size_t i) {
+    auto add = [&](std::string_view k, std::string_view v, bool value_ref, uint64_t expires_at) {
+      file.add(i, k, v, value_ref, expires_at);
+      return true;
+    };
+    if (tree_ != nullptr) {
+      scan_all(snap.seq(), {}, {}, ScanValues::kStored, add);
+    } else {
+      scan_shard(shards_[i], snap.seq(), {}, {}, ScanValues::kStored, add);
+    }
+  });
+  return file.finish(snap.seq());
 }
 
 /*void KVStore::apply_put_no_log_unlocked(std::string key, std::string value) {
@@ -214,33 +1339,467 @@ void KVStore::apply_del_no_log_unlocked(const std::string& key) {
 }*/
 
 bool KVStore::flush_wal() {
-  std::unique_lock lock(mu_);
-  return wal_.flush();
+  // No sequencing lock: writers keep appending while this waits.
+  return flush_logs();
+}
+
+bool KVStore::flush_logs() {
+  return vlog_.sync() && wal_.flush();
 }
 
 void KVStore::ApplyPut(std::string key, std::string value) {
-  std::unique_lock lock(mu_);
-  map_[std::move(key)] = std::move(value);
+  const uint64_t h = hash_key(key);
+  Shard& shard = shard_at(h);
+  std::unique_lock shard_lock(shard.mu, std::defer_lock);
+  uint64_t s = 0;
+  SnapshotBounds snaps;
+  // Large values go to the value log, as in put().
+  std::string ref;
+  if (!separate_value(key, value, ref)) return;
+  const bool is_ref = !ref.empty();
+  {
+    // Logged without waiting (the Raft log is what makes it durable), so
+    // the WAL holds every version: log cleaning decides what a record is
+    // superseded by from the shard tables.
+    std::lock_guard wal_lock(wal_mu_);
+    s = ++seq_;
+    snaps = snapshot_bounds_locked();
+    if (opened_ && !(is_ref ? wal_.append_put_ref(s, key, ref) : wal_.append_put(s, key, value))) {
+      return;
+    }
+    shard_lock.lock();
+  }
+  if (is_ref) {
+    shard.mem->put(key, h, ref, s, snaps, ValueRec::kValueRef);
+  } else {
+    shard.mem->put(key, h, value, s, snaps);
+  }
 }
 
 void KVStore::ApplyDel(const std::string& key) {
-  std::unique_lock lock(mu_);
-  map_.erase(key);
+  const uint64_t h = hash_key(key);
+  Shard& shard = shard_at(h);
+  std::unique_lock shard_lock(shard.mu, std::defer_lock);
+  uint64_t s = 0;
+  SnapshotBounds snaps;
+  {
+    std::lock_guard wal_lock(wal_mu_);
+    s = ++seq_;
+    snaps = snapshot_bounds_locked();
+    if (opened_ && !wal_.append_del(s, key)) return;
+    shard_lock.lock();
+  }
+  shard.mem->erase(key, h, s, snaps);
 }
 
 std::vector<std::string>
 KVStore::list_keys_with_prefix(const std::string& prefix) const {
-  std::shared_lock lock(mu_);
+  const SnapshotPtr snap = snapshot();
+  return list_keys_with_prefix(prefix, *snap);
+}
 
+std::vector<std::string>
+KVStore::list_keys_with_prefix(const std::string& prefix, const Snapshot& snap) const {
   std::vector<std::string> result;
 
-  for (const auto& [k, _] : map_) {
-    if (k.rfind(prefix, 0) == 0) {
-      result.push_back(k);
-    }
+  // Smallest string above every key starting with `prefix` (empty if none).
+  std::string end = prefix;
+  while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xFF) end.pop_back();
+  if (!end.empty()) end.back() = static_cast<char>(end.back() + 1);
+
+  // Each shard seeks to the first key >= prefix and stops past the last
+  // match; the per-shard runs are then merged into one sorted list.
+  scan_all(snap.seq(), prefix, end, ScanValues::kNone,
+           [&](std::string_view k, std::string_view, bool, uint64_t) {
+             result.emplace_back(k);
+             return true;
+           });
+
+  if (tree_ == nullptr) std::sort(result.begin(), result.end());
+  return result;
+}
+
+std::vector<std::string>
+KVStore::list_keys_in_range(const std::string& begin, const std::string& end,
+                            std::size_t limit) const {
+  std::vector<std::string> result;
+  const SnapshotPtr snap = snapshot();
+
+  if (tree_ != nullptr) {
+    // Already in global key order: stop at the limit.
+    scan_lsm(snap->seq(), begin, end, ScanValues::kNone,
+             [&](std::string_view k, std::string_view, bool, uint64_t) {
+               result.emplace_back(k);
+               return limit == 0 || result.size() < limit;
+             });
+    return result;
   }
 
+  for (const auto& shard : shards_) {
+    std::size_t taken = 0;
+    scan_shard(shard, snap->seq(), begin, end, ScanValues::kNone,
+               [&](std::string_view k, std::string_view, bool, uint64_t) {
+                 result.emplace_back(k);
+                 return limit == 0 || ++taken < limit;
+               });
+  }
+
+  std::sort(result.begin(), result.end());
+  if (limit != 0 && result.size() > limit) result.resize(limit);
   return result;
 }
 
-} // namespace kv
\ No newline at end of file
+// ---------------- v0.9 value log ----------------
+
+namespace {
+
+bool points_at(std::string_view encoded, const ValuePointer& ptr) {
+  ValuePointer cur;
+  return ValuePointer::decode(encoded, &cur) && cur.file == ptr.file &&
+         cur.offset == ptr.offset;
+}
+
+}  // namespace
+
+bool KVStore::separate_value(std::string_view key, std::string_view value, std::string& ref) {
+  ref.clear();
+  if (!vlog_.is_open() || value.size() < options_.value_log_threshold) return true;
+  ValuePointer ptr;
+  if (!vlog_.append(key, value, &ptr)) return false;
+  ref = ptr.encode();
+  return true;
+}
+
+bool KVStore::value_log_live(std::string_view key, uint64_t hash, const ValuePointer& ptr,
+                             uint64_t* expires_at) const {
+  uint64_t deadline = 0;
+  if (const ValueRec* v = memtable_version(shard_at(hash), key, hash, kMaxSeq)) {
+    if (!v->value_ref() || !points_at(v->view(), ptr)) return false;
+    deadline = v->expires_at();
+  } else if (tree_ != nullptr) {
+    std::string stored;
+    if (tree_->get(key, kMaxSeq, &stored, &deadline) != SSTable::Lookup::kFoundRef ||
+        !points_at(stored, ptr)) {
+      return false;
+    }
+  } else {
+    SnapshotImage::Entry e;
+    if (!image_find(key, hash, &e) || !e.value_ref || !points_at(e.value, ptr)) return false;
+    deadline = e.expires_at;
+  }
+  // Nobody reads an expired value again, so its record is garbage.
+  if (deadline != 0 && deadline <= TimingWheel::now_ms()) return false;
+  if (expires_at != nullptr) *expires_at = deadline;
+  return true;
+}
+
+uint64_t KVStore::gc_value_log(double min_garbage) {
+  if (!vlog_.is_open()) return 0;
+  std::lock_guard gc_lock(vlog_gc_mu_);
+
+  uint64_t freed = 0;
+  auto delete_ready = [&] {
+    uint64_t oldest = kMaxSeq;
+    {
+      std::lock_guard wal_lock(wal_mu_);
+      if (!snapshots_.empty()) oldest = *snapshots_.begin();
+    }
+    std::erase_if(vlog_pending_, [&](const std::pair<uint32_t, uint64_t>& p) {
+      if (oldest < p.second) return false;
+      const uint64_t bytes = vlog_.file_size(p.first);
+      if (vlog_.remove_file(p.first)) freed += bytes;
+      return true;
+    });
+  };
+  delete_ready();
+
+  auto record_bytes = [](std::string_view key, const ValuePointer& ptr) {
+    return 12 + key.size() + ptr.len;
+  };
+
+  for (uint32_t file : vlog_.sealed_files()) {
+    if (std::any_of(vlog_pending_.begin(), vlog_pending_.end(),
+                    [&](const auto& p) { return p.first == file; })) {
+      continue;
+    }
+
+    // 1. Measure: live bytes are records the newest version still points at.
+    const uint64_t total = vlog_.file_size(file);
+    uint64_t live = 0;
+    vlog_.for_each_record(file, [&](std::string_view key, const ValuePointer& ptr) {
+      const uint64_t h = hash_key(key);
+      std::shared_lock lock(shard_at(h).mu);
+      if (value_log_live(key, h, ptr)) live += record_bytes(key, ptr);
+    });
+    if (total == 0 || static_cast<double>(total - live) < min_garbage * total) continue;
+
+    // 2. Relocate live values to the active file. Each move is a logged
+    // write of the new pointer, applied only if nothing overwrote the key
+    // since it was read.
+    bool ok = true;
+    std::string value;
+    std::size_t memtable_bytes = 0;
+    ok = vlog_.for_each_record(file, [&](std::string_view key, const ValuePointer& ptr) {
+      if (!ok) return;
+      const uint64_t h = hash_key(key);
+      Shard& shard = shard_at(h);
+      const uint64_t flushed = tree_ != nullptr ? tree_->flushed_seq() : 0;
+      uint64_t expires_at = 0;  // relocated values keep their TTL
+      {
+        std::shared_lock lock(shard.mu);
+        if (!value_log_live(key, h, ptr, &expires_at)) return;
+        if (!vlog_.read(ptr, key, &value)) {
+          ok = false;
+          return;
+        }
+      }
+      ValuePointer moved;
+      if (!vlog_.append(key, value, &moved)) {
+        ok = false;
+        return;
+      }
+      const std::string ref = moved.encode();
+
+      std::unique_lock shard_lock(shard.mu, std::defer_lock);
+      uint64_t s = 0;
+      SnapshotBounds snaps;
+      {
+        std::lock_guard wal_lock(wal_mu_);
+        shard_lock.lock();
+        const ValueRec* v = memtable_version(shard, key, h, kMaxSeq);
+        bool still_live = false;
+        if (v != nullptr) {
+          still_live = v->value_ref() && points_at(v->view(), ptr);
+        } else if (tree_ != nullptr) {
+          // Unchanged unless a flush moved a newer write into the tables.
+          still_live = tree_->flushed_seq() == flushed || value_log_live(key, h, ptr);
+        } else {
+          still_live = image_ != nullptr;  // the mapped image never changes
+        }
+        if (!still_live) return;  // the copy is garbage in the new file
+        s = ++seq_;
+        snaps = snapshot_bounds_locked();
+        const bool logged = expires_at != 0
+                                ? wal_.append_put_ttl(s, key, ref, true, expires_at)
+                                : wal_.append_put_ref(s, key, ref);
+        if (!logged) {
+          ok = false;
+          return;
+        }
+      }
+      shard.mem->put(key, h, ref, s, snaps, ValueRec::kValueRef, expires_at);
+      memtable_bytes = std::max(memtable_bytes, shard.mem->memory_bytes());
+    }) && ok;
+    if (tree_ != nullptr) note_memtable_size(memtable_bytes);
+    if (!ok) {
+      std::cerr << "[vlog] gc of file " << file << " failed\n";
+      return freed;
+    }
+
+    // 3. Once the new pointers are durable, the file only serves snapshots
+    // taken before now.
+    uint64_t done_seq = 0;
+    uint64_t lsn = 0;
+    {
+      std::lock_guard wal_lock(wal_mu_);
+      done_seq = seq_;
+      lsn = wal_.last_lsn();
+    }
+    if (!wal_.wait_durable(lsn)) return freed;
+    vlog_pending_.emplace_back(file, done_seq);
+    delete_ready();
+    break;
+  }
+  return freed;
+}
+
+// ---------------- v0.9 TTL ----------------
+
+void KVStore::schedule_expiry(std::string_view key, uint64_t expires_at) {
+  {
+    std::lock_guard lock(ttl_mu_);
+    wheel_.schedule(std::string(key), expires_at);
+  }
+  ttl_cv_.notify_one();
+}
+
+uint64_t KVStore::current_expiry(std::string_view key, uint64_t hash) const {
+  if (const ValueRec* v = memtable_version(shard_at(hash), key, hash, kMaxSeq)) {
+    return v->tombstone() ? 0 : v->expires_at();
+  }
+  if (tree_ == nullptr) {
+    SnapshotImage::Entry e;
+    return image_find(key, hash, &e) ? e.expires_at : 0;
+  }
+  std::string stored;
+  uint64_t expires_at = 0;
+  const auto found = tree_->get(key, kMaxSeq, &stored, &expires_at);
+  return found == SSTable::Lookup::kFound || found == SSTable::Lookup::kFoundRef ? expires_at
+                                                                               : 0;
+}
+
+void KVStore::expire_due(const std::vector<TimingWheel::Entry>& due) {
+  std::size_t memtable_bytes = 0;
+  for (const auto& e : due) {
+    const uint64_t h = hash_key(e.key);
+    Shard& shard = shard_at(h);
+    std::unique_lock shard_lock(shard.mu, std::defer_lock);
+    uint64_t s = 0;
+    SnapshotBounds snaps;
+    {
+      std::lock_guard wal_lock(wal_mu_);
+      if (!opened_) return;
+      shard_lock.lock();
+      // Overwritten, deleted or given a new TTL since it was scheduled.
+      if (current_expiry(e.key, h) != e.expires_at) continue;
+
+      s = ++seq_;
+      snaps = snapshot_bounds_locked();
+      // Not waited for: replay re-derives a lost expiry from the deadline.
+      if (!wal_.append_expire(s, e.key)) return;
+      wal_.sync_within(sync_interval_);
+    }
+    shard.mem->erase(e.key, h, s, snaps);
+    memtable_bytes = std::max(memtable_bytes, shard.mem->memory_bytes());
+  }
+  if (tree_ != nullptr) note_memtable_size(memtable_bytes);
+}
+
+void KVStore::expiry_loop() {
+  std::vector<TimingWheel::Entry> due;
+  std::unique_lock lock(ttl_mu_);
+  for (;;) {
+    // Sleep until something is scheduled, then wake once per tick.
+    if (wheel_.empty()) {
+      ttl_cv_.wait(lock, [&] { return ttl_stop_ || !wheel_.empty(); });
+    } else {
+      ttl_cv_.wait_for(lock, std::chrono::milliseconds(wheel_.tick_ms()));
+    }
+    if (ttl_stop_) return;
+
+    wheel_.advance(TimingWheel::now_ms(), &due);
+    if (due.empty()) continue;
+    lock.unlock();
+    expire_due(due);
+    due.clear();
+    lock.lock();
+  }
+}
+
+// ---------------- v0.9 LSM engine ----------------
+
+bool KVStore::flush_memtable() {
+  if (tree_ == nullptr) return false;
+  return flush_memtables();
+}
+
+void KVStore::note_memtable_size(std::size_t bytes) {
+  if (bytes < flush_trigger_) return;
+  std::unique_lock lock(bg_mu_);
+  const uint64_t seen = flushes_completed_;
+  flush_requested_ = true;
+  bg_cv_.notify_all();
+  // Writers outrunning the flush: wait for it instead of growing without
+  // bound. The next flush picks up this memtable.
+  if (bytes >= 2 * flush_trigger_) {
+    bg_cv_.wait(lock, [&] { return stop_ || flushes_completed_ != seen; });
+  }
+}
+
+bool KVStore::flush_memtables() {
+  std::lock_guard flush_lock(flush_mu_);
+
+  // 1. Freeze: rotate the WAL and swap out every memtable at one sequence
+  // number. Every write <= seq_ holds (or held) its shard lock, so it is in
+  // a frozen memtable and its record in the rotated log. Memtables left
+  // frozen by a failed flush are retried as they are instead.
+  // imm is only replaced under flush_mu_, so it can be read here unlocked.
+  if (shards_.front().imm == nullptr) {
+    std::lock_guard wal_lock(wal_mu_);
+    if (!opened_) return false;
+    auto shard_locks = lock_all_shards();
+    bool any = false;
+    for (const auto& shard : shards_) any = any || !shard.mem->empty();
+    if (!any) return true;
+    frozen_seq_ = seq_;
+    wal_.rotate_after(frozen_seq_);
+    for (auto& shard : shards_) {
+      shard.imm = std::shared_ptr<const Memtable>(std::move(shard.mem));
+      shard.mem = std::make_unique<Memtable>(true);
+    }
+  }
+  std::vector<std::shared_ptr<const Memtable>> frozen;
+  for (const auto& shard : shards_) frozen.push_back(shard.imm);
+
+  // 2. Write every version of every key, keys ascending and versions newest
+  // first, without any lock: frozen memtables are never modified.
+  std::vector<const KeyRec*> recs;
+  for (const auto& mem : frozen) {
+    mem->index().scan_range({}, {}, [&](const KeyRec* k) {
+      recs.push_back(k);
+      return true;
+    });
+  }
+  std::sort(recs.begin(), recs.end(), [](const KeyRec* a, const KeyRec* b) {
+    return a->view() < b->view();
+  });
+
+  const uint64_t number = tree_->new_file_number();
+  SSTableWriter writer(options_);
+  bool ok = writer.open(tree_->table_path(number));
+  for (std::size_t i = 0; ok && i < recs.size(); ++i) {
+    for (const ValueRec* v = recs[i]->head; ok && v != nullptr; v = v->prev) {
+      const EntryType type = v->tombstone()   ? EntryType::Del
+                             : v->value_ref() ? EntryType::Ref
+                                              : EntryType::Put;
+      ok = writer.add(recs[i]->view(), v->seq, type, v->view(), v->expires_at());
+    }
+  }
+  ok = ok && writer.finish() && vlog_.sync();
+  // Kept across retries: a failed flush may already have finished it.
+  if (ok && frozen_segment_ == 0) frozen_segment_ = wal_.finish_rotation();
+  ok = ok && frozen_segment_ != 0 && tree_->install_flush(number, frozen_seq_);
+  if (!ok) {
+    // Keep the frozen memtables readable and the rotated log on disk; the
+    // next open replays it.
+    writer.abandon();
+    std::cerr << "[lsm] memtable flush failed\n";
+    return false;
+  }
+
+  // 3. The table now answers for everything <= freeze_seq.
+  for (auto& shard : shards_) {
+    std::unique_lock lock(shard.mu);
+    shard.imm.reset();
+  }
+  checkpoint_seq_ = frozen_seq_;
+  const uint64_t segment = std::exchange(frozen_segment_, 0);
+  return wal_.release_before(segment);
+}
+
+void KVStore::background_loop() {
+  for (;;) {
+    {
+      std::unique_lock lock(bg_mu_);
+      bg_cv_.wait(lock, [&] { return stop_ || flush_requested_; });
+      if (stop_) return;
+      flush_requested_ = false;
+    }
+    // Stalled writers are released even if the flush failed; they retry
+    // (and stall again) on their next write rather than hang here.
+    const bool flushed = flush_memtables();
+    {
+      std::lock_guard lock(bg_mu_);
+      ++flushes_completed_;
+    }
+    bg_cv_.notify_all();
+    if (!flushed) continue;
+    while (tree_->compact_once(reclaim_floor_.load(std::memory_order_relaxed),
+                               TimingWheel::now_ms())) {
+      std::lock_guard lock(bg_mu_);
+      if (stop_) return;
+    }
+  }
+}
+
+} // namespace kv
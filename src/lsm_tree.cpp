@@ -0,0 +1,371 @@
+#include "kv/lsm_tree.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_util.h"
+
+namespace kv {
+namespace {
+
+// k-way merge of table cursors by key ascending, then seq descending.
+class MergingIterator {
+ public:
+  void add(std::unique_ptr<SSTable::Iterator> it) {
+    if (!it->ok()) ok_ = false;
+    if (it->valid()) heap_.push(it.get());
+    owned_.push_back(std::move(it));
+  }
+
+  bool valid() const { return !heap_.empty(); }
+  bool ok() const { return ok_; }
+  const SSTable::Iterator& top() const { return *heap_.top(); }
+
+  void next() {
+    SSTable::Iterator* it = heap_.top();
+    heap_.pop();
+    it->next();
+    if (!it->ok()) ok_ = false;
+    if (it->valid()) heap_.push(it);
+  }
+
+ private:
+  struct Later {
+    bool operator()(const SSTable::Iterator* a, const SSTable::Iterator* b) const {
+      const int c = a->key().compare(b->key());
+      return c != 0 ? c > 0 : a->seq() < b->seq();
+    }
+  };
+
+  std::vector<std::unique_ptr<SSTable::Iterator>> owned_;
+  std::priority_queue<SSTable::Iterator*, std::vector<SSTable::Iterator*>, Later> heap_;
+  bool ok_ = true;
+};
+
+uint64_t total_bytes(const std::vector<std::shared_ptr<SSTable>>& tables) {
+  uint64_t n = 0;
+  for (const auto& t : tables) n += t->file_size();
+  return n;
+}
+
+}  // namespace
+
+bool LsmTree::open(const std::string& dir, const Options& options) {
+  dir_ = dir;
+  options_ = options;
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) return false;
+
+  auto v = std::make_shared<Version>();
+  std::set<uint64_t> live;
+
+  std::ifstream in(dir_ + "/MANIFEST");
+  if (in) {
+    std::string line;
+    if (!std::getline(in, line) || line != "KVMANIFEST 1") return false;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string tag;
+      fields >> tag;
+      if (tag == "next_file") {
+        fields >> next_file_;
+      } else if (tag == "flushed_seq") {
+        fields >> flushed_seq_;
+      } else if (tag == "table") {
+        int level = -1;
+        uint64_t number = 0;
+        fields >> level >> number;
+        if (level < 0 || level >= kNumLevels) return false;
+        auto t = SSTable::open(table_path(number), number);
+        if (t == nullptr) {
+          std::cerr << "[lsm] cannot open table " << table_path(number) << "\n";
+          return false;
+        }
+        v->levels[level].push_back(std::move(t));
+        live.insert(number);
+      }
+    }
+  }
+
+  // Drop outputs of flushes/compactions that never made it into the MANIFEST.
+  for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+    const auto& p = entry.path();
+    if (p.extension() != ".sst") continue;
+    const uint64_t number = std::strtoull(p.stem().c_str(), nullptr, 10);
+    if (live.count(number) == 0) std::filesystem::remove(p, ec);
+  }
+
+  std::lock_guard lock(mu_);
+  current_ = std::move(v);
+  return true;
+}
+
+std::shared_ptr<const LsmTree::Version> LsmTree::current() const {
+  std::lock_guard lock(mu_);
+  return current_;
+}
+
+uint64_t LsmTree::flushed_seq() const {
+  std::lock_guard lock(mu_);
+  return flushed_seq_;
+}
+
+uint64_t LsmTree::new_file_number() {
+  std::lock_guard lock(mu_);
+  return next_file_++;
+}
+
+std::string LsmTree::table_path(uint64_t number) const {
+  return dir_ + "/" + std::to_string(number) + ".sst";
+}
+
+uint64_t LsmTree::level_target(int level) const {
+  uint64_t target = options_.l1_bytes;
+  for (int l = 1; l < level; ++l) target *= static_cast<uint64_t>(options_.level_multiplier);
+  return target;
+}
+
+std::vector<std::size_t> LsmTree::level_files() const {
+  const auto v = current();
+  std::vector<std::size_t> n;
+  for (const auto& level : v->levels) n.push_back(level.size());
+  return n;
+}
+
+// Caller holds mu_.
+bool LsmTree::write_manifest(const Version& v, uint64_t flushed_seq) {
+  std::ostringstream out;
+  out << "KVMANIFEST 1\n"
+      << "next_file " << next_file_ << "\n"
+      << "flushed_seq " << flushed_seq << "\n";
+  for (int level = 0; level < kNumLevels; ++level) {
+    for (const auto& t : v.levels[level]) out << "table " << level << ' ' << t->number() << "\n";
+  }
+  const std::string data = out.str();
+
+  const std::string path = dir_ + "/MANIFEST";
+  const std::string tmp = path + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) return false;
+  bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+  ok = ok && ::fsync(fd) == 0;
+  ::close(fd);
+  if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) return false;
+  return sync_dir(dir_);
+}
+
+bool LsmTree::install_flush(uint64_t number, uint64_t flushed_seq) {
+  auto t = SSTable::open(table_path(number), number);
+  if (t == nullptr) return false;
+
+  std::lock_guard lock(mu_);
+  auto v = std::make_shared<Version>(*current_);
+  v->levels[0].insert(v->levels[0].begin(), std::move(t));
+  if (!write_manifest(*v, flushed_seq)) return false;
+  flushed_seq_ = flushed_seq;
+  current_ = std::move(v);
+  return true;
+}
+
+SSTable::Lookup LsmTree::get(std::string_view key, uint64_t at, std::string* value,
+                             uint64_t* expires_at) const {
+  const auto v = current();
+  for (const auto& t : v->levels[0]) {
+    const auto r = t->get(key, at, value, expires_at);
+    if (r != SSTable::Lookup::kNotFound) return r;
+  }
+  for (int level = 1; level < kNumLevels; ++level) {
+    const auto& tables = v->levels[level];
+    // The only table whose range can hold `key`.
+    const auto it = std::lower_bound(
+        tables.begin(), tables.end(), key,
+        [](const std::shared_ptr<SSTable>& t, std::string_view k) { return t->largest() < k; });
+    if (it == tables.end() || (*it)->smallest() > key) continue;
+    const auto r = (*it)->get(key, at, value, expires_at);
+    if (r != SSTable::Lookup::kNotFound) return r;
+  }
+  return SSTable::Lookup::kNotFound;
+}
+
+void LsmTree::scan(
+    std::string_view begin, std::string_view end, uint64_t at, uint64_t now_ms,
+    const std::function<bool(std::string_view, std::string_view, EntryType)>& fn) const {
+  const auto v = current();
+  MergingIterator merged;
+  for (const auto& level : v->levels) {
+    for (const auto& t : level) {
+      if (!t->overlaps(begin, end)) continue;
+      auto it = std::make_unique<SSTable::Iterator>(t.get());
+      it->seek(begin);
+      merged.add(std::move(it));
+    }
+  }
+
+  // The first version at or below `at` decides each key.
+  std::string decided;
+  bool have_decided = false;
+  for (; merged.valid(); merged.next()) {
+    const auto& it = merged.top();
+    if (!end.empty() && it.key() >= end) break;
+    if (it.seq() > at) continue;
+    if (have_decided && it.key() == decided) continue;
+    decided.assign(it.key());
+    have_decided = true;
+    if (it.type() == EntryType::Del) continue;
+    if (it.expires_at() != 0 && it.expires_at() <= now_ms) continue;
+    if (!fn(it.key(), it.value(), it.type())) return;
+  }
+}
+
+bool LsmTree::compact_once(uint64_t oldest_snapshot, uint64_t now_ms) {
+  const auto v = current();
+
+  // Pick the inputs: all of level 0 once it has enough tables, otherwise the
+  // next table (round robin) of the first level over budget.
+  int level = -1;
+  std::vector<std::shared_ptr<SSTable>> inputs;
+  if (static_cast<int>(v->levels[0].size()) >= options_.l0_compaction_trigger) {
+    level = 0;
+    inputs = v->levels[0];
+  } else {
+    for (int l = 1; l + 1 < kNumLevels; ++l) {
+      if (total_bytes(v->levels[l]) <= level_target(l)) continue;
+      level = l;
+      const auto& tables = v->levels[l];
+      std::lock_guard lock(mu_);
+      auto it = std::find_if(tables.begin(), tables.end(), [&](const auto& t) {
+        return t->smallest() > compact_pointer_[l];
+      });
+      if (it == tables.end()) it = tables.begin();
+      inputs.push_back(*it);
+      compact_pointer_[l] = std::string((*it)->largest());
+      break;
+    }
+  }
+  if (level < 0) return false;
+  const int out_level = level + 1;
+
+  std::string smallest(inputs.front()->smallest());
+  std::string largest(inputs.front()->largest());
+  for (const auto& t : inputs) {
+    smallest = std::min(smallest, std::string(t->smallest()));
+    largest = std::max(largest, std::string(t->largest()));
+  }
+  const std::size_t upper_inputs = inputs.size();
+  for (const auto& t : v->levels[out_level]) {
+    if (t->overlaps(smallest, largest)) inputs.push_back(t);
+  }
+
+  // Nothing older lives below the output level, so deletes can be dropped.
+  bool bottom = true;
+  for (int l = out_level + 1; l < kNumLevels; ++l) bottom = bottom && v->levels[l].empty();
+
+  MergingIterator merged;
+  for (const auto& t : inputs) {
+    auto it = std::make_unique<SSTable::Iterator>(t.get());
+    it->seek_to_first();
+    merged.add(std::move(it));
+  }
+
+  std::vector<std::shared_ptr<SSTable>> outputs;
+  std::unique_ptr<SSTableWriter> writer;
+  uint64_t writer_number = 0;
+  auto finish_output = [&]() {
+    if (writer == nullptr) return true;
+    const bool ok = writer->finish();
+    writer.reset();
+    if (!ok) return false;
+    auto t = SSTable::open(table_path(writer_number), writer_number);
+    if (t == nullptr) return false;
+    outputs.push_back(std::move(t));
+    return true;
+  };
+  auto fail = [&]() {
+    if (writer != nullptr) writer->abandon();
+    for (const auto& t : outputs) std::remove(table_path(t->number()).c_str());
+    return false;
+  };
+
+  std::string key;
+  bool have_key = false;
+  bool key_done = false;  // remaining versions of `key` are unreachable
+  for (; merged.valid(); merged.next()) {
+    const auto& it = merged.top();
+    const bool new_key = !have_key || it.key() != key;
+    if (new_key) {
+      key.assign(it.key());
+      have_key = true;
+      key_done = false;
+    } else if (key_done) {
+      continue;
+    }
+
+    bool keep = true;
+    if (it.seq() <= oldest_snapshot) {
+      // The version the oldest snapshot (or a latest read) sees; anything
+      // older is unreachable.
+      key_done = true;
+      // An expired version reads as absent to every snapshot, like a delete.
+      const bool expired = it.expires_at() != 0 && it.expires_at() <= now_ms;
+      if ((it.type() == EntryType::Del || expired) && bottom) keep = false;
+    }
+    if (!keep) continue;
+
+    // Cut outputs only between keys so a key never spans two tables.
+    if (writer != nullptr && new_key && writer->file_size() >= options_.sstable_bytes) {
+      if (!finish_output()) return fail();
+    }
+    if (writer == nullptr) {
+      writer_number = new_file_number();
+      writer = std::make_unique<SSTableWriter>(options_);
+      if (!writer->open(table_path(writer_number))) return fail();
+    }
+    if (!writer->add(it.key(), it.seq(), it.type(), it.value(), it.expires_at())) return fail();
+  }
+  if (!merged.ok()) return fail();
+  if (writer != nullptr && writer->entries() == 0) {
+    writer->abandon();
+    writer.reset();
+  }
+  if (!finish_output()) return fail();
+
+  {
+    std::lock_guard lock(mu_);
+    auto next = std::make_shared<Version>(*current_);
+    auto is_input = [&](const std::shared_ptr<SSTable>& t) {
+      return std::find(inputs.begin(), inputs.end(), t) != inputs.end();
+    };
+    for (int l : {level, out_level}) {
+      auto& tables = next->levels[l];
+      tables.erase(std::remove_if(tables.begin(), tables.end(), is_input), tables.end());
+    }
+    auto& dst = next->levels[out_level];
+    dst.insert(dst.end(), outputs.begin(), outputs.end());
+    std::sort(dst.begin(), dst.end(), [](const auto& a, const auto& b) {
+      return a->smallest() < b->smallest();
+    });
+    if (!write_manifest(*next, flushed_seq_)) return fail();
+    current_ = std::move(next);
+  }
+
+  // Readers still holding the old Version keep the files open.
+  for (const auto& t : inputs) std::remove(table_path(t->number()).c_str());
+  std::cerr << "[lsm] compacted " << upper_inputs << "+" << inputs.size() - upper_inputs
+            << " tables L" << level << "->L" << out_level << " into " << outputs.size()
+            << "\n";
+  return true;
+}
+
+}  // namespace kv
@@ -3,6 +3,25 @@
 #include <sstream>
 #include <string>
 #include <chrono>
+#include <cstdlib>
+#include <utility>
+
+namespace {
+
+// `arg` is the record count for kCount, the interval in ms for kTimed and
+// 1 for sync_file_range in kAsync.
+kv::Options with_mode(kv::Options options, kv::Durability mode, int arg) {
+  options.durability = mode;
+  if (mode == kv::Durability::kCount) options.wal_sync_every = static_cast<unsigned>(arg);
+  if (mode == kv::Durability::kTimed) options.wal_sync_interval_ms = static_cast<unsigned>(arg);
+  if (mode == kv::Durability::kAsync) {
+    options.async_flush = arg == 1 ? kv::Options::AsyncFlush::kSyncFileRange
+                                   : kv::Options::AsyncFlush::kFdatasync;
+  }
+  return options;
+}
+
+}  // namespace
 
 int main() {
   std::cerr << "CLI started\n" << std::flush;
@@ -12,6 +31,36 @@ int main() {
   //std::cerr << "open(/tmp/kv.wal) -> " << (ok ? "true" : "false") << "\n" << std::flush;
   if (!ok) return 1;
 
+  kv::Options durability;  // the store's current durability mode
+
+  // Timed puts of N keys: ms until the last one is acknowledged, and until
+  // all of them are durable.
+  auto bench = [&](int N) {
+    // optional: keep values fixed to avoid extra allocations
+    std::string value = "v";
+
+    // Warmup (optional)
+    for (int i = 0; i < 1000; i++) {
+      store.put("warm" + std::to_string(i), value);
+    }
+    store.flush_wal(); // ensure warmup is durable so it doesn't pollute measurement
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < N; i++) {
+      store.put("k" + std::to_string(i), value);
+    }
+    auto acked = std::chrono::high_resolution_clock::now();
+
+    // IMPORTANT: include durability boundary in timing
+    store.flush_wal();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::pair<long long, long long>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(acked - start).count(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+  };
+
   std::string line;
   while (true) {
     std::cerr << "kv> " << std::flush;
@@ -30,42 +79,75 @@ int main() {
       iss >> k >> v;
       store.put(k, v);
       std::cerr << "OK\n" << std::flush;
+    } else if (cmd == "PUTEX") {
+      // PUTEX key ttl_ms value
+      std::string k, v;
+      long long ttl_ms = 0;
+      iss >> k >> ttl_ms >> v;
+      store.put(k, v, std::chrono::milliseconds(ttl_ms));
+      std::cerr << "OK\n" << std::flush;
     } else if (cmd == "BENCH") {
+      // BENCH [N]          one run in the current durability mode
+      // BENCH [N] MODES    one run per durability mode, then restore it
       int N = 100000;            // start with 100k; drop to 10k if too slow
-      iss >> N;                  // allow: BENCH 10000
-
-      // optional: keep values fixed to avoid extra allocations
-      std::string value = "v";
-
-     // Warmup (optional)
-     for (int i = 0; i < 1000; i++) {
-        store.put("warm" + std::to_string(i), value);
-     }
-     store.flush_wal(); // ensure warmup is durable so it doesn't pollute measurement
+      std::string which;
+      if (!(iss >> N) || N <= 0) N = 100000;
+      iss >> which;
 
-     auto start = std::chrono::high_resolution_clock::now();
-
-     for (int i = 0; i < N; i++) {
-        store.put("k" + std::to_string(i), value);
+      if (which != "MODES") {
+        const auto [ack_ms, ms] = bench(N);
+        (void)ack_ms;
+        double ops_per_sec = (ms > 0) ? (1000.0 * N / (double)ms) : 0.0;
+        std::cerr << "BENCH N=" << N
+                  << " total_ms=" << ms
+                  << " ops_per_sec=" << ops_per_sec
+                  << "\n" << std::flush;
+        continue;
       }
 
-     // IMPORTANT: include durability boundary in timing
-     store.flush_wal();
-
-     auto end = std::chrono::high_resolution_clock::now();
-     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-     double ops_per_sec = (ms > 0) ? (1000.0 * N / (double)ms) : 0.0;
-
-     std::cerr << "BENCH N=" << N
-            << " total_ms=" << ms
-            << " ops_per_sec=" << ops_per_sec
-            << "\n" << std::flush;
+      const std::pair<const char*, kv::Options> modes[] = {
+          {"sync", with_mode(durability, kv::Durability::kSync, 1)},
+          {"count/64", with_mode(durability, kv::Durability::kCount, 64)},
+          {"timed/10ms", with_mode(durability, kv::Durability::kTimed, 10)},
+          {"async/fdatasync", with_mode(durability, kv::Durability::kAsync, 0)},
+          {"async/sync_file_range", with_mode(durability, kv::Durability::kAsync, 1)},
+      };
+      for (const auto& [name, options] : modes) {
+        store.set_durability(options);
+        const auto [ack_ms, ms] = bench(N);
+        std::cerr << "BENCH mode=" << name << " N=" << N
+                  << " ack_ms=" << ack_ms
+                  << " total_ms=" << ms
+                  << " ack_ops_per_sec=" << (ack_ms > 0 ? 1000.0 * N / ack_ms : 0.0)
+                  << " durable_ops_per_sec=" << (ms > 0 ? 1000.0 * N / ms : 0.0)
+                  << "\n" << std::flush;
+      }
+      store.set_durability(durability);
 }else if (cmd == "SETBATCH") {
   int n;
   iss >> n;
-  store.set_group_commit_every(n);
+  durability = with_mode(durability, n <= 1 ? kv::Durability::kSync : kv::Durability::kCount, n);
+  store.set_durability(durability);
   std::cerr << "OK batch=" << n << "\n" << std::flush;
+}else if (cmd == "DURABILITY") {
+  // DURABILITY sync | count N | timed MS | async [fdatasync|sync_file_range]
+  std::string mode, arg;
+  iss >> mode >> arg;
+  const int n = std::atoi(arg.c_str());
+  if (mode == "sync") {
+    durability = with_mode(durability, kv::Durability::kSync, 1);
+  } else if (mode == "count" && n > 0) {
+    durability = with_mode(durability, kv::Durability::kCount, n);
+  } else if (mode == "timed" && n > 0) {
+    durability = with_mode(durability, kv::Durability::kTimed, n);
+  } else if (mode == "async") {
+    durability = with_mode(durability, kv::Durability::kAsync, arg == "sync_file_range" ? 1 : 0);
+  } else {
+    std::cerr << "usage: DURABILITY sync | count N | timed MS | async [fdatasync|sync_file_range]\n";
+    continue;
+  }
+  store.set_durability(durability);
+  std::cerr << "OK durability=" << mode << (arg.empty() ? "" : " ") << arg << "\n" << std::flush;
 }else if (cmd == "GET") {
       std::string k;
       iss >> k;
@@ -77,6 +159,12 @@ int main() {
 } else if (cmd == "SNAP") {
        bool ok = store.checkpoint("/tmp/kv.snapshot", "/tmp/kv.wal");
        std::cerr << (ok ? "SNAP OK\n" : "SNAP FAIL\n");
+} else if (cmd == "BGSNAP") {
+       bool ok = store.checkpoint_async("/tmp/kv.snapshot");
+       std::cerr << (ok ? "BGSNAP queued\n" : "BGSNAP FAIL\n") << std::flush;
+} else if (cmd == "COMPACT") {
+       bool ok = store.compact_wal();
+       std::cerr << (ok ? "COMPACT OK\n" : "COMPACT FAIL\n") << std::flush;
 }else if (cmd == "FLUSH") {
        bool ok = store.flush_wal();
        std::cerr << (ok ? "FLUSH OK\n" : "FLUSH FAIL\n") << std::flush;
@@ -0,0 +1,90 @@
+#include "kv/memtable.h"
+
+namespace kv {
+namespace {
+
+// The current head must survive if a snapshot taken after it was written is
+// still live.
+bool keeps_head(const KeyRec* k, const SnapshotBounds& snaps) {
+  return snaps.any && k->head != nullptr && k->head->seq <= snaps.newest;
+}
+
+}  // namespace
+
+void Memtable::put(std::string_view key, uint64_t hash, std::string_view value,
+                   uint64_t seq, const SnapshotBounds& snaps, uint32_t value_flags,
+                   uint64_t expires_at) {
+  auto [k, inserted] = map_.find_or_insert(key, hash);
+  if (inserted) index_.insert(k);
+  const bool was_live = k->head != nullptr && !k->head->tombstone();
+  map_.push_version(k, value, seq, value_flags, keeps_head(k, snaps), expires_at);
+  if (!was_live) ++live_;
+  retire_versions(k, hash, snaps);
+}
+
+bool Memtable::erase(std::string_view key, uint64_t hash, uint64_t seq,
+                     const SnapshotBounds& snaps) {
+  KeyRec* k = nullptr;
+  if (keep_tombstones_) {
+    auto [rec, inserted] = map_.find_or_insert(key, hash);
+    if (inserted) index_.insert(rec);
+    k = rec;
+  } else {
+    k = map_.find(key, hash);
+    if (k == nullptr) return false;
+  }
+
+  const bool was_live = k->head != nullptr && !k->head->tombstone();
+  if (!was_live && !keep_tombstones_) return false;
+  map_.push_version(k, {}, seq, ValueRec::kTombstone, keeps_head(k, snaps));
+  if (was_live) --live_;
+  retire_versions(k, hash, snaps);
+  return was_live;
+}
+
+void Memtable::retire_versions(KeyRec* k, uint64_t hash, const SnapshotBounds& snaps) {
+  map_.prune(k, snaps.oldest);
+  if (k->head->prev != nullptr) {
+    if ((k->flags & KeyRec::kVersioned) == 0) {
+      k->flags |= KeyRec::kVersioned;
+      versioned_.emplace_back(k->view());
+    }
+    return;
+  }
+  // Deleted and no snapshot can see an older version: drop the entry.
+  if (k->head->tombstone() && !keep_tombstones_) drop(k->view(), hash);
+}
+
+void Memtable::drop(std::string_view key, uint64_t hash) {
+  index_.erase(key);  // before the table frees the key bytes it views
+  map_.erase(key, hash);
+}
+
+void Memtable::reclaim(uint64_t oldest) {
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < versioned_.size(); ++i) {
+    const std::string_view key = versioned_[i];
+    const uint64_t h = FlatTable::hash(key);
+    KeyRec* k = map_.find(key, h);
+    if (k == nullptr || (k->flags & KeyRec::kVersioned) == 0) continue;
+
+    map_.prune(k, oldest);
+    if (k->head->prev != nullptr) {
+      if (kept != i) versioned_[kept] = std::move(versioned_[i]);
+      ++kept;
+      continue;
+    }
+    k->flags &= ~KeyRec::kVersioned;
+    if (k->head->tombstone() && !keep_tombstones_) drop(key, h);
+  }
+  versioned_.resize(kept);
+}
+
+void Memtable::clear() {
+  index_.clear();
+  map_.clear();
+  live_ = 0;
+  versioned_.clear();
+}
+
+}  // namespace kv
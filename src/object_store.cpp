@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <optional>
 #include <sstream>
@@ -137,7 +138,7 @@ bool ObjectStore::CreateBucket(const BucketName& bucket) {
   if (bucket.empty()) return false;
 
   const std::string bucket_key = ObjectStoreKeyCodec::BucketMetaKey(bucket);
-  if (kv_.get(bucket_key).has_value()) return true;
+  if (kv_.contains(bucket_key)) return true;
 
   BucketMetadata meta;
   meta.name = bucket;
@@ -149,7 +150,7 @@ bool ObjectStore::CreateBucket(const BucketName& bucket) {
 
 bool ObjectStore::BucketExists(const BucketName& bucket) const {
   if (bucket.empty()) return false;
-  return kv_.get(ObjectStoreKeyCodec::BucketMetaKey(bucket)).has_value();
+  return kv_.contains(ObjectStoreKeyCodec::BucketMetaKey(bucket));
 }
 
 PutObjectResult ObjectStore::PutObject(const PutObjectRequest& req) {
@@ -197,16 +198,20 @@ PutObjectResult ObjectStore::PutObject(const PutObjectRequest& req) {
   const std::uint32_t chunk_count =
       static_cast<std::uint32_t>((total_size + chunk_size_bytes_ - 1) / chunk_size_bytes_);
 
+  // All writes for the object go out as one atomic batch: one WAL record
+  // and one lock acquisition per touched shard instead of one per key.
+  WriteBatch batch;
+
   // 1) Write chunks first
   for (std::uint32_t i = 0; i < chunk_count; ++i) {
     const std::size_t start = static_cast<std::size_t>(i) * chunk_size_bytes_;
     const std::size_t end = std::min(start + static_cast<std::size_t>(chunk_size_bytes_), total_size);
     const std::size_t len = end - start;
 
-    std::string chunk_value;
-    chunk_value.assign(reinterpret_cast<const char*>(req.data.data() + start), len);
+    const std::string_view chunk_value(
+        reinterpret_cast<const char*>(req.data.data() + start), len);
 
-    kv_.put(ObjectStoreKeyCodec::ChunkKey(object_id, i), std::move(chunk_value));
+    batch.put(ObjectStoreKeyCodec::ChunkKey(object_id, i), chunk_value);
   }
 
   // 2) Metadata commit point
@@ -223,11 +228,16 @@ PutObjectResult ObjectStore::PutObject(const PutObjectRequest& req) {
   meta.updated_at_epoch_ms = now_ms;
   meta.state = ObjectState::Committed;
 
-  kv_.put(ObjectStoreKeyCodec::ObjectMetaKey(req.bucket, req.key),
-          serialize_metadata(meta));
+  batch.put(ObjectStoreKeyCodec::ObjectMetaKey(req.bucket, req.key),
+            serialize_metadata(meta));
 
   // 3) Optional index entry (useful for future list/prefix scan)
-  kv_.put(ObjectStoreKeyCodec::BucketIndexKey(req.bucket, req.key), object_id);
+  batch.put(ObjectStoreKeyCodec::BucketIndexKey(req.bucket, req.key), object_id);
+
+  if (!kv_.write(batch)) {
+    result.error = "failed to write object batch";
+    return result;
+  }
 
   // 4) Durability boundary
   if (!kv_.flush_wal()) {
@@ -264,20 +274,41 @@ GetObjectResult ObjectStore::GetObject(const BucketName& bucket, const ObjectKey
   }
 
   result.metadata = *meta;
-  result.data.reserve(static_cast<std::size_t>(meta->size_bytes));
+
+  // Fetch all chunks with one batched lookup; each chunk is copied straight
+  // from the store's buffer into its offset in the output.
+  std::vector<std::string> chunk_keys;
+  chunk_keys.reserve(meta->chunk_count);
+  for (std::uint32_t i = 0; i < meta->chunk_count; ++i) {
+    chunk_keys.push_back(ObjectStoreKeyCodec::ChunkKey(meta->object_id, i));
+  }
+  const std::vector<std::string_view> key_views(chunk_keys.begin(), chunk_keys.end());
+
+  enum : std::uint8_t { kMissing = 0, kOk = 1, kBadSize = 2 };
+  std::vector<std::uint8_t> status(meta->chunk_count, kMissing);
+  const std::uint64_t chunk_size = meta->chunk_size_bytes;
+  result.data.resize(static_cast<std::size_t>(meta->size_bytes));
+
+  kv_.multi_read(key_views, [&](std::size_t i, std::string_view chunk) {
+    const std::uint64_t offset = i * chunk_size;
+    const std::uint64_t expected =
+        offset < meta->size_bytes ? std::min(chunk_size, meta->size_bytes - offset) : 0;
+    if (chunk.size() != expected) {
+      status[i] = kBadSize;
+      return;
+    }
+    std::memcpy(result.data.data() + offset, chunk.data(), chunk.size());
+    status[i] = kOk;
+  });
 
   for (std::uint32_t i = 0; i < meta->chunk_count; ++i) {
-    const auto chunk =
-        kv_.get(ObjectStoreKeyCodec::ChunkKey(meta->object_id, i));
-    if (!chunk.has_value()) {
-      result.error = "missing object chunk at index " + std::to_string(i);
+    if (status[i] != kOk) {
+      result.error = (status[i] == kMissing ? "missing object chunk at index "
+                                            : "object chunk size mismatch at index ") +
+                     std::to_string(i);
       result.data.clear();
       return result;
     }
-
-    result.data.insert(result.data.end(),
-                       chunk->begin(),
-                       chunk->end());
   }
 
   result.found = true;
@@ -302,12 +333,18 @@ DeleteObjectResult ObjectStore::DeleteObject(const BucketName& bucket, const Obj
   meta->state = ObjectState::Deleted;
   meta->updated_at_epoch_ms = now_epoch_ms();
 
-  kv_.put(ObjectStoreKeyCodec::ObjectMetaKey(bucket, key),
-          serialize_metadata(*meta));
+  WriteBatch batch;
+  batch.put(ObjectStoreKeyCodec::ObjectMetaKey(bucket, key),
+            serialize_metadata(*meta));
 
   // Logical delete for v0.1.
   // Keep chunks for now; later you can add background GC.
-  kv_.del(ObjectStoreKeyCodec::BucketIndexKey(bucket, key));
+  batch.del(ObjectStoreKeyCodec::BucketIndexKey(bucket, key));
+
+  if (!kv_.write(batch)) {
+    result.error = "failed to write delete batch";
+    return result;
+  }
 
   if (!kv_.flush_wal()) {
     result.error = "failed to flush WAL";
@@ -343,6 +380,8 @@ ObjectStore::ListObjects(const BucketName& bucket,
 
   const std::string base_prefix = "bucketidx:" + bucket + ":";
 
+  std::vector<std::string> meta_keys;
+  meta_keys.reserve(index_keys.size());
   for (const auto& index_key : index_keys) {
     if (index_key.size() < base_prefix.size()) {
       continue;
@@ -351,9 +390,14 @@ ObjectStore::ListObjects(const BucketName& bucket,
     const std::string object_key =
         index_key.substr(base_prefix.size());
 
-    const auto raw_meta =
-        kv_.get(ObjectStoreKeyCodec::ObjectMetaKey(bucket, object_key));
+    meta_keys.push_back(ObjectStoreKeyCodec::ObjectMetaKey(bucket, object_key));
+  }
 
+  // One batched lookup for all metadata; results stay in listing order.
+  const std::vector<std::string_view> meta_views(meta_keys.begin(), meta_keys.end());
+  const auto raw_metas = kv_.multi_get(meta_views);
+
+  for (const auto& raw_meta : raw_metas) {
     if (!raw_meta.has_value()) {
       continue;
     }
@@ -384,14 +428,19 @@ ObjectStore::ListObjects(const BucketName& bucket,
 std::size_t ObjectStore::GarbageCollectChunks() {
   std::size_t deleted_chunks = 0;
 
+  // v0.9: both passes read one MVCC snapshot. Chunks written by a PutObject
+  // that commits after it are invisible there, so they are never mistaken
+  // for garbage, and concurrent writers are not blocked by the scan.
+  SnapshotPtr snap = kv_.snapshot();
+
   // Step 1: collect reachable object_ids from committed metadata
   std::unordered_set<std::string> reachable_object_ids;
 
-  const auto meta_keys = kv_.list_keys_with_prefix("objmeta:");
-
-  for (const auto& meta_key : meta_keys) {
-    const auto raw_meta = kv_.get(meta_key);
+  const auto meta_keys = kv_.list_keys_with_prefix("objmeta:", *snap);
+  const std::vector<std::string_view> meta_views(meta_keys.begin(), meta_keys.end());
+  const auto raw_metas = kv_.multi_get(meta_views, *snap);
 
+  for (const auto& raw_meta : raw_metas) {
     if (!raw_meta.has_value()) {
       continue;
     }
@@ -407,9 +456,10 @@ std::size_t ObjectStore::GarbageCollectChunks() {
     }
   }
 
-  // Step 2: scan all chunk keys
+  // Step 2: scan all chunk keys; unreachable ones are deleted in one batch
   const std::string prefix = "objchunk:";
-  const auto chunk_keys = kv_.list_keys_with_prefix(prefix);
+  const auto chunk_keys = kv_.list_keys_with_prefix(prefix, *snap);
+  WriteBatch batch;
 
   for (const auto& chunk_key : chunk_keys) {
     const std::size_t last_colon = chunk_key.rfind(':');
@@ -426,14 +476,22 @@ std::size_t ObjectStore::GarbageCollectChunks() {
     if (reachable_object_ids.find(std::string(object_id_view)) ==
       reachable_object_ids.end()) {
 
-        if (kv_.del(chunk_key)) {
-          ++deleted_chunks;
-       }
+        batch.del(chunk_key);
+        ++deleted_chunks;
     }
   }
 
+  if (!batch.empty() && !kv_.write(batch)) {
+    return 0;
+  }
+
   kv_.flush_wal();
 
+  // Step 3 (v0.9): large chunks live in the value log; reclaim the space the
+  // deleted ones held. The snapshot goes first so it does not pin the files.
+  snap.reset();
+  kv_.gc_value_log();
+
   return deleted_chunks;
 }
 
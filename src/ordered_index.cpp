@@ -0,0 +1,91 @@
+#include "kv/ordered_index.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace kv {
+namespace {
+
+bool key_less(const KeyRec* a, std::string_view b) { return a->view() < b; }
+
+}  // namespace
+
+std::size_t OrderedIndex::find_leaf(std::string_view key) const {
+  // Last leaf whose first key is <= key (or the first leaf).
+  auto it = std::upper_bound(fence_.begin(), fence_.end(), key);
+  if (it == fence_.begin()) return 0;
+  return static_cast<std::size_t>(std::distance(fence_.begin(), it)) - 1;
+}
+
+std::size_t OrderedIndex::lower_bound_in(const Leaf& leaf, std::string_view key) {
+  return static_cast<std::size_t>(
+      std::lower_bound(leaf.begin(), leaf.end(), key, key_less) - leaf.begin());
+}
+
+void OrderedIndex::insert(const KeyRec* rec) {
+  const std::string_view key = rec->view();
+  if (leaves_.empty()) {
+    leaves_.push_back(Leaf{rec});
+    fence_.push_back(key);
+    size_ = 1;
+    return;
+  }
+
+  const std::size_t li = find_leaf(key);
+  Leaf& leaf = leaves_[li];
+  const std::size_t pos = lower_bound_in(leaf, key);
+  if (pos < leaf.size() && leaf[pos]->view() == key) {
+    leaf[pos] = rec;  // re-point at the current owner of the bytes
+    if (pos == 0) fence_[li] = key;
+    return;
+  }
+
+  leaf.insert(leaf.begin() + static_cast<std::ptrdiff_t>(pos), rec);
+  if (pos == 0) fence_[li] = key;
+  ++size_;
+
+  if (leaf.size() > kLeafMax) {
+    const std::size_t half = leaf.size() / 2;
+    Leaf right(leaf.begin() + static_cast<std::ptrdiff_t>(half), leaf.end());
+    leaf.resize(half);
+    fence_.insert(fence_.begin() + static_cast<std::ptrdiff_t>(li + 1),
+                  right.front()->view());
+    leaves_.insert(leaves_.begin() + static_cast<std::ptrdiff_t>(li + 1), std::move(right));
+  }
+}
+
+void OrderedIndex::erase(std::string_view key) {
+  if (leaves_.empty()) return;
+
+  const std::size_t li = find_leaf(key);
+  Leaf& leaf = leaves_[li];
+  const std::size_t pos = lower_bound_in(leaf, key);
+  if (pos == leaf.size() || leaf[pos]->view() != key) return;
+
+  leaf.erase(leaf.begin() + static_cast<std::ptrdiff_t>(pos));
+  --size_;
+
+  if (leaf.empty()) {
+    leaves_.erase(leaves_.begin() + static_cast<std::ptrdiff_t>(li));
+    fence_.erase(fence_.begin() + static_cast<std::ptrdiff_t>(li));
+    return;
+  }
+  if (pos == 0) fence_[li] = leaf.front()->view();
+
+  // Merge underfull neighbours so the fence array stays short.
+  if (li + 1 < leaves_.size() &&
+      leaf.size() + leaves_[li + 1].size() <= kLeafMax / 2) {
+    Leaf& next = leaves_[li + 1];
+    leaf.insert(leaf.end(), next.begin(), next.end());
+    leaves_.erase(leaves_.begin() + static_cast<std::ptrdiff_t>(li + 1));
+    fence_.erase(fence_.begin() + static_cast<std::ptrdiff_t>(li + 1));
+  }
+}
+
+void OrderedIndex::clear() {
+  leaves_.clear();
+  fence_.clear();
+  size_ = 0;
+}
+
+}  // namespace kv
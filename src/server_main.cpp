@@ -82,8 +82,16 @@ int main(int argc, char* argv[]) {
     port = std::atoi(argv[1]);
   }
 
+  // v0.9: checkpoint in the background so the WAL, and restart time, stay
+  // bounded (snapshot: /tmp/kv_server.wal.snapshot). Object chunks go to the
+  // value log.
+  kv::Options options;
+  options.value_log_threshold = 1024;
+  options.checkpoint_wal_bytes = uint64_t{256} << 20;
+  options.checkpoint_replay_ms = 2000;
+
   kv::KVStore store;
-  if (!store.open("/tmp/kv_server.wal")) {
+  if (!store.open("/tmp/kv_server.wal", options)) {
     std::cerr << "failed to open WAL\n";
     return 1;
   }
@@ -0,0 +1,236 @@
+#include "kv/snapshot_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "kv/compression.h"
+#include "kv/crc32.h"
+#include "io_util.h"
+
+namespace kv {
+namespace {
+
+constexpr uint32_t kSnapshotMagic = 0x5053564Bu;  // 'K''V''S''P'
+// Version 1 files (no partition index) still load.
+constexpr uint32_t kSnapshotVersion = 2;
+constexpr std::size_t kBlockHeader = 4 + 4 + 4;
+constexpr std::size_t kFooterBytes = 4 * 8 + 4 + 4;
+
+uint32_t crc_of(const char* p, std::size_t n) {
+  return crc32c_update(0, reinterpret_cast<const uint8_t*>(p), n);
+}
+
+}  // namespace
+
+// ---------------- writer ----------------
+
+SnapshotFileWriter::SnapshotFileWriter(IoBackend::Kind io, Options::Compression compression,
+                                       std::size_t partitions)
+    : file_(io), compress_(compression == Options::Compression::kLz4),
+      parts_(std::max<std::size_t>(partitions, 1)) {}
+
+bool SnapshotFileWriter::open(const std::string& path) {
+  if (!file_.open(path)) return false;
+  std::string header;
+  put_fixed(header, kSnapshotMagic);
+  put_fixed(header, kSnapshotVersion);
+  return append(header);
+}
+
+bool SnapshotFileWriter::append(std::string_view bytes, uint64_t* offset) {
+  std::lock_guard lock(mu_);
+  if (offset != nullptr) *offset = offset_;
+  const auto n = static_cast<std::streamsize>(bytes.size());
+  ok_ = ok_ && file_.sputn(bytes.data(), n) == n;
+  offset_ += bytes.size();
+  return ok_;
+}
+
+void SnapshotFileWriter::add(std::size_t partition, std::string_view key, std::string_view value,
+                             bool value_ref, uint64_t expires_at) {
+  Partition& part = parts_[partition];
+  std::string& block = part.block;
+  if (block.capacity() == 0) block.reserve(kBlockBytes + 4096);
+  put_fixed(block, static_cast<uint32_t>(key.size()));
+  put_fixed(block, static_cast<uint32_t>(value.size()));
+  block.push_back(static_cast<char>((value_ref ? kSnapshotRef : 0) |
+                                    (expires_at != 0 ? kSnapshotExpires : 0)));
+  block.append(key);
+  block.append(value);
+  if (expires_at != 0) put_fixed(block, expires_at);
+  ++part.entries;
+  if (block.size() >= kBlockBytes) (void)flush_block(part);
+}
+
+bool SnapshotFileWriter::flush_block(Partition& part) {
+  if (part.block.empty()) return true;
+  std::string& packed = part.packed;
+  packed.assign(kBlockHeader, '\0');
+  if (!compress_ || !lz4_compress(part.block, packed)) packed.append(part.block);
+  const std::size_t stored = packed.size() - kBlockHeader;
+  const uint32_t header[3] = {static_cast<uint32_t>(part.block.size()),
+                              static_cast<uint32_t>(stored),
+                              crc_of(packed.data() + kBlockHeader, stored)};
+  std::memcpy(packed.data(), header, sizeof(header));
+  part.block.clear();
+  uint64_t offset = 0;
+  const bool ok = append(packed, &offset);
+  part.offsets.push_back(offset);
+  return ok;
+}
+
+bool SnapshotFileWriter::finish(uint64_t seq) {
+  bool ok = true;
+  for (Partition& part : parts_) ok = flush_block(part) && ok;
+  const uint64_t data_end = offset_;
+
+  std::string index;
+  uint64_t entries = 0;
+  put_fixed(index, static_cast<uint32_t>(parts_.size()));
+  for (const Partition& part : parts_) {
+    put_fixed(index, part.entries);
+    put_fixed(index, static_cast<uint64_t>(part.offsets.size()));
+    entries += part.entries;
+    blocks_ += part.offsets.size();
+  }
+  for (const Partition& part : parts_) {
+    index.append(reinterpret_cast<const char*>(part.offsets.data()),
+                 part.offsets.size() * sizeof(uint64_t));
+  }
+  put_fixed(index, crc_of(index.data(), index.size()));
+
+  std::string footer;
+  put_fixed(footer, entries);
+  put_fixed(footer, seq);
+  put_fixed(footer, blocks_);
+  put_fixed(footer, data_end);
+  put_fixed(footer, crc_of(footer.data(), footer.size()));
+  put_fixed(footer, kSnapshotMagic);
+  ok = append(index) && append(footer) && ok;
+  return file_.finish() && ok;
+}
+
+// ---------------- reader ----------------
+
+SnapshotFileReader::~SnapshotFileReader() {
+  if (base_ != nullptr) ::munmap(const_cast<char*>(base_), size_);
+}
+
+SnapshotFileReader::Status SnapshotFileReader::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return Status::kMissing;
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return Status::kCorrupt;
+  }
+  size_ = static_cast<std::size_t>(st.st_size);
+  if (size_ < kHeaderBytes) {
+    ::close(fd);
+    return Status::kText;
+  }
+  void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return Status::kCorrupt;
+  base_ = static_cast<const char*>(p);
+  (void)::madvise(p, size_, MADV_SEQUENTIAL);
+
+  if (get_fixed<uint32_t>(base_) != kSnapshotMagic) return Status::kText;
+  const auto version = get_fixed<uint32_t>(base_ + 4);
+  if ((version != 1 && version != kSnapshotVersion) || size_ < kHeaderBytes + kFooterBytes) {
+    return Status::kCorrupt;
+  }
+  const char* footer = base_ + size_ - kFooterBytes;
+  if (get_fixed<uint32_t>(footer + 36) != kSnapshotMagic ||
+      get_fixed<uint32_t>(footer + 32) != crc_of(footer, 32)) {
+    return Status::kCorrupt;
+  }
+  entries_ = get_fixed<uint64_t>(footer);
+  seq_ = get_fixed<uint64_t>(footer + 8);
+  blocks_ = get_fixed<uint64_t>(footer + 16);
+  data_end_ = get_fixed<uint64_t>(footer + 24);
+  if (data_end_ < kHeaderBytes || data_end_ > size_ - kFooterBytes) return Status::kCorrupt;
+  if (version == 1) {
+    // No index: one partition, its blocks found by walking their headers.
+    if (data_end_ != size_ - kFooterBytes) return Status::kCorrupt;
+    for (uint64_t off = kHeaderBytes; off < data_end_;) {
+      if (data_end_ - off < kBlockHeader) return Status::kCorrupt;
+      offsets_.push_back(off);
+      off += kBlockHeader + get_fixed<uint32_t>(base_ + off + 4);
+    }
+    parts_.push_back(Partition{entries_, offsets_.size(), 0});
+    return offsets_.size() == blocks_ ? Status::kOk : Status::kCorrupt;
+  }
+  return open_index();
+}
+
+SnapshotFileReader::Status SnapshotFileReader::open_index() {
+  const char* index = base_ + data_end_;
+  const std::size_t n = size_ - kFooterBytes - data_end_;
+  if (n < 4 + 4 || get_fixed<uint32_t>(index + n - 4) != crc_of(index, n - 4)) {
+    return Status::kCorrupt;
+  }
+  const auto partitions = get_fixed<uint32_t>(index);
+  if (partitions == 0 || (n - 8) / 16 < partitions) return Status::kCorrupt;
+  uint64_t entries = 0;
+  uint64_t blocks = 0;
+  for (uint32_t p = 0; p < partitions; ++p) {
+    const char* e = index + 4 + std::size_t{p} * 16;
+    Partition part{get_fixed<uint64_t>(e), get_fixed<uint64_t>(e + 8), blocks};
+    if (part.blocks > blocks_ - std::min(blocks, blocks_)) return Status::kCorrupt;
+    entries += part.entries;
+    blocks += part.blocks;
+    parts_.push_back(part);
+  }
+  if (entries != entries_ || blocks != blocks_ || blocks > n / sizeof(uint64_t) ||
+      n != 4 + std::size_t{partitions} * 16 + blocks * sizeof(uint64_t) + 4) {
+    return Status::kCorrupt;
+  }
+  offsets_.resize(blocks);
+  std::memcpy(offsets_.data(), index + 4 + std::size_t{partitions} * 16,
+              blocks * sizeof(uint64_t));
+  return Status::kOk;
+}
+
+bool SnapshotFileReader::verify() const {
+  for (std::size_t p = 0; p < parts_.size(); ++p) {
+    if (!verify_partition(p)) return false;
+  }
+  return true;
+}
+
+bool SnapshotFileReader::verify_partition(std::size_t p) const {
+  for (uint64_t b = 0; b < parts_[p].blocks; ++b) {
+    uint64_t off = block_offset(p, b);
+    if (off < kHeaderBytes || off > data_end_ || data_end_ - off < kBlockHeader) return false;
+    const auto raw = get_fixed<uint32_t>(base_ + off);
+    const auto stored = get_fixed<uint32_t>(base_ + off + 4);
+    const auto crc = get_fixed<uint32_t>(base_ + off + 8);
+    off += kBlockHeader;
+    if (stored > raw || stored > data_end_ - off || crc_of(base_ + off, stored) != crc) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SnapshotFileReader::next_block(uint64_t off, std::string& scratch,
+                                    std::string_view& block) const {
+  const auto raw = get_fixed<uint32_t>(base_ + off);
+  const auto stored = get_fixed<uint32_t>(base_ + off + 4);
+  const std::string_view bytes(base_ + off + kBlockHeader, stored);
+  if (stored == raw) {
+    block = bytes;
+    return true;
+  }
+  scratch.clear();
+  if (!lz4_decompress(bytes, raw, scratch)) return false;
+  block = scratch;
+  return true;
+}
+
+}  // namespace kv
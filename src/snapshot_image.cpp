@@ -0,0 +1,303 @@
+#include "kv/snapshot_image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "kv/crc32.h"
+#include "kv/snapshot_file.h"
+#include "io_util.h"
+
+namespace kv {
+namespace {
+
+constexpr uint32_t kImageMagic = 0x4D49564Bu;  // 'K''V''I''M'
+// Version 1 images (no hash id) still load, copied into the shard tables.
+constexpr uint32_t kImageVersion = 2;
+constexpr std::size_t kHeaderBytes = 8;
+constexpr std::size_t kEntryHeader = 4 + 4 + 1;
+constexpr std::size_t kDirEntryBytes = 4 * 8 + 4;
+constexpr std::size_t kFooterBytes = 5 * 8 + 4 + 4 + 4;
+constexpr std::size_t kFooterBytesV1 = 4 * 8 + 4 + 4 + 4;
+constexpr uint64_t kOffsetMask = (uint64_t{1} << 48) - 1;
+
+uint32_t crc_of(uint32_t crc, const char* p, std::size_t n) {
+  return crc32c_update(crc, reinterpret_cast<const uint8_t*>(p), n);
+}
+
+}  // namespace
+
+// ---------------- writer ----------------
+
+SnapshotImageWriter::SnapshotImageWriter(IoBackend::Kind io, std::size_t partitions,
+                                         uint64_t hash_id)
+    : file_(io), parts_(std::max<std::size_t>(partitions, 1)), hash_id_(hash_id) {}
+
+bool SnapshotImageWriter::open(const std::string& path) {
+  if (!file_.open(path)) return false;
+  std::string header;
+  put_fixed(header, kImageMagic);
+  put_fixed(header, kImageVersion);
+  return append(header);
+}
+
+bool SnapshotImageWriter::append(std::string_view bytes, uint64_t* offset) {
+  std::lock_guard lock(mu_);
+  if (offset != nullptr) *offset = offset_;
+  const auto n = static_cast<std::streamsize>(bytes.size());
+  ok_ = ok_ && file_.sputn(bytes.data(), n) == n;
+  offset_ += bytes.size();
+  return ok_;
+}
+
+void SnapshotImageWriter::add(std::size_t partition, std::string_view key, uint64_t hash,
+                              std::string_view value, bool value_ref, uint64_t expires_at) {
+  Partition& part = parts_[partition];
+  std::string& buf = part.buffer;
+  const std::size_t start = buf.size();
+  put_fixed(buf, static_cast<uint32_t>(key.size()));
+  put_fixed(buf, static_cast<uint32_t>(value.size()));
+  buf.push_back(static_cast<char>((value_ref ? kSnapshotRef : 0) |
+                                  (expires_at != 0 ? kSnapshotExpires : 0)));
+  buf.append(key);
+  buf.append(value);
+  if (expires_at != 0) put_fixed(buf, expires_at);
+  put_fixed(buf, crc_of(0, buf.data() + start, buf.size() - start));
+  part.pending.emplace_back(hash, start);
+  if (expires_at != 0) part.pending_ttl.push_back(start);
+  if (buf.size() >= kFlushBytes) (void)flush(part);
+}
+
+bool SnapshotImageWriter::flush(Partition& part) {
+  if (part.buffer.empty()) return true;
+  uint64_t base = 0;
+  const bool ok = append(part.buffer, &base);
+  for (const auto& [hash, off] : part.pending) part.entries.emplace_back(hash, base + off);
+  for (uint64_t off : part.pending_ttl) part.ttl.push_back(base + off);
+  part.buffer.clear();
+  part.pending.clear();
+  part.pending_ttl.clear();
+  return ok;
+}
+
+bool SnapshotImageWriter::finish(uint64_t seq) {
+  bool ok = true;
+  for (Partition& part : parts_) ok = flush(part) && ok;
+  const uint64_t heap_end = offset_;
+  // The index arrays are read as u64 in place.
+  ok = append(std::string((8 - heap_end % 8) % 8, '\0')) && ok;
+
+  std::string dir;
+  uint64_t entries = 0;
+  std::vector<uint64_t> slots;
+  for (const Partition& part : parts_) {
+    // At most 3/4 full, so probe runs stay short.
+    const uint64_t capacity = std::bit_ceil(std::max<uint64_t>(part.entries.size() * 4 / 3 + 1, 8));
+    slots.assign(capacity, 0);
+    for (const auto& [hash, off] : part.entries) {
+      uint64_t i = hash & (capacity - 1);
+      while (slots[i] != 0) i = (i + 1) & (capacity - 1);
+      slots[i] = (hash & ~kOffsetMask) | off;
+    }
+    std::vector<uint64_t> sorted;
+    sorted.reserve(part.entries.size());
+    for (const auto& entry : part.entries) sorted.push_back(entry.second);
+
+    const std::string_view slot_bytes(reinterpret_cast<const char*>(slots.data()),
+                                      slots.size() * sizeof(uint64_t));
+    const std::string_view sorted_bytes(reinterpret_cast<const char*>(sorted.data()),
+                                        sorted.size() * sizeof(uint64_t));
+    uint64_t slots_at = 0;
+    uint64_t sorted_at = 0;
+    ok = append(slot_bytes, &slots_at) && append(sorted_bytes, &sorted_at) && ok;
+    put_fixed(dir, slots_at);
+    put_fixed(dir, capacity);
+    put_fixed(dir, sorted_at);
+    put_fixed(dir, static_cast<uint64_t>(sorted.size()));
+    put_fixed(dir, crc_of(crc_of(0, slot_bytes.data(), slot_bytes.size()), sorted_bytes.data(),
+                          sorted_bytes.size()));
+    entries += sorted.size();
+  }
+
+  uint64_t ttl_at = offset_;
+  uint64_t ttl_count = 0;
+  for (const Partition& part : parts_) {
+    uint64_t at = 0;
+    ok = append(std::string_view(reinterpret_cast<const char*>(part.ttl.data()),
+                                 part.ttl.size() * sizeof(uint64_t)),
+                &at) &&
+         ok;
+    if (ttl_count == 0) ttl_at = at;
+    ttl_count += part.ttl.size();
+  }
+  put_fixed(dir, ttl_at);
+  put_fixed(dir, ttl_count);
+
+  uint64_t dir_at = 0;
+  ok = append(dir, &dir_at) && ok;
+  std::string footer;
+  put_fixed(footer, entries);
+  put_fixed(footer, seq);
+  put_fixed(footer, heap_end);
+  put_fixed(footer, dir_at);
+  put_fixed(footer, hash_id_);
+  put_fixed(footer, static_cast<uint32_t>(parts_.size()));
+  put_fixed(footer, crc_of(crc_of(0, dir.data(), dir.size()), footer.data(), footer.size()));
+  put_fixed(footer, kImageMagic);
+  ok = append(footer) && ok;
+  return file_.finish() && ok;
+}
+
+// ---------------- reader ----------------
+
+SnapshotImage::~SnapshotImage() {
+  if (base_ != nullptr) ::munmap(const_cast<char*>(base_), size_);
+}
+
+SnapshotImage::Status SnapshotImage::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return Status::kMissing;
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return Status::kCorrupt;
+  }
+  size_ = static_cast<std::size_t>(st.st_size);
+  if (size_ < kHeaderBytes) {
+    ::close(fd);
+    return Status::kOther;
+  }
+  void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    base_ = nullptr;
+    return Status::kCorrupt;
+  }
+  base_ = static_cast<const char*>(p);
+  // Served by point lookups: fault in what is touched, no readahead.
+  (void)::madvise(p, size_, MADV_RANDOM);
+
+  if (get_fixed<uint32_t>(base_) != kImageMagic) return Status::kOther;
+  const auto version = get_fixed<uint32_t>(base_ + 4);
+  const std::size_t footer_bytes = version == 1 ? kFooterBytesV1 : kFooterBytes;
+  if ((version != kImageVersion && version != 1) || size_ < kHeaderBytes + footer_bytes) {
+    return Status::kCorrupt;
+  }
+  const char* footer = base_ + size_ - footer_bytes;
+  // Fields after the directory offset; v1 has no hash id.
+  const char* tail = footer + (version == 1 ? 32 : 40);
+  if (get_fixed<uint32_t>(tail + 8) != kImageMagic) return Status::kCorrupt;
+  entries_ = get_fixed<uint64_t>(footer);
+  seq_ = get_fixed<uint64_t>(footer + 8);
+  heap_end_ = get_fixed<uint64_t>(footer + 16);
+  const auto dir_at = get_fixed<uint64_t>(footer + 24);
+  hash_id_ = version == 1 ? 0 : get_fixed<uint64_t>(footer + 32);
+  const auto partitions = get_fixed<uint32_t>(tail);
+  const uint64_t dir_end = size_ - footer_bytes;
+  if (partitions == 0 || dir_at > dir_end ||
+      dir_end - dir_at != std::size_t{partitions} * kDirEntryBytes + 16 ||
+      heap_end_ < kHeaderBytes || heap_end_ > dir_at) {
+    return Status::kCorrupt;
+  }
+  const char* dir = base_ + dir_at;
+  if (get_fixed<uint32_t>(tail + 4) !=
+      crc_of(crc_of(0, dir, dir_end - dir_at), footer, tail + 4 - footer)) {
+    return Status::kCorrupt;
+  }
+
+  // Index arrays lie between the heap and the directory.
+  auto array_ok = [&](uint64_t at, uint64_t n) {
+    return at % 8 == 0 && at >= heap_end_ && at <= dir_at && n <= (dir_at - at) / 8;
+  };
+  uint64_t entries = 0;
+  for (uint32_t i = 0; i < partitions; ++i) {
+    const char* d = dir + std::size_t{i} * kDirEntryBytes;
+    Partition part{get_fixed<uint64_t>(d), get_fixed<uint64_t>(d + 8),
+                   get_fixed<uint64_t>(d + 16), get_fixed<uint64_t>(d + 24),
+                   get_fixed<uint32_t>(d + 32)};
+    if (!std::has_single_bit(part.capacity) || part.count >= part.capacity ||
+        !array_ok(part.slots, part.capacity) || !array_ok(part.sorted, part.count)) {
+      return Status::kCorrupt;
+    }
+    entries += part.count;
+    parts_.push_back(part);
+  }
+  ttl_ = get_fixed<uint64_t>(dir + std::size_t{partitions} * kDirEntryBytes);
+  ttl_count_ = get_fixed<uint64_t>(dir + std::size_t{partitions} * kDirEntryBytes + 8);
+  if (entries != entries_ || !array_ok(ttl_, ttl_count_)) return Status::kCorrupt;
+  return Status::kOk;
+}
+
+uint64_t SnapshotImage::load(uint64_t off) const { return get_fixed<uint64_t>(base_ + off); }
+
+bool SnapshotImage::decode(uint64_t off, Entry* entry) const {
+  if (off < kHeaderBytes || off > heap_end_ || heap_end_ - off < kEntryHeader + 4) return false;
+  const char* p = base_ + off;
+  const auto key_len = get_fixed<uint32_t>(p);
+  const auto val_len = get_fixed<uint32_t>(p + 4);
+  const auto flags = static_cast<uint8_t>(p[8]);
+  const std::size_t tail = (flags & kSnapshotExpires) != 0 ? sizeof(uint64_t) : 0;
+  const uint64_t body = uint64_t{key_len} + val_len + tail;
+  if (body > heap_end_ - off - kEntryHeader - 4) return false;
+  const std::size_t n = kEntryHeader + body;
+  if (get_fixed<uint32_t>(p + n) != crc_of(0, p, n)) return false;
+  entry->key = std::string_view(p + kEntryHeader, key_len);
+  entry->value = std::string_view(p + kEntryHeader + key_len, val_len);
+  entry->value_ref = (flags & kSnapshotRef) != 0;
+  entry->expires_at = tail != 0 ? get_fixed<uint64_t>(p + kEntryHeader + key_len + val_len) : 0;
+  return true;
+}
+
+bool SnapshotImage::find(std::size_t partition, std::string_view key, uint64_t hash,
+                         Entry* entry) const {
+  const Partition& part = parts_[partition];
+  const uint64_t mask = part.capacity - 1;
+  for (uint64_t i = hash & mask, probes = 0; probes < part.capacity; i = (i + 1) & mask, ++probes) {
+    const uint64_t slot = load(part.slots + i * 8);
+    if (slot == 0) return false;
+    if ((slot & ~kOffsetMask) != (hash & ~kOffsetMask)) continue;
+    if (decode(slot & kOffsetMask, entry) && entry->key == key) return true;
+  }
+  return false;
+}
+
+uint64_t SnapshotImage::lower_bound(std::size_t partition, std::string_view key) const {
+  const Partition& part = parts_[partition];
+  uint64_t lo = 0;
+  uint64_t hi = part.count;
+  Entry e;
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    // A damaged entry sorts first; the scan reports nothing for it.
+    if (!decode(load(part.sorted + mid * 8), &e) || e.key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool SnapshotImage::entry_at(std::size_t partition, uint64_t i, Entry* entry) const {
+  return decode(load(parts_[partition].sorted + i * 8), entry);
+}
+
+bool SnapshotImage::verify() const {
+  Entry e;
+  for (const Partition& part : parts_) {
+    const uint32_t crc = crc_of(crc_of(0, base_ + part.slots, part.capacity * 8),
+                                base_ + part.sorted, part.count * 8);
+    if (crc != part.crc) return false;
+    for (uint64_t i = 0; i < part.count; ++i) {
+      if (!decode(load(part.sorted + i * 8), &e)) return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace kv
@@ -0,0 +1,312 @@
+#include "kv/sstable.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kv/crc32.h"
+#include "io_util.h"
+
+namespace kv {
+namespace {
+
+constexpr uint32_t kTableMagic = 0x5453564Bu;  // 'K''V''S''T'
+constexpr uint32_t kTableVersion = 1;
+constexpr std::size_t kEntryHeader = 4 + 4 + 8 + 1;
+constexpr std::size_t kFooterBytes = 6 * 8 + 4 + 4;
+
+uint32_t crc_of(std::string_view bytes) {
+  return crc32_update(0, reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+}
+
+bool write_all(int fd, const char* p, std::size_t n) {
+  while (n > 0) {
+    const ssize_t w = ::write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= static_cast<std::size_t>(w);
+  }
+  return true;
+}
+
+}  // namespace
+
+// ---------------- writer ----------------
+
+SSTableWriter::SSTableWriter(const Options& options)
+    : block_bytes_(options.block_bytes == 0 ? 4096 : options.block_bytes),
+      bloom_(options.bloom_bits_per_key) {}
+
+SSTableWriter::~SSTableWriter() {
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool SSTableWriter::open(const std::string& path) {
+  path_ = path;
+  fd_ = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  return fd_ >= 0;
+}
+
+bool SSTableWriter::append(std::string_view bytes) {
+  if (!write_all(fd_, bytes.data(), bytes.size())) return false;
+  offset_ += bytes.size();
+  return true;
+}
+
+bool SSTableWriter::add(std::string_view key, uint64_t seq, EntryType type,
+                        std::string_view value, uint64_t expires_at) {
+  if (entries_ == 0) smallest_.assign(key);
+  if (entries_ == 0 || key != last_key_) {
+    // Cut blocks only between keys so one key's versions stay together.
+    if (block_.size() >= block_bytes_ && !flush_block()) return false;
+    bloom_.add(key);
+    last_key_.assign(key);
+  }
+
+  put_fixed(block_, static_cast<uint32_t>(key.size()));
+  const std::size_t trailer = expires_at != 0 ? sizeof(expires_at) : 0;
+  put_fixed(block_, static_cast<uint32_t>(value.size() + trailer));
+  put_fixed(block_, seq);
+  block_.push_back(static_cast<char>(static_cast<uint8_t>(type) |
+                                     (trailer != 0 ? kExpiresBit : 0)));
+  block_.append(key);
+  block_.append(value);
+  if (trailer != 0) put_fixed(block_, expires_at);
+  ++entries_;
+  max_seq_ = std::max(max_seq_, seq);
+  return true;
+}
+
+bool SSTableWriter::flush_block() {
+  if (block_.empty()) return true;
+  const uint64_t off = offset_;
+  const auto size = static_cast<uint32_t>(block_.size());
+  put_fixed(block_, crc_of(block_));
+  if (!append(block_)) return false;
+  block_.clear();
+
+  put_fixed(index_, static_cast<uint32_t>(last_key_.size()));
+  put_fixed(index_, off);
+  put_fixed(index_, size);
+  index_.append(last_key_);
+  return true;
+}
+
+bool SSTableWriter::finish() {
+  if (fd_ < 0 || entries_ == 0) return false;
+  if (!flush_block()) return false;
+
+  std::string index;
+  put_fixed(index, static_cast<uint32_t>(smallest_.size()));
+  index.append(smallest_);
+  index.append(index_);
+  const uint64_t index_off = offset_;
+  const uint64_t index_size = index.size();
+  put_fixed(index, crc_of(index));
+  if (!append(index)) return false;
+
+  std::string filter = bloom_.finish();
+  const uint64_t filter_off = offset_;
+  const uint64_t filter_size = filter.size();
+  put_fixed(filter, crc_of(filter));
+  if (!append(filter)) return false;
+
+  std::string footer;
+  put_fixed(footer, index_off);
+  put_fixed(footer, index_size);
+  put_fixed(footer, filter_off);
+  put_fixed(footer, filter_size);
+  put_fixed(footer, entries_);
+  put_fixed(footer, max_seq_);
+  put_fixed(footer, kTableVersion);
+  put_fixed(footer, kTableMagic);
+  if (!append(footer)) return false;
+
+  if (::fsync(fd_) != 0) return false;
+  ::close(fd_);
+  fd_ = -1;
+  return true;
+}
+
+void SSTableWriter::abandon() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  std::remove(path_.c_str());
+}
+
+// ---------------- reader ----------------
+
+std::shared_ptr<SSTable> SSTable::open(const std::string& path, uint64_t number) {
+  std::shared_ptr<SSTable> t(new SSTable());
+  t->path_ = path;
+  t->number_ = number;
+  t->fd_ = ::open(path.c_str(), O_RDONLY);
+  if (t->fd_ < 0) return nullptr;
+
+  struct stat st{};
+  if (::fstat(t->fd_, &st) != 0 || static_cast<uint64_t>(st.st_size) < kFooterBytes) {
+    return nullptr;
+  }
+  t->file_size_ = static_cast<uint64_t>(st.st_size);
+
+  char footer[kFooterBytes];
+  if (!pread_all(t->fd_, footer, kFooterBytes, t->file_size_ - kFooterBytes)) return nullptr;
+  const auto index_off = get_fixed<uint64_t>(footer);
+  const auto index_size = get_fixed<uint64_t>(footer + 8);
+  const auto filter_off = get_fixed<uint64_t>(footer + 16);
+  const auto filter_size = get_fixed<uint64_t>(footer + 24);
+  t->entries_ = get_fixed<uint64_t>(footer + 32);
+  t->max_seq_ = get_fixed<uint64_t>(footer + 40);
+  if (get_fixed<uint32_t>(footer + 48) != kTableVersion ||
+      get_fixed<uint32_t>(footer + 52) != kTableMagic) {
+    return nullptr;
+  }
+  if (index_off + index_size + 4 > t->file_size_ ||
+      filter_off + filter_size + 4 > t->file_size_) {
+    return nullptr;
+  }
+
+  auto read_checked = [&](uint64_t off, uint64_t size, std::string& out) {
+    out.resize(size + 4);
+    if (!pread_all(t->fd_, out.data(), out.size(), off)) return false;
+    const auto stored = get_fixed<uint32_t>(out.data() + size);
+    out.resize(size);
+    return crc_of(out) == stored;
+  };
+
+  std::string index;
+  if (!read_checked(index_off, index_size, index)) return nullptr;
+  if (!read_checked(filter_off, filter_size, t->filter_)) return nullptr;
+
+  std::size_t pos = 0;
+  auto take = [&](std::size_t n) { return index.size() - pos >= n; };
+  if (!take(4)) return nullptr;
+  const auto smallest_len = get_fixed<uint32_t>(index.data());
+  pos = 4;
+  if (!take(smallest_len)) return nullptr;
+  t->smallest_.assign(index, pos, smallest_len);
+  pos += smallest_len;
+  while (pos < index.size()) {
+    if (!take(16)) return nullptr;
+    const auto klen = get_fixed<uint32_t>(index.data() + pos);
+    BlockHandle h{{}, get_fixed<uint64_t>(index.data() + pos + 4),
+                  get_fixed<uint32_t>(index.data() + pos + 12)};
+    pos += 16;
+    if (!take(klen)) return nullptr;
+    h.last_key.assign(index, pos, klen);
+    pos += klen;
+    t->index_.push_back(std::move(h));
+  }
+  if (t->index_.empty()) return nullptr;
+  return t;
+}
+
+SSTable::~SSTable() {
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool SSTable::read_block(std::size_t i, std::string* out) const {
+  const BlockHandle& h = index_[i];
+  out->resize(static_cast<std::size_t>(h.size) + 4);
+  if (!pread_all(fd_, out->data(), out->size(), h.offset)) return false;
+  const auto stored = get_fixed<uint32_t>(out->data() + h.size);
+  out->resize(h.size);
+  if (crc_of(*out) != stored) {
+    std::cerr << "[sstable] bad block crc in " << path_ << " block " << i << "\n";
+    return false;
+  }
+  return true;
+}
+
+SSTable::Lookup SSTable::get(std::string_view key, uint64_t at, std::string* value,
+                             uint64_t* expires_at) const {
+  if (key < smallest() || key > largest()) return Lookup::kNotFound;
+  if (!bloom_may_contain(filter_, key)) return Lookup::kNotFound;
+
+  Iterator it(this);
+  for (it.seek(key); it.valid() && it.key() == key; it.next()) {
+    if (it.seq() > at) continue;
+    if (it.type() == EntryType::Del) return Lookup::kDeleted;
+    value->assign(it.value());
+    if (expires_at != nullptr) *expires_at = it.expires_at();
+    return it.type() == EntryType::Ref ? Lookup::kFoundRef : Lookup::kFound;
+  }
+  return Lookup::kNotFound;
+}
+
+bool SSTable::Iterator::load_block(std::size_t i) {
+  block_ = i;
+  pos_ = 0;
+  if (i >= table_->index_.size()) return false;
+  if (!table_->read_block(i, &data_)) {
+    ok_ = false;
+    return false;
+  }
+  return true;
+}
+
+void SSTable::Iterator::parse() {
+  // Move to the next block when this one is used up.
+  while (pos_ >= data_.size()) {
+    if (!load_block(block_ + 1)) {
+      valid_ = false;
+      return;
+    }
+  }
+  if (data_.size() - pos_ < kEntryHeader) {
+    ok_ = valid_ = false;
+    return;
+  }
+  const char* p = data_.data() + pos_;
+  const auto klen = get_fixed<uint32_t>(p);
+  const auto vlen = get_fixed<uint32_t>(p + 4);
+  if (data_.size() - pos_ - kEntryHeader < static_cast<std::size_t>(klen) + vlen) {
+    ok_ = valid_ = false;
+    return;
+  }
+  seq_ = get_fixed<uint64_t>(p + 8);
+  const auto type = static_cast<uint8_t>(p[16]);
+  type_ = static_cast<EntryType>(type & ~kExpiresBit);
+  key_ = std::string_view(p + kEntryHeader, klen);
+  value_ = std::string_view(p + kEntryHeader + klen, vlen);
+  entry_bytes_ = kEntryHeader + klen + vlen;
+  expires_at_ = 0;
+  if ((type & kExpiresBit) != 0) {
+    if (vlen < sizeof(expires_at_)) {
+      ok_ = valid_ = false;
+      return;
+    }
+    value_.remove_suffix(sizeof(expires_at_));
+    expires_at_ = get_fixed<uint64_t>(value_.data() + value_.size());
+  }
+  valid_ = true;
+}
+
+void SSTable::Iterator::seek(std::string_view target) {
+  valid_ = false;
+  const auto& index = table_->index_;
+  // First block whose last key is >= target.
+  const auto it = std::lower_bound(
+      index.begin(), index.end(), target,
+      [](const BlockHandle& h, std::string_view k) { return h.last_key < k; });
+  if (it == index.end()) return;
+  if (!load_block(static_cast<std::size_t>(it - index.begin()))) return;
+  for (parse(); valid_ && key_ < target; next()) {
+  }
+}
+
+void SSTable::Iterator::next() {
+  pos_ += entry_bytes_;
+  parse();
+}
+
+}  // namespace kv
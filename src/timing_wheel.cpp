@@ -0,0 +1,78 @@
+#include "kv/timing_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace kv {
+
+TimingWheel::TimingWheel(uint64_t tick_ms)
+    : tick_ms_(tick_ms == 0 ? 1 : tick_ms), current_(now_ms() / tick_ms_) {}
+
+uint64_t TimingWheel::now_ms() {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(
+      duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+void TimingWheel::schedule(std::string key, uint64_t expires_at) {
+  place(Entry{std::move(key), expires_at}, current_ + 1);
+  ++size_;
+}
+
+void TimingWheel::place(Entry e, uint64_t earliest) {
+  const uint64_t tick = std::max(tick_of(e.expires_at), earliest);
+  const uint64_t delta = tick - current_;
+  for (int level = 0; level < kLevels; ++level) {
+    const unsigned shift = kSlotBits * static_cast<unsigned>(level);
+    if (level + 1 < kLevels && delta >= (uint64_t{1} << (shift + kSlotBits))) continue;
+    // The top level also takes deadlines beyond its range: clamp to the
+    // farthest slot and re-place when it cascades.
+    const uint64_t span = uint64_t{1} << (shift + kSlotBits);
+    const uint64_t at = delta < span ? tick : current_ + span - 1;
+    slots_[level][(at >> shift) & (kSlots - 1)].push_back(std::move(e));
+    return;
+  }
+}
+
+void TimingWheel::cascade(int level) {
+  const unsigned shift = kSlotBits * static_cast<unsigned>(level);
+  auto entries = std::move(slots_[level][(current_ >> shift) & (kSlots - 1)]);
+  slots_[level][(current_ >> shift) & (kSlots - 1)].clear();
+  // Runs before level 0 handles current_, so entries due now land there.
+  for (auto& e : entries) place(std::move(e), current_);
+}
+
+void TimingWheel::advance(uint64_t now_ms, std::vector<Entry>* due) {
+  const uint64_t target = now_ms / tick_ms_;
+  if (size_ == 0) {
+    current_ = std::max(current_, target);
+    return;
+  }
+  while (current_ < target && size_ != 0) {
+    ++current_;
+    // Cascade from the highest wheel that wrapped down, so entries moved
+    // into a lower slot that is due this tick are seen by that level too.
+    int top = 0;
+    while (top + 1 < kLevels &&
+           (current_ & ((uint64_t{1} << (kSlotBits * static_cast<unsigned>(top + 1))) - 1)) == 0) {
+      ++top;
+    }
+    for (int level = top; level >= 1; --level) cascade(level);
+
+    auto& slot = slots_[0][current_ & (kSlots - 1)];
+    auto entries = std::move(slot);
+    slot.clear();
+    for (auto& e : entries) {
+      if (tick_of(e.expires_at) <= current_) {
+        due->push_back(std::move(e));
+        --size_;
+      } else {
+        place(std::move(e), current_ + 1);  // parked beyond the top level's range
+      }
+    }
+  }
+  current_ = std::max(current_, target);
+}
+
+}  // namespace kv
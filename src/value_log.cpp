@@ -0,0 +1,208 @@
+#include "kv/value_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kv/crc32.h"
+#include "io_util.h"
+
+namespace kv {
+namespace {
+
+constexpr std::size_t kRecordHeader = 4 + 4 + 4;
+
+uint32_t record_crc(const char* rec, std::size_t n) {
+  // Everything after the crc field.
+  return crc32_update(0, reinterpret_cast<const uint8_t*>(rec + 4), n - 4);
+}
+
+}  // namespace
+
+std::string ValuePointer::encode() const {
+  std::string out(kEncodedSize, '\0');
+  put_fixed(out.data(), file);
+  put_fixed(out.data() + 4, offset);
+  put_fixed(out.data() + 12, len);
+  return out;
+}
+
+bool ValuePointer::decode(std::string_view bytes, ValuePointer* out) {
+  if (bytes.size() != kEncodedSize) return false;
+  out->file = get_fixed<uint32_t>(bytes.data());
+  out->offset = get_fixed<uint64_t>(bytes.data() + 4);
+  out->len = get_fixed<uint32_t>(bytes.data() + 12);
+  return true;
+}
+
+ValueLog::File::~File() {
+  if (fd >= 0) ::close(fd);
+}
+
+ValueLog::~ValueLog() {
+  (void)sync();
+}
+
+std::string ValueLog::path_of(uint32_t file) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%06u.vlog", file);
+  return dir_ + "/" + name;
+}
+
+bool ValueLog::open(const std::string& dir, std::size_t file_bytes) {
+  dir_ = dir;
+  file_bytes_ = file_bytes == 0 ? (64u << 20) : file_bytes;
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) return false;
+
+  uint32_t last = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+    const std::string name = entry.path().filename().string();
+    unsigned number = 0;
+    char tail = 0;
+    if (std::sscanf(name.c_str(), "%u.vlo%c", &number, &tail) != 2 || tail != 'g') continue;
+
+    auto f = std::make_shared<File>();
+    f->fd = ::open(entry.path().c_str(), O_RDONLY);
+    if (f->fd < 0) return false;
+    f->size = static_cast<uint64_t>(entry.file_size(ec));
+    files_[number] = std::move(f);
+    last = std::max<uint32_t>(last, number);
+  }
+  if (ec) return false;
+
+  std::lock_guard lock(append_mu_);
+  open_ = open_active_locked(last + 1);
+  return open_;
+}
+
+bool ValueLog::open_active_locked(uint32_t number) {
+  auto f = std::make_shared<File>();
+  f->fd = ::open(path_of(number).c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (f->fd < 0) return false;
+  // Make the new name durable along with the records that will refer to it.
+  const int dir_fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    (void)::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  std::unique_lock lock(mu_);
+  files_[number] = f;
+  active_ = std::move(f);
+  active_number_ = number;
+  return true;
+}
+
+bool ValueLog::append(std::string_view key, std::string_view value, ValuePointer* ptr) {
+  std::string rec(kRecordHeader + key.size() + value.size(), '\0');
+  put_fixed(rec.data() + 4, static_cast<uint32_t>(key.size()));
+  put_fixed(rec.data() + 8, static_cast<uint32_t>(value.size()));
+  std::memcpy(rec.data() + kRecordHeader, key.data(), key.size());
+  std::memcpy(rec.data() + kRecordHeader + key.size(), value.data(), value.size());
+  put_fixed(rec.data(), record_crc(rec.data(), rec.size()));
+
+  std::lock_guard lock(append_mu_);
+  if (active_ == nullptr) return false;
+  if (active_->size != 0 && active_->size + rec.size() > file_bytes_) {
+    // Seal: the old file must be durable before it stops being synced.
+    if (dirty_ && ::fdatasync(active_->fd) != 0) return false;
+    dirty_ = false;
+    if (!open_active_locked(active_number_ + 1)) return false;
+  }
+  if (!pwrite_all(active_->fd, rec.data(), rec.size(), active_->size)) return false;
+
+  ptr->file = active_number_;
+  ptr->offset = active_->size;
+  ptr->len = static_cast<uint32_t>(value.size());
+  active_->size += rec.size();
+  dirty_ = true;
+  return true;
+}
+
+bool ValueLog::sync() {
+  std::lock_guard lock(append_mu_);
+  if (!dirty_ || active_ == nullptr) return true;
+  if (::fdatasync(active_->fd) != 0) return false;
+  dirty_ = false;
+  return true;
+}
+
+std::shared_ptr<ValueLog::File> ValueLog::find(uint32_t file) const {
+  std::shared_lock lock(mu_);
+  const auto it = files_.find(file);
+  return it == files_.end() ? nullptr : it->second;
+}
+
+bool ValueLog::read(const ValuePointer& ptr, std::string_view key, std::string* value) const {
+  const auto f = find(ptr.file);
+  if (f == nullptr) return false;
+
+  std::string rec(kRecordHeader + key.size() + ptr.len, '\0');
+  if (!pread_all(f->fd, rec.data(), rec.size(), ptr.offset)) return false;
+  if (get_fixed<uint32_t>(rec.data()) != record_crc(rec.data(), rec.size()) ||
+      get_fixed<uint32_t>(rec.data() + 4) != key.size() ||
+      get_fixed<uint32_t>(rec.data() + 8) != ptr.len ||
+      std::string_view(rec).substr(kRecordHeader, key.size()) != key) {
+    std::cerr << "[vlog] bad record in " << path_of(ptr.file) << " at " << ptr.offset << "\n";
+    return false;
+  }
+  value->assign(rec, kRecordHeader + key.size(), ptr.len);
+  return true;
+}
+
+std::vector<uint32_t> ValueLog::sealed_files() const {
+  std::vector<uint32_t> out;
+  std::shared_lock lock(mu_);
+  for (const auto& [number, f] : files_) {
+    if (f != active_) out.push_back(number);
+  }
+  return out;
+}
+
+uint64_t ValueLog::file_size(uint32_t file) const {
+  const auto f = find(file);
+  return f == nullptr ? 0 : f->size;
+}
+
+bool ValueLog::for_each_record(
+    uint32_t file,
+    const std::function<void(std::string_view, const ValuePointer&)>& fn) const {
+  const auto f = find(file);
+  if (f == nullptr) return false;
+
+  char header[kRecordHeader];
+  std::string rec;
+  uint64_t off = 0;
+  while (off + kRecordHeader <= f->size) {
+    if (!pread_all(f->fd, header, kRecordHeader, off)) return false;
+    const auto klen = get_fixed<uint32_t>(header + 4);
+    const auto vlen = get_fixed<uint32_t>(header + 8);
+    const uint64_t n = kRecordHeader + static_cast<uint64_t>(klen) + vlen;
+    if (off + n > f->size) break;  // torn tail
+    rec.resize(n);
+    if (!pread_all(f->fd, rec.data(), n, off)) return false;
+    if (get_fixed<uint32_t>(rec.data()) != record_crc(rec.data(), n)) break;
+    fn(std::string_view(rec).substr(kRecordHeader, klen), ValuePointer{file, off, vlen});
+    off += n;
+  }
+  return true;
+}
+
+bool ValueLog::remove_file(uint32_t file) {
+  {
+    std::unique_lock lock(mu_);
+    const auto it = files_.find(file);
+    if (it == files_.end() || it->second == active_) return false;
+    files_.erase(it);  // the fd closes once in-flight readers drop it
+  }
+  return std::remove(path_of(file).c_str()) == 0;
+}
+
+}  // namespace kv
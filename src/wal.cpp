@@ -1,94 +1,545 @@
 #include "kv/wal.h"
+#include "kv/compression.h"
+#include "kv/crc32.h"
 #include "kv/kv_store.h"
+#include "kv/write_batch.h"
+#include "io_util.h"
 
 #include <algorithm>
 #include <cerrno>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <unistd.h>
 #include <iostream>
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 namespace kv {
 
-// -------- CRC32 (IEEE) --------
-static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n) {
-  static uint32_t table[256];
-  static bool inited = false;
-  if (!inited) {
-    for (uint32_t i = 0; i < 256; ++i) {
-      uint32_t c = i;
-      for (int k = 0; k < 8; ++k) c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
-      table[i] = c;
+#ifdef O_DIRECT
+static constexpr int kODirect = O_DIRECT;
+#else
+static constexpr int kODirect = 0;
+#endif
+static constexpr std::size_t kDirectBlock = 4096;
+
+// Segment files are fully allocated and written once with zeros, so later
+// appends only overwrite initialized blocks (fallocate alone would leave
+// unwritten extents whose conversion still costs a journal commit).
+static bool create_segment_file(const std::string& path, std::size_t bytes) {
+  const int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) return false;
+#ifdef __linux__
+  (void)::fallocate(fd, 0, 0, static_cast<off_t>(bytes));
+#endif
+  static const std::string zeros(std::size_t{1} << 20, '\0');
+  bool ok = true;
+  for (std::size_t off = 0; ok && off < bytes; off += zeros.size()) {
+    ok = pwrite_all(fd, zeros.data(), std::min(zeros.size(), bytes - off), off);
+  }
+  ok = ok && ::fsync(fd) == 0;
+  ::close(fd);
+  if (!ok) std::remove(path.c_str());
+  return ok;
+}
+
+#pragma pack(push, 1)
+struct WalHeader {
+  uint32_t magic;     // 'KVLG'
+  uint16_t version;   // 1: IEEE CRC-32, 2: CRC-32C
+  uint8_t  type;      // 1=PUT,2=DEL,3=BATCH,4=PUT_REF,5=PUT_TTL,6=EXPIRE,7=BATCH_LZ4
+  uint32_t key_len;   // BATCH: operation count
+  uint32_t val_len;   // 0 for DEL/EXPIRE; BATCH: payload bytes
+  uint64_t seq;       // BATCH: sequence number of the first operation
+};
+#pragma pack(pop)
+
+static constexpr uint32_t kMagic = 0x474C564Bu;   // 'K''V''L''G'
+static constexpr uint16_t kVersion = 2;
+static constexpr uint16_t kVersionIeee = 1;  // still replayed
+
+// Record checksum for a header's format version.
+static uint32_t record_crc(uint16_t version, uint32_t crc, const void* data, std::size_t n) {
+  const auto* p = static_cast<const uint8_t*>(data);
+  return version == kVersionIeee ? crc32_update(crc, p, n) : crc32c_update(crc, p, n);
+}
+static constexpr std::size_t kTtlPrefix = 8 + 1;  // PUT_TTL: expires_at | is_ref
+// Initial size of each append arena. Arenas keep their capacity between
+// groups, so the put path stops allocating once they are warm; one that grew
+// past kArenaRetain for an outsized group is given back.
+static constexpr std::size_t kArenaBytes = std::size_t{1} << 20;
+static constexpr std::size_t kArenaRetain = std::size_t{16} << 20;
+// Appends wait once this much is queued: writers that do not wait for
+// durability (kTimed, kAsync, kCount) must not outrun the writer thread
+// without bound.
+static constexpr std::size_t kMaxQueuedBytes = std::size_t{64} << 20;
+// Released segments beyond this many are deleted instead of pooled.
+static constexpr std::size_t kMaxFreeSegments = 4;
+// Smaller batch payloads are not worth a compression attempt.
+static constexpr std::size_t kMinCompressBytes = 128;
+
+// Header of a new (v2) record; key_len is the operation count for BATCH.
+static WalHeader make_header(Wal::Type t, uint64_t seq, std::size_t key_len,
+                             std::size_t val_len) {
+  WalHeader h{};
+  h.magic = kMagic;
+  h.version = kVersion;
+  h.type = static_cast<uint8_t>(t);
+  h.key_len = static_cast<uint32_t>(key_len);
+  h.val_len = static_cast<uint32_t>(val_len);
+  h.seq = seq;
+  return h;
+}
+
+// A record is header | key | value slot | crc; the value slot may be built
+// from a prefix and the value.
+static uint32_t record_checksum(const WalHeader& h, std::string_view key,
+                                std::string_view prefix, std::string_view value) {
+  uint32_t crc = 0;
+  crc = crc32c_update(crc, reinterpret_cast<const uint8_t*>(&h), sizeof(h));
+  crc = crc32c_update(crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
+  crc = crc32c_update(crc, reinterpret_cast<const uint8_t*>(prefix.data()), prefix.size());
+  crc = crc32c_update(crc, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+  return crc;
+}
+
+static bool has_value_slot(uint8_t type) {
+  return type != static_cast<uint8_t>(Wal::Type::Del) &&
+         type != static_cast<uint8_t>(Wal::Type::Expire);
+}
+
+static bool is_batch_type(uint8_t type) {
+  return type == static_cast<uint8_t>(Wal::Type::Batch) ||
+         type == static_cast<uint8_t>(Wal::Type::BatchLz4);
+}
+
+static std::size_t record_size(const WalHeader& h) {
+  return sizeof(WalHeader) + (is_batch_type(h.type) ? 0 : h.key_len) +
+         (has_value_slot(h.type) ? h.val_len : 0) + sizeof(uint32_t);
+}
+
+// Highest sequence number a record carries.
+static uint64_t last_seq_of(const WalHeader& h) {
+  return is_batch_type(h.type) ? h.seq + h.key_len - 1 : h.seq;
+}
+
+// The WriteBatch payload in a batch record's value slot, decompressed into
+// `scratch` for BATCH_LZ4. False if it does not decode.
+static bool batch_payload(uint8_t type, std::string_view slot, std::string& scratch,
+                          std::string_view& payload) {
+  if (type != static_cast<uint8_t>(Wal::Type::BatchLz4)) {
+    payload = slot;
+    return true;
+  }
+  uint32_t raw_len = 0;
+  if (slot.size() < sizeof(raw_len)) return false;
+  std::memcpy(&raw_len, slot.data(), sizeof(raw_len));
+  scratch.clear();
+  if (!lz4_decompress(slot.substr(sizeof(raw_len)), raw_len, scratch)) return false;
+  payload = scratch;
+  return true;
+}
+
+// ---- replay ----
+
+// Replay chunk size: the unit of parallel verification.
+static constexpr uint64_t kReplayChunkBytes = uint64_t{4} << 20;
+static constexpr unsigned kMaxReplayThreads = 16;
+static constexpr uint64_t kNoRecord = ~uint64_t{0};
+
+namespace {
+
+// A log file mapped read-only for replay, cut off at its sealed end.
+struct MappedLog {
+  const char* base = nullptr;
+  uint64_t size = 0;
+
+  MappedLog() = default;
+  MappedLog(const MappedLog&) = delete;
+  MappedLog& operator=(const MappedLog&) = delete;
+  ~MappedLog() {
+    if (base != nullptr) ::munmap(const_cast<char*>(base), size);
+  }
+
+  // A missing file maps as empty.
+  bool map(const std::string& path, uint64_t end) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return errno == ENOENT;
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+    if (end != 0) size = std::min(size, end);
+    if (size == 0) {
+      ::close(fd);
+      return true;
     }
-    inited = true;
+    void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      size = 0;
+      return false;
+    }
+    (void)::madvise(p, size, MADV_SEQUENTIAL);
+    base = static_cast<const char*>(p);
+    return true;
+  }
+};
+
+struct ReplayChunk {
+  std::size_t file;
+  uint64_t begin;  // nominal byte range; a record may run past `end`
+  uint64_t end;
+  uint64_t start = kNoRecord;  // first valid record at or after begin
+  uint64_t stop = 0;           // end of the valid chain from start
+  bool complete = false;       // the chain reached `end`
+};
+
+}  // namespace
+
+// Size of the well-formed, checksum-valid record at `off`; 0 if there is
+// none.
+static std::size_t valid_record_at(const char* base, uint64_t off, uint64_t limit) {
+  if (limit - off < sizeof(WalHeader)) return 0;
+  WalHeader h{};
+  std::memcpy(&h, base + off, sizeof(h));
+  // A v1 log keeps its records after an upgrade; new ones are appended as
+  // v2, so the version is checked per record.
+  if (h.magic != kMagic || (h.version != kVersion && h.version != kVersionIeee)) return 0;
+  if (h.type < static_cast<uint8_t>(Wal::Type::Put) ||
+      h.type > static_cast<uint8_t>(Wal::Type::BatchLz4)) {
+    return 0;
   }
+  const std::size_t n = record_size(h);
+  if (n > limit - off) return 0;
 
-  crc = ~crc;
-  for (size_t i = 0; i < n; ++i) crc = table[(crc ^ data[i]) & 0xFFu] ^ (crc >> 8);
-  return ~crc;
+  // Key and value are contiguous, so one pass covers both.
+  uint32_t crc = record_crc(h.version, 0, &h, sizeof(h));
+  crc = record_crc(h.version, crc, base + off + sizeof(h), n - sizeof(h) - sizeof(uint32_t));
+  uint32_t stored_crc = 0;
+  std::memcpy(&stored_crc, base + off + n - sizeof(uint32_t), sizeof(stored_crc));
+  return crc == stored_crc ? n : 0;
 }
 
-static bool write_all(int fd, const void* buf, size_t n) {
-  const uint8_t* p = static_cast<const uint8_t*>(buf);
-  while (n > 0) {
-    ssize_t w = ::write(fd, p, n);
-    if (w < 0) {
-      if (errno == EINTR) continue;
+// Follows valid records from `from` until one starts at or after `to`.
+// False if a bad record ends the chain first; `*stop` is where it ended.
+static bool verify_chain(const char* base, uint64_t from, uint64_t to, uint64_t limit,
+                         uint64_t* stop) {
+  uint64_t off = from;
+  while (off < to) {
+    const std::size_t n = valid_record_at(base, off, limit);
+    if (n == 0) {
+      *stop = off;
       return false;
     }
-    p += static_cast<size_t>(w);
-    n -= static_cast<size_t>(w);
+    off += n;
   }
+  *stop = off;
   return true;
 }
 
-static bool read_exact(int fd, void* buf, size_t n) {
-  uint8_t* p = static_cast<uint8_t*>(buf);
-  size_t got = 0;
-  while (got < n) {
-    ssize_t r = ::read(fd, p + got, n - got);
-    if (r < 0) {
-      if (errno == EINTR) continue;
+static void verify_chunk(const MappedLog& log, ReplayChunk& c) {
+  uint64_t off = c.begin;
+  if (off != 0) {
+    // Resynchronize: the first magic that starts a valid record. A false
+    // match inside a value is caught when the chains are stitched.
+    const char first = static_cast<char>(kMagic & 0xFFu);
+    for (;; ++off) {
+      const void* hit = off < c.end ? std::memchr(log.base + off, first, c.end - off) : nullptr;
+      if (hit == nullptr) return;
+      off = static_cast<uint64_t>(static_cast<const char*>(hit) - log.base);
+      if (valid_record_at(log.base, off, log.size) != 0) break;
+    }
+  }
+  c.start = off;
+  c.complete = verify_chain(log.base, off, c.end, log.size, &c.stop);
+}
+
+Wal::~Wal() {
+  // Whatever is still queued is written before the thread exits.
+  stop_writer();
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool Wal::open(const std::string& path, std::size_t segment_bytes, IoBackend::Kind io,
+               bool direct_io) {
+  std::lock_guard lock(io_mu_);
+  path_ = path;
+  dir_ = path + ".seg";
+  segment_bytes_ = segment_bytes == 0 ? kDefaultSegmentBytes : segment_bytes;
+  io_ = IoBackend::create(io);
+  pinned_[0] = pinned_[1] = nullptr;
+  pinned_bytes_[0] = pinned_bytes_[1] = 0;
+#ifdef O_DIRECT
+  direct_io_ = direct_io;
+#else
+  if (direct_io) std::cerr << "[wal] O_DIRECT is not available; using buffered writes\n";
+  direct_io_ = false;
+#endif
+  if (direct_io_) {
+    // Whole blocks: segment ends stay aligned however the groups fall.
+    segment_bytes_ = (segment_bytes_ + kDirectBlock - 1) / kDirectBlock * kDirectBlock;
+  }
+  live_.clear();
+  free_.clear();
+  legacy_.clear();
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) return false;
+
+  checkpoint_ = Checkpoint{};
+  bool has_manifest = false;
+  std::ifstream in(dir_ + "/MANIFEST");
+  if (in) {
+    std::string line;
+    if (!std::getline(in, line) ||
+        (line != "KVWALMANIFEST 1" && line != "KVWALMANIFEST 2")) {
       return false;
     }
-    if (r == 0) return false; // EOF mid-read
-    got += static_cast<size_t>(r);
+    has_manifest = true;
+    checkpoint_recorded_ = line != "KVWALMANIFEST 1";
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string tag;
+      fields >> tag;
+      if (tag == "next_segment") {
+        fields >> next_segment_;
+      } else if (tag == "segment") {
+        Segment seg{};
+        fields >> seg.number >> seg.floor_seq >> seg.end;
+        live_.push_back(seg);
+      } else if (tag == "checkpoint") {
+        // The path is the rest of the line.
+        fields >> checkpoint_.seq;
+        fields.get();
+        std::getline(fields, checkpoint_.snapshot_path);
+      }
+    }
   }
+
+  // Files the MANIFEST does not list are left over from a rollover or
+  // release that did not finish; recycle them. Free files smaller than a
+  // segment were still being prepared.
+  for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+    const std::string name = entry.path().filename().string();
+    unsigned long long number = 0;
+    char tail = 0;
+    const bool is_free = std::sscanf(name.c_str(), "free-%llu.lo%c", &number, &tail) == 2;
+    if (!is_free && std::sscanf(name.c_str(), "%llu.lo%c", &number, &tail) != 2) continue;
+    if (tail != 'g') continue;
+    next_segment_ = std::max<uint64_t>(next_segment_, number + 1);
+    if (!is_free) {
+      const bool listed = std::any_of(live_.begin(), live_.end(),
+                                      [&](const Segment& s) { return s.number == number; });
+      if (!listed) release_file_locked(number);
+    } else if (entry.file_size(ec) < segment_bytes_ || free_.size() >= kMaxFreeSegments) {
+      std::filesystem::remove(entry.path(), ec);
+    } else {
+      free_.push_back(number);
+    }
+  }
+  if (ec) return false;
+
+  for (const std::string& legacy : {path + ".old", path}) {
+    if (std::filesystem::is_regular_file(legacy, ec)) legacy_.push_back(legacy);
+  }
+  if (!has_manifest) checkpoint_recorded_ = legacy_.empty();
   return true;
 }
 
-#pragma pack(push, 1)
-struct WalHeader {
-  uint32_t magic;     // 'KVLG'
-  uint16_t version;   // 1
-  uint8_t  type;      // 1=PUT,2=DEL
-  uint32_t key_len;
-  uint32_t val_len;   // 0 for DEL
-  uint64_t seq;
-};
-#pragma pack(pop)
+Wal::Checkpoint Wal::checkpoint() {
+  std::lock_guard io(io_mu_);
+  return checkpoint_;
+}
 
-static constexpr uint32_t kMagic = 0x474C564Bu;   // 'K''V''L''G'
-static constexpr uint16_t kVersion = 1;
+void Wal::set_checkpoint(const Checkpoint& checkpoint) {
+  std::lock_guard io(io_mu_);
+  checkpoint_ = checkpoint;
+}
 
-Wal::~Wal() {
+std::string Wal::segment_path(uint64_t number) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%06llu.log", static_cast<unsigned long long>(number));
+  return dir_ + "/" + name;
+}
+
+std::string Wal::free_path(uint64_t number) const {
+  char name[40];
+  std::snprintf(name, sizeof(name), "free-%06llu.log", static_cast<unsigned long long>(number));
+  return dir_ + "/" + name;
+}
+
+// Caller holds io_mu_.
+bool Wal::write_manifest_locked() {
+  std::ostringstream out;
+  out << "KVWALMANIFEST 2\n"
+      << "next_segment " << next_segment_ << "\n";
+  for (const Segment& seg : live_) {
+    out << "segment " << seg.number << ' ' << seg.floor_seq << ' ' << seg.end << "\n";
+  }
+  if (!checkpoint_.snapshot_path.empty()) {
+    out << "checkpoint " << checkpoint_.seq << ' ' << checkpoint_.snapshot_path << "\n";
+  }
+  const std::string data = out.str();
+
+  const std::string path = dir_ + "/MANIFEST";
+  const std::string tmp = path + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) return false;
+  bool ok = pwrite_all(fd, data.data(), data.size(), 0);
+  ok = ok && ::fsync(fd) == 0;
+  ::close(fd);
+  if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) return false;
+  return sync_dir(dir_);
+}
+
+// Caller holds io_mu_.
+bool Wal::roll_over_locked(uint64_t floor_seq) {
+  // A sealed segment is always synced: replay trusts its recorded end.
+  if (unsynced_) {
+    if (!io_->sync(fd_)) return false;
+    unsynced_ = false;
+  }
+  const uint64_t number = next_segment_++;
+  const std::string path = segment_path(number);
+  bool recycled = false;
+  if (!free_.empty()) {
+    recycled = std::rename(free_path(free_.back()).c_str(), path.c_str()) == 0;
+    if (recycled) free_.pop_back();
+  }
+  if (!recycled && !create_segment_file(path, segment_bytes_)) return false;
+  spare_needed_.store(free_.empty(), std::memory_order_relaxed);
+
+  int fd = ::open(path.c_str(), O_RDWR | (direct_io_ ? kODirect : 0));
+  if (fd < 0 && direct_io_ && errno == EINVAL) {
+    // tmpfs and some network filesystems refuse O_DIRECT.
+    std::cerr << "[wal] O_DIRECT refused for " << dir_ << "; using buffered writes\n";
+    direct_io_ = false;
+    fd = ::open(path.c_str(), O_RDWR);
+  }
+  if (fd < 0) return false;
+  if (ready_.load(std::memory_order_relaxed)) live_.back().end = write_off_;
+  live_.push_back(Segment{number, floor_seq, 0});
+  if (!write_manifest_locked()) {
+    // The file is not listed anywhere durable; the next open recycles it.
+    live_.pop_back();
+    if (ready_.load(std::memory_order_relaxed)) live_.back().end = 0;
+    ::close(fd);
+    return false;
+  }
   if (fd_ >= 0) ::close(fd_);
+  fd_ = fd;
+  write_off_ = 0;
+  tail_len_ = 0;
+  ready_.store(true, std::memory_order_release);
+  return true;
 }
 
-bool Wal::open(const std::string& path) {
-  path_ = path;
-  fd_ = ::open(path.c_str(), O_CREAT | O_RDWR, 0644);
-  if (fd_ < 0) return false;
-  if (::lseek(fd_, 0, SEEK_END) < 0) return false;
-  last_good_offset_ = 0;
+// Caller holds io_mu_.
+void Wal::release_file_locked(uint64_t number, std::vector<std::string>* unlink_later) {
+  const std::string path = segment_path(number);
+  // Compaction output is only as long as its records: too short to reuse.
+  std::error_code ec;
+  const bool full_size = std::filesystem::file_size(path, ec) >= segment_bytes_ && !ec;
+  if (full_size && free_.size() < kMaxFreeSegments &&
+      std::rename(path.c_str(), free_path(number).c_str()) == 0) {
+    free_.push_back(number);
+    spare_needed_.store(false, std::memory_order_relaxed);
+  } else if (unlink_later != nullptr) {
+    unlink_later->push_back(path);
+  } else {
+    std::remove(path.c_str());
+  }
+}
+
+void Wal::prepare_spare() {
+  uint64_t number = 0;
+  std::size_t bytes = 0;
+  std::string path;
+  {
+    std::lock_guard io(io_mu_);
+    if (!free_.empty()) return;
+    number = next_segment_++;
+    bytes = segment_bytes_;
+    path = free_path(number);
+  }
+  // The zero fill runs without io_mu_, so groups keep committing meanwhile.
+  if (!create_segment_file(path, bytes)) return;
+  std::lock_guard io(io_mu_);
+  free_.push_back(number);
+  spare_needed_.store(false, std::memory_order_relaxed);
+}
+
+void Wal::rotate_after(uint64_t seq) {
+  rotate_after_.store(seq, std::memory_order_release);
+}
+
+uint64_t Wal::finish_rotation() {
+  std::lock_guard io(io_mu_);
+  if (rotate_after_.load(std::memory_order_relaxed) != kNoRotation) {
+    // Everything written so far is at or below the rotation seq. An empty
+    // active segment already starts after it.
+    if (!ready_.load(std::memory_order_relaxed)) return 0;
+    if (write_off_ != 0 && !roll_over_locked(written_seq_)) return 0;
+    rotated_to_ = live_.back().number;
+    rotate_after_.store(kNoRotation, std::memory_order_relaxed);
+  }
+  return rotated_to_;
+}
+
+bool Wal::release_before(uint64_t segment, const Checkpoint* checkpoint) {
+  // Unlinking a segment can take a while; the writer does not wait for it.
+  std::vector<std::string> unlink_later;
+  std::unique_lock io(io_mu_);
+  const Checkpoint previous = checkpoint_;
+  if (checkpoint != nullptr) checkpoint_ = *checkpoint;
+  // By position: a compacted segment carries a newer number than the
+  // segments that follow it.
+  const auto it = std::find_if(live_.begin(), live_.end(),
+                               [&](const Segment& seg) { return seg.number == segment; });
+  std::vector<uint64_t> released;
+  std::vector<Segment> kept;
+  for (const Segment& seg : live_) {
+    const bool active = &seg == &live_.back() && ready_.load(std::memory_order_relaxed);
+    const bool ahead = it != live_.end() ? &seg < &*it : seg.number < segment;
+    if (ahead && !active) {
+      released.push_back(seg.number);
+    } else {
+      kept.push_back(seg);
+    }
+  }
+  if (released.empty() && legacy_.empty()) {
+    if (checkpoint == nullptr || write_manifest_locked()) return true;
+    checkpoint_ = previous;
+    return false;
+  }
+  live_.swap(kept);
+  if (!write_manifest_locked()) {
+    live_.swap(kept);
+    checkpoint_ = previous;
+    return false;
+  }
+  for (uint64_t number : released) release_file_locked(number, &unlink_later);
+  unlink_later.insert(unlink_later.end(), legacy_.begin(), legacy_.end());
+  legacy_.clear();
+  io.unlock();
+  for (const std::string& path : unlink_later) std::remove(path.c_str());
   return true;
 }
 
@@ -100,162 +551,751 @@ bool Wal::append_del(uint64_t seq, std::string_view key) {
   return write_record(Type::Del, seq, key, {});
 }
 
-bool Wal::write_record(Type t, uint64_t seq, std::string_view key, std::string_view value) {
-  if (fd_ < 0) return false;
+bool Wal::append_put_ref(uint64_t seq, std::string_view key, std::string_view encoded_pointer) {
+  return write_record(Type::PutRef, seq, key, encoded_pointer);
+}
 
-  WalHeader h{};
-  h.magic = kMagic;
-  h.version = kVersion;
-  h.type = static_cast<uint8_t>(t);
-  h.key_len = static_cast<uint32_t>(key.size());
-  h.val_len = static_cast<uint32_t>(value.size());
-  h.seq = seq;
+bool Wal::append_put_ttl(uint64_t seq, std::string_view key, std::string_view value,
+                         bool value_ref, uint64_t expires_at) {
+  char prefix[kTtlPrefix];
+  std::memcpy(prefix, &expires_at, sizeof(expires_at));
+  prefix[8] = value_ref ? 1 : 0;
+  return write_record(Type::PutTtl, seq, key, value, 0, std::string_view(prefix, kTtlPrefix));
+}
 
-  uint32_t crc = 0;
-  crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(&h), sizeof(h));
-  crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
-  if (t == Type::Put) {
-    crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+bool Wal::append_expire(uint64_t seq, std::string_view key) {
+  return write_record(Type::Expire, seq, key, {});
+}
+
+bool Wal::append_batch(uint64_t first_seq, uint32_t count, std::string_view payload) {
+  // The payload travels in the value slot; key_len carries the op count.
+  if (compression_ == Options::Compression::kLz4 && payload.size() >= kMinCompressBytes) {
+    std::string packed;
+    if (lz4_compress(payload, packed)) {
+      const auto raw_len = static_cast<uint32_t>(payload.size());
+      return write_record(Type::BatchLz4, first_seq, {}, packed, count,
+                          std::string_view(reinterpret_cast<const char*>(&raw_len),
+                                           sizeof(raw_len)));
+    }
   }
+  return write_record(Type::Batch, first_seq, {}, payload, count);
+}
 
-  // Serialize into a contiguous buffer
-  const size_t total =
-      sizeof(WalHeader) +
-      key.size() +
-      (t == Type::Put ? value.size() : 0) +
-      sizeof(uint32_t);
+bool Wal::write_record(Type t, uint64_t seq, std::string_view key, std::string_view value,
+                       uint32_t batch_count, std::string_view prefix) {
+  if (!ready_.load(std::memory_order_acquire)) return false;
 
-  std::string rec;
-  rec.resize(total);
+  const bool has_value = has_value_slot(static_cast<uint8_t>(t));
+  if (!has_value) {
+    value = {};
+    prefix = {};
+  }
 
-  char* p = rec.data();
-  std::memcpy(p, &h, sizeof(h));
-  p += sizeof(h);
+  const WalHeader h = make_header(t, seq,
+                                  is_batch_type(static_cast<uint8_t>(t)) ? batch_count : key.size(),
+                                  prefix.size() + value.size());
+  const uint32_t crc = record_checksum(h, key, prefix, value);
 
-  if (!key.empty()) {
-    std::memcpy(p, key.data(), key.size());
-    p += key.size();
+  // v0.4: buffer record, do not fsync here (v0.9: the writer thread does).
+  // Serialized straight into the arena: no per-record allocation.
+  bool wake = false;
+  {
+    std::unique_lock lock(mu_);
+    if (!writer_.joinable()) {
+      buffer_.reserve(kArenaBytes);
+      writer_ = std::thread([this] { writer_loop(); });
+    }
+    if (buffer_.size() >= kMaxQueuedBytes) {
+      writeback_ = true;
+      if (writer_idle_) work_cv_.notify_one();
+      done_cv_.wait(lock, [&] { return stop_ || buffer_.size() < kMaxQueuedBytes; });
+    }
+    buffer_.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    buffer_.append(key);
+    buffer_.append(prefix);
+    buffer_.append(value);
+    buffer_.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    ++buffered_;
+    appended_.fetch_add(1, std::memory_order_relaxed);
+    // Otherwise the writer is woken by whoever needs the record durable.
+    wake = gathering_ && buffered_ >= group_target_;
   }
-  if (t == Type::Put && !value.empty()) {
-    std::memcpy(p, value.data(), value.size());
-    p += value.size();
+  if (wake) work_cv_.notify_one();
+  return true;
+}
+
+void Wal::sync_within(std::chrono::microseconds d) {
+  const auto at = std::chrono::steady_clock::now() + d;
+  bool wake = false;
+  {
+    std::lock_guard lock(mu_);
+    if (at >= deadline_) return;
+    deadline_ = at;
+    wake = writer_idle_;
   }
+  if (wake) work_cv_.notify_one();
+}
 
-  std::memcpy(p, &crc, sizeof(crc));
+void Wal::write_back_soon() {
+  bool wake = false;
+  {
+    std::lock_guard lock(mu_);
+    if (writeback_) return;
+    writeback_ = true;
+    wake = writer_idle_;
+  }
+  if (wake) work_cv_.notify_one();
+}
 
-  // v0.4: buffer record, do not fsync here
-  buffer_.push_back(std::move(rec));
-  return true;
+void Wal::set_max_group_delay(std::chrono::microseconds delay) {
+  std::lock_guard lock(mu_);
+  max_group_delay_ = delay;
+}
+
+void Wal::set_before_write(std::function<bool()> fn) {
+  std::lock_guard io(io_mu_);
+  before_write_ = std::move(fn);
+}
+
+void Wal::writer_loop() {
+  std::string group;  // the second arena: written while writers fill buffer_
+  group.reserve(kArenaBytes);
+  // Something is owed: a waiter, a due deadline, or records to hand over.
+  auto due = [&] {
+    return stop_ || wanted_ > durable_ || (writeback_ && !buffer_.empty()) ||
+           (deadline_ != kNoDeadline && std::chrono::steady_clock::now() >= deadline_);
+  };
+  std::unique_lock lock(mu_);
+  for (;;) {
+    writer_idle_ = true;
+    while (!due()) {
+      if (deadline_ == kNoDeadline) {
+        work_cv_.wait(lock);
+      } else {
+        work_cv_.wait_until(lock, deadline_);
+      }
+    }
+    // Under concurrent load, let the group grow to its recent size (bounded
+    // by max_group_delay_) before paying for the fsync. A lone writer has
+    // groups of one and never waits here.
+    if (!stop_ && !flush_requested_ && wanted_ > durable_ && buffered_ < group_target_) {
+      gathering_ = true;
+      work_cv_.wait_for(lock, max_group_delay_, [&] {
+        return stop_ || flush_requested_ || buffered_ >= group_target_;
+      });
+      gathering_ = false;
+    }
+    writer_idle_ = false;
+    // Only write_back_soon() records and nothing else owed: write them
+    // without the fdatasync.
+    const bool waited_for = wanted_ > durable_;
+    const bool sync = stop_ || waited_for ||
+                      (deadline_ != kNoDeadline && std::chrono::steady_clock::now() >= deadline_);
+    writeback_ = false;
+    if (sync) deadline_ = kNoDeadline;
+    if (buffer_.empty() && (!sync || written_ == durable_)) {
+      if (stop_) return;
+      continue;
+    }
+
+    group.swap(buffer_);
+    const std::size_t records = buffered_;
+    buffered_ = 0;
+    flush_requested_ = false;
+    lock.unlock();
+    bool ok = false;
+    std::size_t done_bytes = 0;
+    std::size_t done_records = 0;
+    {
+      std::lock_guard io(io_mu_);
+      if (!direct_io_) pin_arena_locked(group);
+      ok = write_group_locked(group, sync, &done_bytes, &done_records);
+    }
+    lock.lock();
+    written_ += done_records;
+    // Every chunk is synced on its own, which covers what earlier groups
+    // left unsynced in the same segment (older segments are synced when
+    // sealed).
+    if (sync && (ok || done_records > 0)) durable_ = written_;
+
+    if (ok) {
+      // Only groups that writers wait on say how large a group is worth
+      // holding open for.
+      if (waited_for && records > 0) {
+        group_target_ = std::max<std::size_t>(1, (3 * group_target_ + records) / 4);
+      }
+      if (group.capacity() > kArenaRetain) {
+        std::string().swap(group);
+        group.reserve(kArenaBytes);
+      }
+      group.clear();
+      done_cv_.notify_all();
+      if (spare_needed_.load(std::memory_order_relaxed)) {
+        lock.unlock();
+        prepare_spare();
+        lock.lock();
+      }
+      continue;
+    }
+    // Requeue the unwritten records ahead of newer ones and retry after a
+    // pause.
+    ++failures_;
+    std::cerr << "[wal] group write failed: " << path_ << "\n";
+    group.erase(0, done_bytes);
+    group.append(buffer_);
+    buffer_.swap(group);
+    buffered_ += records - done_records;
+    group.clear();
+    if (sync) {
+      deadline_ = std::chrono::steady_clock::now();
+    } else {
+      writeback_ = true;
+    }
+    done_cv_.notify_all();
+    if (work_cv_.wait_for(lock, std::chrono::milliseconds(10), [&] { return stop_; })) return;
+  }
 }
-//rebuilds the in-memory KV store from the WAL file during recovery.
-bool Wal::replay_into(KVStore& store, uint64_t& max_seq) {
+
+bool Wal::write_group_locked(std::string_view group, bool sync, std::size_t* done_bytes,
+                             std::size_t* done_records) {
   if (fd_ < 0) return false;
+  // Records about to become durable may point into the value log.
+  if (sync && before_write_ && !before_write_()) return false;
+  if (group.empty()) {
+    if (!unsynced_) return true;
+    if (!io_->sync(fd_)) return false;
+    unsynced_ = false;
+    return true;
+  }
+  std::size_t pos = 0;
+  while (pos < group.size()) {
+    // Whole records that fit the active segment; one that is larger than a
+    // whole segment gets an empty segment to itself and extends it.
+    const uint64_t room = write_off_ < segment_bytes_ ? segment_bytes_ - write_off_ : 0;
+    std::size_t take = 0;
+    std::size_t count = 0;
+    uint64_t last_seq = written_seq_;
+    const uint64_t rotate_after = rotate_after_.load(std::memory_order_acquire);
+    bool rotate = false;
+    while (pos + take < group.size()) {
+      WalHeader h{};
+      std::memcpy(&h, group.data() + pos + take, sizeof(h));
+      const std::size_t n = record_size(h);
+      if (h.seq > rotate_after) {
+        rotate = true;
+        break;
+      }
+      if (take + n > room && !(take == 0 && write_off_ == 0)) break;
+      take += n;
+      ++count;
+      last_seq = last_seq_of(h);
+    }
+    if (take == 0) {
+      if (rotate && write_off_ == 0) {
+        // Already in a fresh segment.
+      } else if (!roll_over_locked(written_seq_)) {
+        return false;
+      }
+      if (rotate) {
+        rotated_to_ = live_.back().number;
+        rotate_after_.store(kNoRotation, std::memory_order_relaxed);
+      }
+      continue;
+    }
+    if (!write_out_locked(group.data() + pos, take, sync)) return false;
+    write_off_ += take;
+    written_seq_ = last_seq;
+    pos += take;
+    *done_bytes = pos;
+    *done_records += count;
+  }
+  return true;
+}
 
-  if (::lseek(fd_, 0, SEEK_SET) < 0) return false;
+// Caller holds io_mu_.
+bool Wal::write_out_locked(const char* data, std::size_t n, bool sync) {
+  if (!direct_io_) {
+    if (sync) {
+      if (!io_->write_sync(fd_, data, n, write_off_)) return false;
+    } else {
+      if (!io_->write(fd_, data, n, write_off_)) return false;
+      io_->start_writeback(fd_, write_off_, n);
+    }
+    unsynced_ = !sync;
+    return true;
+  }
+  // O_DIRECT takes whole aligned blocks only: the segment's partial last
+  // block, kept at the front of the staging buffer, is written again ahead
+  // of the new records, and the rest of the final block is zero padded.
+  const std::size_t used = tail_len_ + n;
+  const std::size_t bytes = (used + kDirectBlock - 1) / kDirectBlock * kDirectBlock;
+  if (bytes > direct_bytes_) {
+    const std::size_t grown = std::max(bytes, 2 * direct_bytes_);
+    std::unique_ptr<char, void (*)(void*)> buf(
+        static_cast<char*>(std::aligned_alloc(kDirectBlock, grown)), std::free);
+    if (!buf) return false;
+    if (tail_len_ > 0) std::memcpy(buf.get(), direct_buf_.get(), tail_len_);
+    direct_buf_ = std::move(buf);
+    direct_bytes_ = grown;
+    io_->register_buffer(0, direct_buf_.get(), direct_bytes_);
+  }
+  char* buf = direct_buf_.get();
+  std::memcpy(buf + tail_len_, data, n);
+  std::memset(buf + used, 0, bytes - used);
+  const uint64_t at = write_off_ - tail_len_;
+  if (!(sync ? io_->write_sync(fd_, buf, bytes, at) : io_->write(fd_, buf, bytes, at))) {
+    return false;
+  }
+  unsynced_ = !sync;
+  const std::size_t keep = used % kDirectBlock;
+  std::memmove(buf, buf + used - keep, keep);
+  tail_len_ = keep;
+  return true;
+}
 
-  uint64_t last_good = 0;
-  max_seq = 0;
-  int applied = 0;
+// Caller holds io_mu_.
+void Wal::pin_arena_locked(const std::string& arena) {
+  for (unsigned i = 0; i < 2; ++i) {
+    if (pinned_[i] == arena.data() && pinned_bytes_[i] == arena.capacity()) return;
+  }
+  // Two arenas alternate; a reallocated one replaces the older registration.
+  const unsigned slot = next_pin_;
+  next_pin_ ^= 1;
+  pinned_[slot] = arena.data();
+  pinned_bytes_[slot] = arena.capacity();
+  io_->register_buffer(slot, arena.data(), arena.capacity());
+}
 
-  
+uint64_t Wal::sealed_bytes() {
+  std::lock_guard io(io_mu_);
+  if (!ready_.load(std::memory_order_relaxed)) return 0;
+  uint64_t bytes = 0;
+  for (std::size_t i = 0; i + 1 < live_.size(); ++i) bytes += live_[i].end;
+  return bytes;
+}
 
-  for (;;) {
-    WalHeader h{};
+uint64_t Wal::log_bytes() {
+  std::lock_guard io(io_mu_);
+  uint64_t bytes = ready_.load(std::memory_order_relaxed) ? write_off_ : 0;
+  for (const Segment& seg : live_) bytes += seg.end;
+  return bytes;
+}
 
-    
+bool Wal::compact(const LiveFn& live, CompactStats* stats) {
+  const auto started = std::chrono::steady_clock::now();
+  CompactStats st;
+  std::vector<Segment> inputs;
+  uint64_t number = 0;
+  {
+    std::lock_guard io(io_mu_);
+    if (!ready_.load(std::memory_order_relaxed)) return false;
+    if (live_.size() < 2) {
+      if (stats != nullptr) *stats = st;
+      return true;
+    }
+    inputs.assign(live_.begin(), live_.end() - 1);
+    number = next_segment_++;
+  }
 
-    ssize_t r = ::read(fd_, &h, sizeof(h));
-    if (r == 0) break;                         // clean EOF
-    if (r < 0) { if (errno == EINTR) continue; break; }
-    if (static_cast<size_t>(r) != sizeof(h)) break; // truncated header
+  // Sealed segments never change, so they are read without io_mu_.
+  std::vector<std::unique_ptr<MappedLog>> logs;
+  for (const Segment& seg : inputs) {
+    auto log = std::make_unique<MappedLog>();
+    uint64_t stop = 0;
+    if (!log->map(segment_path(seg.number), seg.end) || log->size != seg.end ||
+        !verify_chain(log->base, 0, log->size, log->size, &stop)) {
+      // Replay cuts the log at the damage; compaction must not paper over it.
+      std::cerr << "[wal] not compacting: " << segment_path(seg.number) << " is damaged\n";
+      return false;
+    }
+    st.bytes_in += seg.end;
+    logs.push_back(std::move(log));
+  }
+  st.segments = inputs.size();
 
-    if (h.magic != kMagic || h.version != kVersion) break;
-    if (h.type != static_cast<uint8_t>(Type::Put) && h.type != static_cast<uint8_t>(Type::Del)) break;
+  // fn(type, seq, key, value slot, record bytes) for every operation in log
+  // order, with the same stopping rules as replay. Batch operations come
+  // one by one, without record bytes.
+  std::string unpacked;
+  auto for_each_op = [&](auto&& fn) {
+    for (std::size_t i = 0; i < logs.size(); ++i) {
+      const char* base = logs[i]->base;
+      for (uint64_t off = 0; off < logs[i]->size;) {
+        WalHeader h{};
+        std::memcpy(&h, base + off, sizeof(h));
+        const std::size_t n = record_size(h);
+        const bool is_batch = is_batch_type(h.type);
+        const std::string_view key(base + off + sizeof(h), is_batch ? 0 : h.key_len);
+        const std::string_view val(key.data() + key.size(),
+                                   has_value_slot(h.type) ? h.val_len : 0);
+        if (h.seq <= inputs[i].floor_seq) break;
+        if (is_batch) {
+          std::string_view payload;
+          if (!batch_payload(h.type, val, unpacked, payload) || h.key_len == 0 ||
+              WriteBatch::count_in(payload) != h.key_len) {
+            break;
+          }
+          uint64_t s = h.seq;
+          WriteBatch::for_each_in(payload, [&](WriteBatch::OpType op, std::string_view k,
+                                           std::string_view v) {
+            const Type t = op == WriteBatch::OpType::Put      ? Type::Put
+                           : op == WriteBatch::OpType::PutRef ? Type::PutRef
+                                                              : Type::Del;
+            fn(t, s++, k, v, std::string_view());
+          });
+        } else {
+          fn(static_cast<Type>(h.type), static_cast<uint64_t>(h.seq), key, val,
+             std::string_view(base + off, n));
+        }
+        off += n;
+      }
+    }
+  };
+  auto is_delete = [](Type t) { return t == Type::Del || t == Type::Expire; };
 
-    std::string key(h.key_len, '\0');
-    std::string val(h.val_len, '\0');
+  // Pass 1: the newest live delete of each key; older ones are redundant.
+  std::unordered_map<std::string, uint64_t> last_delete;
+  for_each_op([&](Type t, uint64_t seq, std::string_view key, std::string_view,
+                  std::string_view) {
+    if (is_delete(t) && live(key, seq, true)) last_delete[std::string(key)] = seq;
+  });
 
-    if (h.key_len && !read_exact(fd_, key.data(), key.size())) break;
-    if (h.type == static_cast<uint8_t>(Type::Put) && h.val_len && !read_exact(fd_, val.data(), val.size())) break;
+  // Pass 2: write the survivors, v2 records copied as they are.
+  const std::string path = segment_path(number);
+  const int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) return false;
+  std::string out;
+  out.reserve(kArenaBytes);
+  bool ok = true;
+  auto spill = [&] {
+    ok = ok && pwrite_all(fd, out.data(), out.size(), st.bytes_out);
+    st.bytes_out += out.size();
+    out.clear();
+  };
+  std::string key_buf;
+  for_each_op([&](Type t, uint64_t seq, std::string_view key, std::string_view value,
+                  std::string_view raw) {
+    ++st.records_in;
+    if (is_delete(t)) {
+      key_buf.assign(key);
+      const auto it = last_delete.find(key_buf);
+      if (it == last_delete.end() || it->second != seq) return;
+    } else if (!live(key, seq, false)) {
+      return;
+    }
+    ++st.records_out;
+    WalHeader h{};
+    if (!raw.empty()) std::memcpy(&h, raw.data(), sizeof(h));
+    if (!raw.empty() && h.version == kVersion) {
+      out.append(raw);
+    } else {
+      h = make_header(t, seq, key.size(), value.size());
+      const uint32_t crc = record_checksum(h, key, {}, value);
+      out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+      out.append(key);
+      out.append(value);
+      out.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    }
+    if (out.size() >= kArenaBytes) spill();
+  });
+  spill();
+  ok = ok && ::fsync(fd) == 0;
+  ::close(fd);
+  logs.clear();
 
-    uint32_t stored_crc = 0;
-    if (!read_exact(fd_, &stored_crc, sizeof(stored_crc))) break;
+  // The records that superseded the dropped ones must be durable before
+  // the segments holding the older ones go.
+  ok = ok && sync_dir(dir_) && flush();
+  std::vector<std::string> unlink_later;
+  if (ok) {
+    std::lock_guard io(io_mu_);
+    ok = live_.size() > inputs.size();
+    for (std::size_t i = 0; ok && i < inputs.size(); ++i) {
+      ok = live_[i].number == inputs[i].number;
+    }
+    std::vector<Segment> next;
+    if (st.records_out > 0) next.push_back(Segment{number, inputs.front().floor_seq, st.bytes_out});
+    if (ok) {
+      next.insert(next.end(), live_.begin() + static_cast<std::ptrdiff_t>(inputs.size()),
+                  live_.end());
+      live_.swap(next);
+      ok = write_manifest_locked();
+      if (!ok) live_.swap(next);
+    }
+    if (ok) {
+      for (const Segment& seg : inputs) release_file_locked(seg.number, &unlink_later);
+    }
+  }
+  const double ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  for (const std::string& old : unlink_later) std::remove(old.c_str());
+  if (!ok || st.records_out == 0) std::remove(path.c_str());
+  if (!ok) return false;
 
-    uint32_t crc = 0;
-    crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(&h), sizeof(h));
-    crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
-    if (h.type == static_cast<uint8_t>(Type::Put)) {
-      crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(val.data()), val.size());
+  std::cerr << "[wal] compacted " << st.segments << " segment(s): " << st.bytes_in / 1e6
+            << " MB -> " << st.bytes_out / 1e6 << " MB, kept " << st.records_out << " of "
+            << st.records_in << " records in " << ms << " ms\n";
+  if (stats != nullptr) *stats = st;
+  return true;
+}
+
+bool Wal::wait_durable(uint64_t lsn) {
+  std::unique_lock lock(mu_);
+  if (durable_ >= lsn) return true;
+  if (lsn > wanted_) {
+    wanted_ = lsn;
+    if (writer_idle_) work_cv_.notify_one();
+  }
+  const uint64_t failures = failures_;
+  done_cv_.wait(lock, [&] { return durable_ >= lsn || failures_ != failures || stop_; });
+  return durable_ >= lsn;
+}
+
+void Wal::stop_writer() {
+  {
+    std::lock_guard lock(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  if (writer_.joinable()) writer_.join();
+}
+//rebuilds the in-memory KV store from the WAL segments during recovery.
+bool Wal::replay_into(KVStore& store, uint64_t& max_seq, uint64_t skip_through) {
+  std::lock_guard io(io_mu_);
+  if (dir_.empty() || ready_.load(std::memory_order_relaxed)) return false;
+  max_seq = 0;
+  const auto started = std::chrono::steady_clock::now();
+
+  // Legacy single-file logs first, then the live segments. A sealed segment
+  // is skipped unread when the next one's floor shows that every record in
+  // it is <= skip_through.
+  std::vector<std::unique_ptr<MappedLog>> logs;
+  std::vector<char> skipped(legacy_.size() + live_.size(), 0);
+  for (std::size_t f = 0; f < legacy_.size() + live_.size(); ++f) {
+    const bool legacy = f < legacy_.size();
+    const std::size_t i = f - legacy_.size();
+    auto log = std::make_unique<MappedLog>();
+    skipped[f] = !legacy && i + 1 < live_.size() && live_[i + 1].floor_seq <= skip_through;
+    if (!skipped[f]) {
+      const std::string path = legacy ? legacy_[f] : segment_path(live_[i].number);
+      if (!log->map(path, legacy ? 0 : live_[i].end)) return false;
     }
+    logs.push_back(std::move(log));
+  }
 
-   
+  std::vector<ReplayChunk> chunks;
+  for (std::size_t f = 0; f < logs.size(); ++f) {
+    for (uint64_t off = 0; off < logs[f]->size; off += kReplayChunkBytes) {
+      chunks.push_back(ReplayChunk{f, off, std::min(off + kReplayChunkBytes, logs[f]->size)});
+    }
+  }
 
+  // Workers take chunks in log order, so the apply loop below rarely waits.
+  std::atomic<std::size_t> next{0};
+  std::atomic<bool> cancel{false};
+  std::mutex verified_mu;
+  std::condition_variable verified_cv;
+  std::vector<char> verified(chunks.size(), 0);
+  const unsigned threads = static_cast<unsigned>(std::min<std::size_t>(
+      std::clamp(std::thread::hardware_concurrency(), 1u, kMaxReplayThreads), chunks.size()));
+  std::vector<std::thread> pool;
+  if (threads > 1) {
+    for (unsigned t = 0; t < threads; ++t) {
+      pool.emplace_back([&] {
+        for (;;) {
+          const std::size_t i = next.fetch_add(1);
+          if (i >= chunks.size() || cancel.load(std::memory_order_relaxed)) return;
+          verify_chunk(*logs[chunks[i].file], chunks[i]);
+          {
+            std::lock_guard lock(verified_mu);
+            verified[i] = 1;
+          }
+          verified_cv.notify_all();
+        }
+      });
+    }
+  }
 
-    if (crc != stored_crc) break;
+  // Recycled only once the MANIFEST no longer lists them.
+  std::vector<uint64_t> dropped;
+  uint64_t replayed_bytes = 0;
+  uint64_t replayed_records = 0;
+  uint64_t skipped_bytes = 0;
+  std::size_t ci = 0;
+  for (std::size_t f = 0; f < logs.size(); ++f) {
+    const MappedLog& log = *logs[f];
+    Segment* seg = f < legacy_.size() ? nullptr : &live_[f - legacy_.size()];
+    const uint64_t floor_seq = seg != nullptr ? seg->floor_seq : 0;
+    max_seq = std::max(max_seq, floor_seq);
+    if (skipped[f]) {
+      skipped_bytes += seg->end;
+      continue;
+    }
 
-    // Apply to store WITHOUT re-logging.
-    /*if (h.type == static_cast<uint8_t>(Type::Put)) {
-       store.apply_put_no_log_unlocked(std::move(key), std::move(val));
-    } else {
-      store.apply_del_no_log_unlocked(key);
-    }*/
-  
-   if (h.type == static_cast<uint8_t>(Type::Put)) {
-     store.map_[std::move(key)] = std::move(val);
-     applied++;
-    } else {
-      store.map_.erase(key);
-     \
-      applied++;
-   }
+    // Stitch the chunk chains: a chunk's own chain is used when it starts
+    // where the valid prefix ends; otherwise that stretch is verified here.
+    uint64_t reached = 0;
+    bool more = true;
+    for (; ci < chunks.size() && chunks[ci].file == f; ++ci) {
+      ReplayChunk& c = chunks[ci];
+      if (!more || reached >= c.end) continue;
+      if (pool.empty()) {
+        verify_chunk(log, c);
+      } else {
+        std::unique_lock lock(verified_mu);
+        verified_cv.wait(lock, [&] { return verified[ci] != 0; });
+      }
+      uint64_t stop = 0;
+      bool complete = false;
+      if (c.start == reached) {
+        stop = c.stop;
+        complete = c.complete;
+      } else {
+        complete = verify_chain(log.base, reached, c.end, log.size, &stop);
+      }
+      const uint64_t applied = apply_records(log.base, reached, stop, floor_seq, store, max_seq,
+                                             skip_through, replayed_records);
+      more = complete && applied == stop;
+      reached = applied;
+    }
+    replayed_bytes += reached;
+    if (seg == nullptr) continue;
 
-    max_seq = std::max(max_seq, h.seq);
+    if (seg->end == 0) {
+      // The active segment of the last run ends at its last good record.
+      seg->end = reached;
+    } else if (reached != seg->end) {
+      // A sealed segment is damaged: recover to the point before it and
+      // drop the later segments, which would otherwise leave a hole.
+      const std::size_t i = f - legacy_.size();
+      std::cerr << "[wal] corrupt record in " << segment_path(seg->number) << " at offset "
+                << reached << "; dropping " << live_.size() - i - 1 << " later segment(s)\n";
+      seg->end = reached;
+      for (std::size_t j = i + 1; j < live_.size(); ++j) dropped.push_back(live_[j].number);
+      live_.resize(i + 1);
+      break;
+    }
+  }
+  cancel.store(true, std::memory_order_relaxed);
+  for (auto& t : pool) t.join();
+  logs.clear();
 
-    off_t off = ::lseek(fd_, 0, SEEK_CUR);
-    if (off < 0) break;
-    last_good = static_cast<uint64_t>(off);
+  const double secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  replay_stats_ = {replayed_bytes, replayed_records, secs};
+  if (replayed_bytes != 0) {
+    const double mb = static_cast<double>(replayed_bytes) / 1e6;
+    std::cerr << "[wal] replayed " << mb << " MB in " << secs * 1e3 << " ms ("
+              << (secs > 0 ? mb / secs : 0.0) << " MB/s, " << std::max(threads, 1u)
+              << " verify thread(s))\n";
+  }
+  if (skipped_bytes != 0) {
+    std::cerr << "[wal] skipped " << static_cast<double>(skipped_bytes) / 1e6
+              << " MB covered by the checkpoint (seq " << skip_through << ")\n";
   }
 
-  last_good_offset_ = last_good;
+  // Segments that ended up empty (restarts without writes) hold nothing.
+  std::vector<Segment> kept;
+  for (const Segment& seg : live_) {
+    if (seg.end == 0) {
+      dropped.push_back(seg.number);
+    } else {
+      kept.push_back(seg);
+    }
+  }
+  live_.swap(kept);
 
-  // ready for appends
-  ::lseek(fd_, 0, SEEK_END);
-  //std::cerr << "[replay] applied_count=" << applied << "\n";
+  // ready for appends: a fresh segment, never the tail of an old one
+  written_seq_ = std::max(max_seq, skip_through);
+  if (!roll_over_locked(written_seq_)) return false;
+  for (uint64_t number : dropped) release_file_locked(number);
   return true;
 }
 
-//repairs the WAL by cutting off corrupted or incomplete data
-bool Wal::truncate_to_last_good() {
-  if (fd_ < 0) return false;
-  return ::ftruncate(fd_, static_cast<off_t>(last_good_offset_)) == 0;
+uint64_t Wal::apply_records(const char* base, uint64_t from, uint64_t to, uint64_t floor_seq,
+                            KVStore& store, uint64_t& max_seq, uint64_t skip_through,
+                            uint64_t& records) {
+  uint64_t off = from;
+  std::string unpacked;
+  while (off < to) {
+    WalHeader h{};
+    std::memcpy(&h, base + off, sizeof(h));
+    const bool is_batch = is_batch_type(h.type);
+    const std::string_view key(base + off + sizeof(h), is_batch ? 0 : h.key_len);
+    const std::string_view val(key.data() + key.size(), has_value_slot(h.type) ? h.val_len : 0);
+
+    // Left in a recycled segment by its previous use.
+    if (h.seq <= floor_seq) break;
+
+    if (is_batch) {
+      // CRC covers the whole batch, so it is applied all or nothing.
+      std::string_view payload;
+      if (!batch_payload(h.type, val, unpacked, payload) || h.key_len == 0 ||
+          WriteBatch::count_in(payload) != h.key_len) {
+        break;
+      }
+      uint64_t s = h.seq;
+      if (h.seq + h.key_len - 1 > skip_through) {
+        ++records;
+        WriteBatch::for_each_in(payload, [&](WriteBatch::OpType op, std::string_view k,
+                                         std::string_view v) {
+          if (op == WriteBatch::OpType::Put) {
+            store.apply_put_no_log_unlocked(k, v, s++);
+          } else if (op == WriteBatch::OpType::PutRef) {
+            store.apply_put_no_log_unlocked(k, v, s++, ValueRec::kValueRef);
+          } else {
+            store.apply_del_no_log_unlocked(k, s++);
+          }
+        });
+      }
+      max_seq = std::max(max_seq, h.seq + h.key_len - 1);
+      off += record_size(h);
+      continue;
+    }
+
+    // Apply to store WITHOUT re-logging.
+    if (h.seq <= skip_through) {
+      // Already in an SSTable (LSM engine).
+    } else if (h.type == static_cast<uint8_t>(Type::Put)) {
+      store.apply_put_no_log_unlocked(key, val, h.seq);
+    } else if (h.type == static_cast<uint8_t>(Type::PutRef)) {
+      store.apply_put_no_log_unlocked(key, val, h.seq, ValueRec::kValueRef);
+    } else if (h.type == static_cast<uint8_t>(Type::PutTtl)) {
+      if (val.size() < kTtlPrefix) break;
+      uint64_t expires_at = 0;
+      std::memcpy(&expires_at, val.data(), sizeof(expires_at));
+      const uint32_t flags = val[8] != 0 ? ValueRec::kValueRef : 0;
+      store.apply_put_no_log_unlocked(key, val.substr(kTtlPrefix), h.seq, flags, expires_at);
+    } else {
+      store.apply_del_no_log_unlocked(key, h.seq);
+    }
+    if (h.seq > skip_through) ++records;
+
+    if (h.seq > max_seq) max_seq = h.seq;  // h is packed: no reference to h.seq
+    off += record_size(h);
+  }
+  return off;
 }
 
-//safely closes the WAL file descriptor
+//safely closes the active segment (flush first: queued records would
+//otherwise fail and be retried)
 void Wal::close() {
+  std::lock_guard io(io_mu_);
+  ready_.store(false, std::memory_order_release);
   if (fd_ >= 0) { ::close(fd_); fd_ = -1; }
 }
 
 // Method returns true if all writes return true
 bool Wal::flush() {
-  if (fd_ < 0) return false;
-  if (buffer_.empty()) return true;
-
-  for (const auto& rec : buffer_) {
-    const char* p = rec.data();
-    size_t n = rec.size();
-    while (n > 0) {
-      ssize_t w = ::write(fd_, p, n);
-      if (w < 0) return false;
-      p += static_cast<size_t>(w);
-      n -= static_cast<size_t>(w);
-    }
+  uint64_t lsn = 0;
+  {
+    std::lock_guard lock(mu_);
+    lsn = appended_.load(std::memory_order_relaxed);
+    if (durable_ >= lsn) return true;
+    flush_requested_ = true;
   }
-
-  // macOS: use fsync (fdatasync is not available)
-  if (::fsync(fd_) != 0) return false;
-
-  buffer_.clear();
-  return true;
+  work_cv_.notify_one();
+  return wait_durable(lsn);
 }
 
 } // namespace kv
@@ -0,0 +1,50 @@
+#include "kv/write_batch.h"
+
+namespace kv {
+
+void WriteBatch::append(OpType type, std::string_view key, std::string_view value) {
+  const uint32_t klen = static_cast<uint32_t>(key.size());
+  const uint32_t vlen = static_cast<uint32_t>(value.size());
+
+  const std::size_t at = rep_.size();
+  rep_.resize(at + kOpHeader + key.size() + value.size());
+  char* p = rep_.data() + at;
+  *p = static_cast<char>(type);
+  std::memcpy(p + 1, &klen, sizeof(klen));
+  std::memcpy(p + 5, &vlen, sizeof(vlen));
+  p += kOpHeader;
+  if (!key.empty()) std::memcpy(p, key.data(), key.size());
+  if (!value.empty()) std::memcpy(p + key.size(), value.data(), value.size());
+  ++count_;
+}
+
+bool WriteBatch::validate(std::string_view rep) {
+  std::size_t pos = 0;
+  while (pos < rep.size()) {
+    if (rep.size() - pos < kOpHeader) return false;
+    const auto type = static_cast<uint8_t>(rep[pos]);
+    if (type != static_cast<uint8_t>(OpType::Put) &&
+        type != static_cast<uint8_t>(OpType::Del) &&
+        type != static_cast<uint8_t>(OpType::PutRef)) {
+      return false;
+    }
+    uint32_t klen = 0;
+    uint32_t vlen = 0;
+    std::memcpy(&klen, rep.data() + pos + 1, sizeof(klen));
+    std::memcpy(&vlen, rep.data() + pos + 5, sizeof(vlen));
+    pos += kOpHeader;
+    if (rep.size() - pos < static_cast<std::size_t>(klen) + vlen) return false;
+    pos += static_cast<std::size_t>(klen) + vlen;
+  }
+  return true;
+}
+
+uint32_t WriteBatch::count_in(std::string_view rep) {
+  uint32_t n = 0;
+  if (!for_each_in(rep, [&](OpType, std::string_view, std::string_view) { ++n; })) {
+    return 0;
+  }
+  return n;
+}
+
+}  // namespace kv